@@ -36,12 +36,36 @@ enum Parameter {
 
 enum Operator { eq, neq, lt, gt, l, g, OP_NUM_ITEMS };
 
+// how a value is compared, chosen once when the value is parsed
+enum Compare {
+	CMP_STR, // string compare
+	CMP_INT, // integer compare with ival, string compare if the sysfs value is not convertable
+	CMP_NONE // never matches, example: intfcount with a value that is not convertable
+};
+
 // structure for parameters, example bInterfaceNumber==01
+// the layout is part of the ABI: ival and cmp were added with soname 2, other changes need a new soname
 struct Data {
 	bool anyChild; // if true parse parameter for the devices interfaces, too. example match bInterfaceProtocol==1 for all devices interfaces (the parameter is only at intf 0, so it would returned at intf 1 as well)
 	enum Parameter param;
 	enum Operator op;
 	const char* val;
+	int ival; // val converted from hex, -1 if not convertable
+	enum Compare cmp;
+};
+
+#define PARAM_BIT(param) (UINT32_C(1) << (param))
+#define PARAM_BITS_SYSFS (((PARAM_BIT(PARAM_NUM_ITEMS) - 1) & ~PARAM_BIT(INVALID)) & ~(PARAM_BIT(intfcount) | PARAM_BIT(devcount)))
+
+#define SNAPSHOT_BUF_LEN 1024
+#define SNAPSHOT_NONE UINT16_MAX
+
+// values of all sysfs parameters of an interface and its device, read once for an evaluation
+struct Snapshot {
+	int val[PARAM_NUM_ITEMS]; // value converted from hex, -1 if not available or not convertable
+	uint16_t off[PARAM_NUM_ITEMS]; // offset of the string value within buf, SNAPSHOT_NONE if not available
+	uint16_t len; // used length of buf
+	char buf[SNAPSHOT_BUF_LEN];
 };
 
 enum Type { COMMENT, DENY, ALLOW, COND };
@@ -69,6 +93,7 @@ struct match_ret {
 struct auth_ret {
 	bool match:1;
 	bool allowed:1;
+	int rule; // index of the deciding rule, -1 if no rule has matched
 };
 
 #endif /* GENERIC_H_ */
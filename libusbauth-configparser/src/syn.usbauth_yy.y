@@ -19,69 +19,168 @@
  */
 
 %define api.prefix {usbauth_yy}
+%define api.pure full
+%lex-param {yyscan_t scanner}
+%parse-param {yyscan_t scanner} {struct usbauth_parse *p}
 
-%{
+%code requires {
+#include "usbauth-parse.h"
+}
+
+%code {
 
 #include "generic.h"
 #include "usbauth-configparser.h"
+#include "usbauth-arena.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-int yylex();
-int yyerror(const char*msg);
-void allocate_copy_yytext(char **dest);
+// provided by the reentrant flex scanner
+int usbauth_yylex(USBAUTH_YYSTYPE *lval, yyscan_t scanner);
+int usbauth_yylex_init_extra(struct usbauth_parse *extra, yyscan_t *scanner);
+int usbauth_yylex_destroy(yyscan_t scanner);
+void usbauth_yyset_in(FILE *in, yyscan_t scanner);
+char* usbauth_yyget_text(yyscan_t scanner);
 
-extern char* usbauth_yytext;
+int yyerror(yyscan_t scanner, struct usbauth_parse *p, const char*msg);
 
-extern struct Auth *gen_auths;
-extern unsigned gen_length;
+int yyerror (yyscan_t scanner, struct usbauth_parse *p, const char*msg) {
+	printf("error %s\n", msg);
+	return 0;
+}
 
-static struct Data **data_array = NULL;
-static unsigned *data_array_length = NULL;
-static struct Data *data_ptr = NULL;
+static const char* intern_yytext(yyscan_t scanner, struct usbauth_parse *p) {
+	const char *text = usbauth_yyget_text(scanner);
+	return usbauth_arena_intern(p->arena, text, strlen(text));
+}
 
-static char *paramStr = NULL;
-static char *opStr = NULL;
-static char *valStr = NULL;
-static bool anychild = false;
-static int tmpType = INVALID;
+static bool grow(void **arr, unsigned *cap, unsigned len, size_t size) {
+	unsigned new_cap = *cap ? *cap * 2 : 64;
+	void *new_arr = NULL;
 
-int yyerror (const char*msg) {
-	printf("error %s\n", msg);
-	return 0;
+	if (len < *cap)
+		return true;
+
+	new_arr = realloc(*arr, new_cap * size);
+	if (!new_arr)
+		return false;
+
+	*arr = new_arr;
+	*cap = new_cap;
+
+	return true;
 }
 
-void allocate_copy_yytext(char **dest) {
-	int len = strlen(usbauth_yytext);
-	*dest = (char*) calloc(len+1, sizeof(char));
-	strncpy(*dest, usbauth_yytext, len);
-	(*dest)[len] = 0;
+// begin a new rule, it is counted when its line is complete
+static bool begin_auth(struct usbauth_parse *p) {
+	unsigned cap = p->auth_cap; // auth_vec and pos_vec have the same capacity
+
+	if (!grow((void**) &p->auth_vec, &cap, p->auth_len, sizeof(struct Auth)))
+		return false;
+
+	if (!grow((void**) &p->pos_vec, &p->auth_cap, p->auth_len, sizeof(struct rule_pos)))
+		return false;
+
+	memset(&p->auth_vec[p->auth_len], 0, sizeof(struct Auth));
+	memset(&p->pos_vec[p->auth_len], 0, sizeof(struct rule_pos));
+
+	return true;
+}
+
+// the data of a rule's attributes or conditions is stored contiguous, starting at index data_len
+static void begin_data(struct usbauth_parse *p, unsigned *length, unsigned *idx) {
+	p->data_array_length = length;
+	*idx = p->data_len;
+}
+
+static struct Data* add_data(struct usbauth_parse *p) {
+	struct Data *d = NULL;
+
+	if (!grow((void**) &p->data_vec, &p->data_cap, p->data_len, sizeof(struct Data)))
+		return NULL;
+
+	d = &p->data_vec[p->data_len++];
+	memset(d, 0, sizeof(struct Data));
+	(*p->data_array_length)++;
+
+	return d;
 }
 
-void process(unsigned *counter, void **arr, bool data) {
-	unsigned size;
-	
-	if(data)
-		size = sizeof(struct Data);
-	else
-		size = sizeof(struct Auth);
-	
-	if(!*arr)
-		*arr = (void*) malloc((*counter+1) * size);
-	else {
-		*arr = (void*) realloc(*arr, (*counter+1) * size);
+static void add_data_str(struct usbauth_parse *p, const char *valStr, bool *ok) {
+	struct Data *d = add_data(p);
+
+	*ok = d && valStr;
+
+	if (*ok) {
+		usbauth_convert_str_to_data(d, p->paramStr, p->opStr, valStr);
+		d->anyChild = p->anychild;
 	}
-	uint8_t *ptr = (uint8_t*) *arr + *counter * size;
-	memset(ptr, 0, size);
-	
-	if(data) {
-		data_ptr = (struct Data*) ptr;
-		(*counter)++;
+}
+
+// move the complete rules with their data into one arena block
+static bool parse_end(struct usbauth_parse *p, struct Auth **auths, unsigned *length) {
+	struct Data *data = NULL;
+	unsigned i;
+
+	*auths = NULL;
+	*length = 0;
+
+	if (!p->auth_len)
+		return true;
+
+	*auths = usbauth_arena_alloc(p->arena, p->auth_len * sizeof(struct Auth) + p->data_len * sizeof(struct Data));
+	if (!*auths)
+		return false;
+
+	data = (struct Data*) (*auths + p->auth_len);
+	memcpy(*auths, p->auth_vec, p->auth_len * sizeof(struct Auth));
+	if (p->data_len)
+		memcpy(data, p->data_vec, p->data_len * sizeof(struct Data));
+
+	for (i = 0; i < p->auth_len; i++) {
+		(*auths)[i].attr_array = (*auths)[i].attr_len ? &data[p->pos_vec[i].attr_idx] : NULL;
+		(*auths)[i].cond_array = (*auths)[i].cond_len ? &data[p->pos_vec[i].cond_idx] : NULL;
 	}
+
+	*length = p->auth_len;
+
+	return true;
 }
 
-%}
+int usbauth_parse_stream(FILE *in, struct usbauth_arena *arena, struct Auth **auths, unsigned *length) {
+	struct usbauth_parse p;
+	yyscan_t scanner = NULL;
+	int ret = -1;
+
+	memset(&p, 0, sizeof(p));
+	p.arena = arena;
+	p.tmpType = INVALID;
+
+	*auths = NULL;
+	*length = 0;
+
+	if (usbauth_yylex_init_extra(&p, &scanner))
+		return -1;
+
+	usbauth_yyset_in(in, scanner);
+
+	if (usbauth_yyparse(scanner, &p) == 0)
+		ret = 0;
+
+	// the rules that are complete are kept at an error as well
+	if (!parse_end(&p, auths, length))
+		ret = -1;
+
+	usbauth_yylex_destroy(scanner);
+	free(p.auth_vec);
+	free(p.pos_vec);
+	free(p.data_vec);
+
+	return ret;
+}
+
+}
 
 %token t_allow t_deny t_condition t_all t_case t_anyChild t_name t_op t_val t_nl t_eof t_comment 
 
@@ -89,16 +188,16 @@ void process(unsigned *counter, void **arr, bool data) {
 S: FILE { return 0; }
 FILE: LINE | FILE LINE
 NLA: t_nl | NLA t_nl
-LINE: { process(&gen_length, (void**)&gen_auths, false); } RULE NLA { gen_auths[gen_length].type = tmpType; gen_length++; tmpType = INVALID; }
-RULE: COMMENT {tmpType = COMMENT; } | GENERIC | AUTH | COND
-COMMENT: t_comment { allocate_copy_yytext((char**)&(gen_auths[gen_length].comment)); }
+LINE: { if (!begin_auth(p)) YYABORT; } RULE NLA { p->auth_vec[p->auth_len].type = p->tmpType; p->auth_len++; p->tmpType = INVALID; }
+RULE: COMMENT {p->tmpType = COMMENT; } | GENERIC | AUTH | COND
+COMMENT: t_comment { p->auth_vec[p->auth_len].comment = intern_yytext(scanner, p); }
 COMMENT_add: EMPTY | COMMENT
 GENERIC: AUTH_KEYWORD t_all COMMENT_add
-AUTH: AUTH_KEYWORD { data_array_length = &(gen_auths[gen_length].attr_len); data_array = &(gen_auths[gen_length].attr_array); } DATA_mult COMMENT_add
-AUTH_KEYWORD: t_allow {tmpType = ALLOW; } | t_deny {tmpType = DENY; }
-COND: t_condition { tmpType = COND; data_array_length = &(gen_auths[gen_length].cond_len); data_array = &(gen_auths[gen_length].cond_array); } DATA_mult t_case { data_array_length = &(gen_auths[gen_length].attr_len); data_array = &(gen_auths[gen_length].attr_array); } DATA_mult COMMENT_add
-DATA: ANYCHILD_add t_name {allocate_copy_yytext(&paramStr); } t_op {allocate_copy_yytext(&opStr); } t_val {allocate_copy_yytext(&valStr); process(data_array_length, (void**)data_array, true); usbauth_convert_str_to_data(data_ptr, paramStr, opStr, valStr); data_ptr->anyChild = anychild; }
+AUTH: AUTH_KEYWORD { begin_data(p, &p->auth_vec[p->auth_len].attr_len, &p->pos_vec[p->auth_len].attr_idx); } DATA_mult COMMENT_add
+AUTH_KEYWORD: t_allow {p->tmpType = ALLOW; } | t_deny {p->tmpType = DENY; }
+COND: t_condition { p->tmpType = COND; begin_data(p, &p->auth_vec[p->auth_len].cond_len, &p->pos_vec[p->auth_len].cond_idx); } DATA_mult t_case { begin_data(p, &p->auth_vec[p->auth_len].attr_len, &p->pos_vec[p->auth_len].attr_idx); } DATA_mult COMMENT_add
+DATA: ANYCHILD_add t_name {p->paramStr = intern_yytext(scanner, p); } t_op {p->opStr = intern_yytext(scanner, p); } t_val {bool ok = false; add_data_str(p, intern_yytext(scanner, p), &ok); if (!ok) YYABORT; }
 DATA_mult: DATA | DATA_mult DATA
-ANYCHILD_add: EMPTY {anychild = false; } | t_anyChild {anychild = true; }
+ANYCHILD_add: EMPTY {p->anychild = false; } | t_anyChild {p->anychild = true; }
 EMPTY: 
 %%
@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2018 Stefan Koch <stefan.koch10@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2.1 of the GNU Lesser General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+
+/*
+ * Description : arena allocator for the parsed rules
+ */
+
+#include "usbauth-arena.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGN 16
+#define INTERN_MIN 256
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+};
+
+// the data of a chunk follows its header
+#define CHUNK_HEADER ((sizeof(struct arena_chunk) + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1))
+#define CHUNK_DATA(chunk) ((char*) (chunk) + CHUNK_HEADER)
+
+struct usbauth_arena {
+	struct arena_chunk *chunk; // current chunk, older chunks are linked by next
+	const char **intern; // hash table of the interned strings
+	size_t intern_len;
+	size_t intern_size;
+};
+
+// 64 bit FNV-1a hash
+static uint64_t hash_str(const char *str, size_t len) {
+	uint64_t hash = UINT64_C(14695981039346656037);
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (uint8_t) str[i];
+		hash *= UINT64_C(1099511628211);
+	}
+
+	return hash;
+}
+
+struct usbauth_arena* usbauth_arena_new() {
+	return calloc(1, sizeof(struct usbauth_arena));
+}
+
+static struct arena_chunk* add_chunk(struct usbauth_arena *arena, size_t size) {
+	struct arena_chunk *chunk = NULL;
+
+	if (size < CHUNK_SIZE)
+		size = CHUNK_SIZE;
+
+	chunk = malloc(CHUNK_HEADER + size);
+	if (!chunk)
+		return NULL;
+
+	chunk->next = arena->chunk;
+	chunk->size = size;
+	chunk->used = 0;
+	arena->chunk = chunk;
+
+	return chunk;
+}
+
+static void* alloc_aligned(struct usbauth_arena *arena, size_t size, size_t align) {
+	struct arena_chunk *chunk = arena->chunk;
+	size_t pos = 0;
+	void *ptr = NULL;
+
+	if (chunk)
+		pos = (chunk->used + align - 1) & ~(align - 1);
+
+	if (!chunk || pos > chunk->size || chunk->size - pos < size) {
+		chunk = add_chunk(arena, size);
+		pos = 0;
+	}
+
+	if (!chunk)
+		return NULL;
+
+	ptr = CHUNK_DATA(chunk) + pos;
+	chunk->used = pos + size;
+	memset(ptr, 0, size);
+
+	return ptr;
+}
+
+void* usbauth_arena_alloc(struct usbauth_arena *arena, size_t size) {
+	return alloc_aligned(arena, size, ARENA_ALIGN);
+}
+
+static bool intern_grow(struct usbauth_arena *arena) {
+	size_t size = arena->intern_size ? arena->intern_size * 2 : INTERN_MIN;
+	const char **table = calloc(size, sizeof(const char*));
+	size_t i;
+
+	if (!table)
+		return false;
+
+	for (i = 0; i < arena->intern_size; i++) {
+		const char *str = arena->intern[i];
+		size_t pos;
+
+		if (!str)
+			continue;
+
+		pos = hash_str(str, strlen(str)) & (size - 1);
+		while (table[pos])
+			pos = (pos + 1) & (size - 1);
+
+		table[pos] = str;
+	}
+
+	free(arena->intern);
+	arena->intern = table;
+	arena->intern_size = size;
+
+	return true;
+}
+
+const char* usbauth_arena_intern(struct usbauth_arena *arena, const char *str, size_t len) {
+	char *copy = NULL;
+	size_t pos;
+
+	// keep the hash table at most half full
+	if (arena->intern_len * 2 >= arena->intern_size && !intern_grow(arena))
+		return NULL;
+
+	pos = hash_str(str, len) & (arena->intern_size - 1);
+	while (arena->intern[pos]) {
+		const char *cur = arena->intern[pos];
+
+		if (strncmp(cur, str, len) == 0 && cur[len] == 0)
+			return cur;
+
+		pos = (pos + 1) & (arena->intern_size - 1);
+	}
+
+	// strings need no alignment
+	copy = alloc_aligned(arena, len + 1, 1);
+	if (!copy)
+		return NULL;
+
+	memcpy(copy, str, len);
+	arena->intern[pos] = copy;
+	arena->intern_len++;
+
+	return copy;
+}
+
+void usbauth_arena_free(struct usbauth_arena *arena) {
+	struct arena_chunk *chunk = NULL;
+
+	if (!arena)
+		return;
+
+	chunk = arena->chunk;
+	while (chunk) {
+		struct arena_chunk *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+
+	free(arena->intern);
+	free(arena);
+}
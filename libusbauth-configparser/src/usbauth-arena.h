@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2018 Stefan Koch <stefan.koch10@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2.1 of the GNU Lesser General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+
+/*
+ * Description : arena allocator for the parsed rules
+ *
+ * Memory is taken from large chunks and all of it is freed at once.
+ * Strings are interned, so a value used by many rules is stored only once.
+ */
+
+#ifndef USBAUTH_ARENA_H_
+#define USBAUTH_ARENA_H_
+
+#include <stddef.h>
+
+struct usbauth_arena;
+
+/**
+ * create an empty arena
+ *
+ * Return: the arena, NULL at allocation failure
+ */
+struct usbauth_arena* usbauth_arena_new();
+
+/**
+ * allocate zeroed memory from the arena
+ *
+ * @arena: the arena
+ * @size: size in bytes
+ *
+ * Return: pointer to the memory, NULL at allocation failure
+ */
+void* usbauth_arena_alloc(struct usbauth_arena *arena, size_t size);
+
+/**
+ * store a string in the arena, an equal string is stored only once
+ *
+ * @arena: the arena
+ * @str: the string, does not need to be terminated
+ * @len: length of the string
+ *
+ * Return: terminated string owned by the arena, NULL at allocation failure
+ */
+const char* usbauth_arena_intern(struct usbauth_arena *arena, const char *str, size_t len);
+
+/**
+ * free the arena and all memory allocated from it
+ *
+ * @arena: the arena, could be NULL
+ */
+void usbauth_arena_free(struct usbauth_arena *arena);
+
+#endif /* USBAUTH_ARENA_H_ */
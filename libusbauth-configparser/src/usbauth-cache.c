@@ -0,0 +1,485 @@
+/*
+ * Copyright (c) 2018 Stefan Koch <stefan.koch10@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2.1 of the GNU Lesser General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+
+/*
+ * Description : compiled binary form of the parsed rules
+ */
+
+#include "usbauth-cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+
+#define CACHE_MAGIC "USBAUTHC"
+#define CACHE_VERSION 1
+#define CACHE_BYTE_ORDER 0x01020304
+#define CACHE_NONE UINT32_MAX
+
+// layout of the file: header, auth records, data records, string table
+struct cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order; // written in host byte order to detect a foreign file
+	uint64_t src_mtime_sec;
+	uint64_t src_mtime_nsec;
+	uint64_t src_size;
+	uint64_t src_hash;
+	uint32_t auth_len;
+	uint32_t data_len;
+	uint32_t str_len;
+	uint32_t reserved;
+};
+
+struct cache_auth {
+	uint32_t type;
+	uint32_t attr_idx; // index of the first attribute in the data records
+	uint32_t attr_len;
+	uint32_t cond_idx; // index of the first condition in the data records
+	uint32_t cond_len;
+	uint32_t comment; // offset in the string table, CACHE_NONE if there is no comment
+};
+
+struct cache_data {
+	uint8_t anyChild;
+	uint8_t param;
+	uint8_t op;
+	uint8_t cmp;
+	int32_t ival;
+	uint32_t val; // offset in the string table, CACHE_NONE if there is no value
+};
+
+// 64 bit FNV-1a hash
+static uint64_t hash_data(const char *data, size_t size) {
+	uint64_t hash = UINT64_C(14695981039346656037);
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		hash ^= (uint8_t) data[i];
+		hash *= UINT64_C(1099511628211);
+	}
+
+	return hash;
+}
+
+bool usbauth_cache_src_open(const char *path, struct cache_src *src) {
+	struct stat st;
+	void *map = MAP_FAILED;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	memset(src, 0, sizeof(*src));
+
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return false;
+
+	src->data = map;
+	src->size = st.st_size;
+	src->mtime_sec = st.st_mtim.tv_sec;
+	src->mtime_nsec = st.st_mtim.tv_nsec;
+	src->hash = hash_data(src->data, src->size);
+
+	return true;
+}
+
+void usbauth_cache_src_close(struct cache_src *src) {
+	if (src->data)
+		munmap((void*) src->data, src->size);
+
+	memset(src, 0, sizeof(*src));
+}
+
+static bool header_matches(const struct cache_header *hdr, const struct cache_src *src) {
+	if (memcmp(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic)) != 0)
+		return false;
+
+	if (hdr->version != CACHE_VERSION || hdr->byte_order != CACHE_BYTE_ORDER)
+		return false;
+
+	return hdr->src_mtime_sec == src->mtime_sec && hdr->src_mtime_nsec == src->mtime_nsec && hdr->src_size == src->size && hdr->src_hash == src->hash;
+}
+
+static bool map_cache(const char *path, const struct cache_src *src, struct cache_map *map) {
+	struct cache_header hdr;
+	struct stat st;
+	void *data = MAP_FAILED;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size >= (off_t) sizeof(hdr) && pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) && header_matches(&hdr, src))
+		data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	if (data == MAP_FAILED)
+		return false;
+
+	map->data = data;
+	map->size = st.st_size;
+
+	return true;
+}
+
+void usbauth_cache_unmap(struct cache_map *map) {
+	if (map->data)
+		munmap((void*) map->data, map->size);
+
+	memset(map, 0, sizeof(*map));
+}
+
+static bool str_valid(uint32_t off, uint32_t str_len) {
+	return off == CACHE_NONE || off < str_len;
+}
+
+static bool data_valid(const struct cache_data *rec, uint32_t str_len) {
+	return rec->param < PARAM_NUM_ITEMS && rec->op < OP_NUM_ITEMS && rec->cmp <= CMP_NONE && str_valid(rec->val, str_len);
+}
+
+static bool auth_valid(const struct cache_auth *rec, uint32_t data_len, uint32_t str_len) {
+	if (rec->type > COND || !str_valid(rec->comment, str_len))
+		return false;
+
+	if (rec->attr_idx > data_len || rec->attr_len > data_len - rec->attr_idx)
+		return false;
+
+	if (rec->cond_idx > data_len || rec->cond_len > data_len - rec->cond_idx)
+		return false;
+
+	return true;
+}
+
+static const char* get_str(const char *strs, uint32_t off) {
+	return off == CACHE_NONE ? NULL : strs + off;
+}
+
+static struct Auth* load_auths(const char *map, size_t map_len, unsigned *length) {
+	const struct cache_header *hdr = NULL;
+	const struct cache_auth *auth_recs = NULL;
+	const struct cache_data *data_recs = NULL;
+	const char *strs = NULL;
+	struct Auth *auths = NULL;
+	struct Data *data = NULL;
+	uint64_t expected = 0;
+	unsigned i;
+
+	hdr = (const struct cache_header*) map;
+	expected = sizeof(*hdr) + (uint64_t) hdr->auth_len * sizeof(*auth_recs) + (uint64_t) hdr->data_len * sizeof(*data_recs) + hdr->str_len;
+
+	if (!hdr->auth_len || expected != map_len)
+		return NULL;
+
+	auth_recs = (const struct cache_auth*) (map + sizeof(*hdr));
+	data_recs = (const struct cache_data*) (auth_recs + hdr->auth_len);
+	strs = (const char*) (data_recs + hdr->data_len);
+
+	// every offset within the string table ends with a terminated string
+	if (hdr->str_len && strs[hdr->str_len - 1] != 0)
+		return NULL;
+
+	for (i = 0; i < hdr->auth_len; i++) {
+		if (!auth_valid(&auth_recs[i], hdr->data_len, hdr->str_len))
+			return NULL;
+	}
+
+	for (i = 0; i < hdr->data_len; i++) {
+		if (!data_valid(&data_recs[i], hdr->str_len))
+			return NULL;
+	}
+
+	// the rules and their attributes are allocated as one block
+	auths = calloc(1, hdr->auth_len * sizeof(struct Auth) + hdr->data_len * sizeof(struct Data));
+	if (!auths)
+		return NULL;
+
+	data = (struct Data*) (auths + hdr->auth_len);
+
+	for (i = 0; i < hdr->data_len; i++) {
+		data[i].anyChild = data_recs[i].anyChild;
+		data[i].param = data_recs[i].param;
+		data[i].op = data_recs[i].op;
+		data[i].cmp = data_recs[i].cmp;
+		data[i].ival = data_recs[i].ival;
+		data[i].val = get_str(strs, data_recs[i].val);
+	}
+
+	for (i = 0; i < hdr->auth_len; i++) {
+		auths[i].type = auth_recs[i].type;
+		auths[i].attr_len = auth_recs[i].attr_len;
+		auths[i].attr_array = auth_recs[i].attr_len ? &data[auth_recs[i].attr_idx] : NULL;
+		auths[i].cond_len = auth_recs[i].cond_len;
+		auths[i].cond_array = auth_recs[i].cond_len ? &data[auth_recs[i].cond_idx] : NULL;
+		auths[i].comment = get_str(strs, auth_recs[i].comment);
+	}
+
+	*length = hdr->auth_len;
+	return auths;
+}
+
+struct Auth* usbauth_cache_load(const char *path, const struct cache_src *src, unsigned *length, struct cache_map *map) {
+	struct Auth *auths = NULL;
+
+	memset(map, 0, sizeof(*map));
+
+	if (!map_cache(path, src, map))
+		return NULL;
+
+	auths = load_auths(map->data, map->size, length);
+
+	// the strings of the rules point into the mapping, so it is kept as long as the rules
+	if (!auths)
+		usbauth_cache_unmap(map);
+
+	return auths;
+}
+
+static uint32_t put_str(char *strs, uint32_t *str_len, const char *str) {
+	uint32_t off = *str_len;
+
+	if (!str)
+		return CACHE_NONE;
+
+	strcpy(strs + off, str);
+	*str_len += strlen(str) + 1;
+
+	return off;
+}
+
+static void put_data(struct cache_data *rec, const struct Data *d, char *strs, uint32_t *str_len) {
+	rec->anyChild = d->anyChild;
+	rec->param = d->param;
+	rec->op = d->op;
+	rec->cmp = d->cmp;
+	rec->ival = d->ival;
+	rec->val = put_str(strs, str_len, d->val);
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+	while (len) {
+		ssize_t ret = write(fd, buf, len);
+
+		if (ret < 0)
+			return -1;
+
+		buf += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+static void make_parent_dir(const char *path) {
+	char *dir = strdup(path);
+	char *sep = dir ? strrchr(dir, '/') : NULL;
+
+	if (sep && sep != dir) {
+		*sep = 0;
+		mkdir(dir, 0755);
+	}
+
+	free(dir);
+}
+
+#define SELINUX_XATTR "security.selinux"
+
+// give the new file the SELinux label of the replaced file, ignored without SELinux
+static int copy_label(const char *path, int fd) {
+	char *label = NULL;
+	ssize_t len = getxattr(path, SELINUX_XATTR, NULL, 0);
+	int ret = 0;
+
+	if (len < 0)
+		return errno == ENOTSUP || errno == ENODATA ? 0 : -1;
+
+	label = malloc(len);
+	if (!label)
+		return -1;
+
+	len = getxattr(path, SELINUX_XATTR, label, len);
+	if (len < 0 || (fsetxattr(fd, SELINUX_XATTR, label, len, 0) != 0 && errno != ENOTSUP))
+		ret = -1;
+
+	free(label);
+
+	return ret;
+}
+
+// the owner, the permissions and the label of an existing file are kept
+static int copy_attributes(const char *path, int fd, mode_t mode) {
+	struct stat st;
+	struct stat tmp_st;
+
+	if (stat(path, &st) != 0)
+		return errno == ENOENT && fchmod(fd, mode) == 0 ? 0 : -1;
+
+	if (fstat(fd, &tmp_st) != 0)
+		return -1;
+
+	if ((st.st_uid != tmp_st.st_uid || st.st_gid != tmp_st.st_gid) && fchown(fd, st.st_uid, st.st_gid) != 0)
+		return -1;
+
+	if (fchmod(fd, st.st_mode & 07777) != 0)
+		return -1;
+
+	return copy_label(path, fd);
+}
+
+// the rename is only durable after its directory entry is synced
+static int sync_parent_dir(const char *path) {
+	char *copy = strdup(path);
+	int fd = copy ? open(dirname(copy), O_RDONLY | O_DIRECTORY | O_CLOEXEC) : -1;
+	int ret = fd >= 0 && fsync(fd) == 0 ? 0 : -1;
+
+	if (fd >= 0)
+		close(fd);
+
+	free(copy);
+
+	return ret;
+}
+
+int usbauth_write_atomic(const char *path, const char *buf, size_t len, mode_t mode) {
+	char real_path[PATH_MAX];
+	char *tmp_path = NULL;
+	int fd = -1;
+	int ret = -1;
+
+	// a symlink is kept, the file it points to is replaced
+	if (!realpath(path, real_path)) {
+		if (errno != ENOENT || strlen(path) >= sizeof(real_path))
+			return -1;
+
+		strcpy(real_path, path);
+	}
+
+	tmp_path = malloc(strlen(real_path) + sizeof(".XXXXXX"));
+	if (!tmp_path)
+		return -1;
+
+	strcpy(tmp_path, real_path);
+	strcat(tmp_path, ".XXXXXX");
+	fd = mkstemp(tmp_path);
+
+	if (fd < 0) {
+		free(tmp_path);
+		return -1;
+	}
+
+	if (copy_attributes(real_path, fd, mode) == 0 && write_all(fd, buf, len) == 0 && fsync(fd) == 0)
+		ret = 0;
+
+	if (close(fd) != 0)
+		ret = -1;
+
+	if (ret == 0 && rename(tmp_path, real_path) != 0)
+		ret = -1;
+
+	if (ret != 0)
+		unlink(tmp_path);
+	else
+		ret = sync_parent_dir(real_path);
+
+	free(tmp_path);
+
+	return ret;
+}
+
+int usbauth_cache_store(const char *path, const struct cache_src *src, const struct Auth *auths, unsigned length) {
+	struct cache_header *hdr = NULL;
+	struct cache_auth *auth_recs = NULL;
+	struct cache_data *data_recs = NULL;
+	char *buf = NULL;
+	char *strs = NULL;
+	size_t size = 0;
+	size_t strs_size = 0;
+	uint32_t data_len = 0;
+	uint32_t data_idx = 0;
+	uint32_t str_len = 0;
+	unsigned i, j;
+	int ret = -1;
+
+	if (!auths || !length)
+		return -1;
+
+	for (i = 0; i < length; i++) {
+		data_len += auths[i].attr_len + auths[i].cond_len;
+
+		if (auths[i].comment)
+			strs_size += strlen(auths[i].comment) + 1;
+
+		for (j = 0; j < auths[i].attr_len; j++)
+			strs_size += auths[i].attr_array[j].val ? strlen(auths[i].attr_array[j].val) + 1 : 0;
+
+		for (j = 0; j < auths[i].cond_len; j++)
+			strs_size += auths[i].cond_array[j].val ? strlen(auths[i].cond_array[j].val) + 1 : 0;
+	}
+
+	size = sizeof(*hdr) + length * sizeof(*auth_recs) + data_len * sizeof(*data_recs) + strs_size;
+	buf = calloc(1, size);
+
+	if (!buf)
+		return -1;
+
+	hdr = (struct cache_header*) buf;
+	auth_recs = (struct cache_auth*) (buf + sizeof(*hdr));
+	data_recs = (struct cache_data*) (auth_recs + length);
+	strs = (char*) (data_recs + data_len);
+
+	memcpy(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic));
+	hdr->version = CACHE_VERSION;
+	hdr->byte_order = CACHE_BYTE_ORDER;
+	hdr->src_mtime_sec = src->mtime_sec;
+	hdr->src_mtime_nsec = src->mtime_nsec;
+	hdr->src_size = src->size;
+	hdr->src_hash = src->hash;
+	hdr->auth_len = length;
+	hdr->data_len = data_len;
+	hdr->str_len = strs_size;
+
+	for (i = 0; i < length; i++) {
+		auth_recs[i].type = auths[i].type;
+		auth_recs[i].comment = put_str(strs, &str_len, auths[i].comment);
+
+		auth_recs[i].attr_idx = data_idx;
+		auth_recs[i].attr_len = auths[i].attr_len;
+		for (j = 0; j < auths[i].attr_len; j++)
+			put_data(&data_recs[data_idx++], &auths[i].attr_array[j], strs, &str_len);
+
+		auth_recs[i].cond_idx = data_idx;
+		auth_recs[i].cond_len = auths[i].cond_len;
+		for (j = 0; j < auths[i].cond_len; j++)
+			put_data(&data_recs[data_idx++], &auths[i].cond_array[j], strs, &str_len);
+	}
+
+	make_parent_dir(path);
+	ret = usbauth_write_atomic(path, buf, size, 0644);
+	free(buf);
+
+	return ret;
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2018 Stefan Koch <stefan.koch10@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2.1 of the GNU Lesser General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+
+/*
+ * Description : compiled binary form of the parsed rules
+ *
+ * The cache file stores the rules with offsets instead of pointers, so it is
+ * mapped read-only and used without parsing. It is only used if the modification
+ * time, size and content hash of the config file match the stored values.
+ */
+
+#ifndef USBAUTH_CACHE_H_
+#define USBAUTH_CACHE_H_
+
+#include "generic.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+// the config file mapped into memory, used to validate and to parse it
+struct cache_src {
+	const char *data;
+	size_t size;
+	uint64_t mtime_sec;
+	uint64_t mtime_nsec;
+	uint64_t hash;
+};
+
+// the mapped cache file that loaded rules point into
+struct cache_map {
+	const char *data;
+	size_t size;
+};
+
+/**
+ * map the config file and calculate its content hash
+ *
+ * @path: path of the config file
+ * @src: the config file information (out)
+ *
+ * Return: true at success, false if the file is not available or empty
+ */
+bool usbauth_cache_src_open(const char *path, struct cache_src *src);
+
+/**
+ * unmap a config file mapped with usbauth_cache_src_open
+ *
+ * @src: the config file information
+ */
+void usbauth_cache_src_close(struct cache_src *src);
+
+/**
+ * load the rules from a cache file
+ *
+ * The returned array and all its Data arrays are allocated as one block,
+ * so they must be freed with one call of free() on the array.
+ * The string values point into the mapped cache file,
+ * the mapping must be kept until the rules are freed and then unmapped with usbauth_cache_unmap.
+ *
+ * @path: path of the cache file
+ * @src: the config file that the cache must belong to
+ * @length: array length of the loaded rules (out)
+ * @map: the mapped cache file (out), not mapped if NULL is returned
+ *
+ * Return: the rules, NULL if the cache is not available, invalid or outdated
+ */
+struct Auth* usbauth_cache_load(const char *path, const struct cache_src *src, unsigned *length, struct cache_map *map);
+
+/**
+ * unmap a cache file mapped with usbauth_cache_load
+ *
+ * @map: the mapped cache file
+ */
+void usbauth_cache_unmap(struct cache_map *map);
+
+/**
+ * write the rules to a cache file
+ *
+ * The file is written to a temporary file and then renamed,
+ * so the cache file is never seen incomplete.
+ *
+ * @path: path of the cache file
+ * @src: the config file that the rules are parsed from
+ * @auths: the rules
+ * @length: array length of the rules
+ *
+ * Return: 0 at success, -1 at failure
+ */
+int usbauth_cache_store(const char *path, const struct cache_src *src, const struct Auth *auths, unsigned length);
+
+/**
+ * replace a file atomically
+ *
+ * The content is written to a temporary file in the same directory,
+ * synced to disk and then renamed over the file. The directory is synced after the rename.
+ * A symlink is resolved and the file it points to is replaced.
+ * The owner, the permissions and the SELinux label of an existing file are kept.
+ *
+ * @path: path of the file
+ * @buf: the new content
+ * @len: length of the content
+ * @mode: permissions of the file if it does not exist
+ *
+ * Return: 0 at success, -1 at failure
+ */
+int usbauth_write_atomic(const char *path, const char *buf, size_t len, mode_t mode);
+
+#endif /* USBAUTH_CACHE_H_ */
@@ -24,19 +24,41 @@
 
 #include "generic.h"
 #include "usbauth-configparser.h"
-#include "syn.usbauth_yy.h"
+#include "usbauth-cache.h"
+#include "usbauth-arena.h"
+#include "usbauth-parse.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
 #include <libudev.h>
 
 #define CONFIG_FILE "/etc/usbauth.conf"
+#define CACHE_FILE "/var/cache/usbauth/usbauth.conf.cache"
 
-unsigned gen_length;
-struct Auth *gen_auths;
+// immutable rules shared by reference counting, stored in one of three ways
+struct usbauth_policy {
+	atomic_uint refs;
+	uint64_t generation;
+	struct Auth *auths;
+	unsigned length;
+	struct usbauth_arena *arena; // if set, auths is parsed and allocated from this arena
+	struct cache_map map; // if mapped, auths is loaded from this cache file and allocated as one block
+};
 
-extern FILE *usbauth_yyin;
+// rules of a context
+struct usbauth_config_ctx {
+	struct usbauth_policy *policy; // NULL if there are no rules
+};
+
+// every new policy gets a new generation, in all contexts
+static atomic_uint_fast64_t policy_generation = 0;
+
+// context used by the usbauth_config_* functions without context parameter
+static struct usbauth_config_ctx gen_ctx;
 
 const char* parameter_strings[] = {"INVALID", "busnum", "devpath", "idVendor", "idProduct", "bDeviceClass", "bDeviceSubClass", "bDeviceProtocol", "bConfigurationValue", "bNumInterfaces", "bInterfaceNumber", "bInterfaceClass", "bInterfaceSubClass", "bInterfaceProtocol", "bNumEndpoints", "bcdDevice", "speed", "devnum", "serial", "manufacturer", "product", "connectType", "intfcount", "devcount", "PARAM_NUM_ITEMS"};
 const char* operator_strings[] = {"==", "!=", "<=", ">=", "<", ">", "OP_NUM_ITEMS"};
@@ -62,8 +84,256 @@ const char* usbauth_get_param_valStr(enum Parameter param, struct udev_device *u
 }
 
 int usbauth_get_param_val(enum Parameter param, struct udev_device *udevdev) {
+	return usbauth_str_to_val(usbauth_get_param_valStr(param, udevdev));
+}
+
+void usbauth_snapshot_clear(struct Snapshot *snap) {
+	unsigned i;
+	for (i = 0; i < PARAM_NUM_ITEMS; i++) {
+		snap->val[i] = -1;
+		snap->off[i] = SNAPSHOT_NONE;
+	}
+
+	snap->len = 0;
+}
+
+bool usbauth_snapshot_set(struct Snapshot *snap, enum Parameter param, const char *valStr) {
+	size_t len = 0;
+
+	if (param <= INVALID || param >= PARAM_NUM_ITEMS)
+		return false;
+
+	snap->val[param] = -1;
+	snap->off[param] = SNAPSHOT_NONE;
+
+	if (!valStr)
+		return true;
+
+	len = strlen(valStr) + 1;
+	if (len > SNAPSHOT_BUF_LEN - snap->len)
+		return false;
+
+	memcpy(snap->buf + snap->len, valStr, len);
+	snap->off[param] = snap->len;
+	snap->val[param] = usbauth_str_to_val(valStr);
+	snap->len += len;
+
+	return true;
+}
+
+bool usbauth_snapshot_fill(struct Snapshot *snap, struct udev_device *udevdev) {
+	bool ret = true;
+	unsigned i;
+
+	usbauth_snapshot_clear(snap);
+
+	for (i = INVALID + 1; i < PARAM_NUM_ITEMS; i++) {
+		if (i == intfcount || i == devcount) // not in sysfs
+			continue;
+
+		ret &= usbauth_snapshot_set(snap, i, usbauth_get_param_valStr(i, udevdev));
+	}
+
+	return ret;
+}
+
+// where a parameter is found in sysfs
+enum Source { SRC_NONE, SRC_INTF, SRC_DEV, SRC_INTF_UEVENT, SRC_DEV_UEVENT };
+
+struct sysfs_param {
+	enum Source src;
+	const char *attr;
+};
+
+static const struct sysfs_param sysfs_params[PARAM_NUM_ITEMS] = {
+	[busnum] = { SRC_DEV_UEVENT, NULL },
+	[devpath] = { SRC_DEV, "devpath" },
+	[idVendor] = { SRC_INTF_UEVENT, NULL },
+	[idProduct] = { SRC_INTF_UEVENT, NULL },
+	[bDeviceClass] = { SRC_INTF_UEVENT, NULL },
+	[bDeviceSubClass] = { SRC_INTF_UEVENT, NULL },
+	[bDeviceProtocol] = { SRC_INTF_UEVENT, NULL },
+	[bConfigurationValue] = { SRC_DEV, "bConfigurationValue" },
+	[bNumInterfaces] = { SRC_DEV, "bNumInterfaces" },
+	[bInterfaceNumber] = { SRC_INTF, "bInterfaceNumber" },
+	[bInterfaceClass] = { SRC_INTF_UEVENT, NULL },
+	[bInterfaceSubClass] = { SRC_INTF_UEVENT, NULL },
+	[bInterfaceProtocol] = { SRC_INTF_UEVENT, NULL },
+	[bNumEndpoints] = { SRC_INTF, "bNumEndpoints" },
+	[bcdDevice] = { SRC_INTF_UEVENT, NULL },
+	[speed] = { SRC_DEV, "speed" },
+	[devnum] = { SRC_DEV_UEVENT, NULL },
+	[serial] = { SRC_DEV, "serial" },
+	[manufacturer] = { SRC_DEV, "manufacturer" },
+	[product] = { SRC_DEV, "product" },
+	[connectType] = { SRC_DEV, "port/connect_type" },
+};
+
+// read a sysfs attribute without the trailing newline
+static bool read_attr(int dirfd, const char *name, char *buf, size_t size) {
+	ssize_t len = 0;
+	int fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return false;
+
+	len = read(fd, buf, size - 1);
+	close(fd);
+
+	if (len < 0)
+		return false;
+
+	while (len > 0 && buf[len - 1] == '\n')
+		len--;
+	buf[len] = 0;
+
+	return true;
+}
+
+// the uevent values are formatted like the sysfs attributes, example PRODUCT=46d/c52b/1211 to idVendor 046d
+static bool fill_uevent(struct Snapshot *snap, int dirfd, uint32_t params) {
+	bool ret = true;
+	char buf[1024];
+	char valStr[16];
+	char *line = NULL;
+	char *saveptr = NULL;
+
+	if (!read_attr(dirfd, "uevent", buf, sizeof(buf)))
+		return false;
+
+	for (line = strtok_r(buf, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr)) {
+		unsigned v1 = 0, v2 = 0, v3 = 0;
+		enum Parameter p1 = INVALID, p2 = INVALID, p3 = INVALID;
+		const char *fmt = "%02x";
+
+		if (sscanf(line, "PRODUCT=%x/%x/%x", &v1, &v2, &v3) == 3) {
+			p1 = idVendor; p2 = idProduct; p3 = bcdDevice;
+			fmt = "%04x";
+		} else if (sscanf(line, "TYPE=%u/%u/%u", &v1, &v2, &v3) == 3) {
+			p1 = bDeviceClass; p2 = bDeviceSubClass; p3 = bDeviceProtocol;
+		} else if (sscanf(line, "INTERFACE=%u/%u/%u", &v1, &v2, &v3) == 3) {
+			p1 = bInterfaceClass; p2 = bInterfaceSubClass; p3 = bInterfaceProtocol;
+		} else if (sscanf(line, "BUSNUM=%u", &v1) == 1) {
+			p1 = busnum;
+			fmt = "%u";
+		} else if (sscanf(line, "DEVNUM=%u", &v1) == 1) {
+			p1 = devnum;
+			fmt = "%u";
+		}
+
+		if (p1 != INVALID && (params & PARAM_BIT(p1))) {
+			snprintf(valStr, sizeof(valStr), fmt, v1);
+			ret &= usbauth_snapshot_set(snap, p1, valStr);
+		}
+
+		if (p2 != INVALID && (params & PARAM_BIT(p2))) {
+			snprintf(valStr, sizeof(valStr), fmt, v2);
+			ret &= usbauth_snapshot_set(snap, p2, valStr);
+		}
+
+		if (p3 != INVALID && (params & PARAM_BIT(p3))) {
+			snprintf(valStr, sizeof(valStr), fmt, v3);
+			ret &= usbauth_snapshot_set(snap, p3, valStr);
+		}
+	}
+
+	return ret;
+}
+
+bool usbauth_snapshot_fill_sysfs(struct Snapshot *snap, int intf_fd, int dev_fd, uint32_t params) {
+	bool ret = true;
+	uint32_t intf_uevent = 0;
+	uint32_t dev_uevent = 0;
+	char buf[256];
+	unsigned i;
+
+	usbauth_snapshot_clear(snap);
+
+	for (i = INVALID + 1; i < PARAM_NUM_ITEMS; i++) {
+		const struct sysfs_param *p = &sysfs_params[i];
+
+		if (!(params & PARAM_BIT(i)))
+			continue;
+
+		if (p->src == SRC_INTF_UEVENT)
+			intf_uevent |= PARAM_BIT(i);
+		else if (p->src == SRC_DEV_UEVENT)
+			dev_uevent |= PARAM_BIT(i);
+		else if (p->src == SRC_INTF && read_attr(intf_fd, p->attr, buf, sizeof(buf)))
+			ret &= usbauth_snapshot_set(snap, i, buf);
+		else if (p->src == SRC_DEV && read_attr(dev_fd, p->attr, buf, sizeof(buf)))
+			ret &= usbauth_snapshot_set(snap, i, buf);
+	}
+
+	// one read of the uevent file for all parameters found there
+	if (intf_uevent)
+		fill_uevent(snap, intf_fd, intf_uevent);
+
+	if (dev_uevent)
+		fill_uevent(snap, dev_fd, dev_uevent);
+
+	return ret;
+}
+
+bool usbauth_snapshot_fill_syspath(struct Snapshot *snap, const char *syspath, uint32_t params) {
+	bool ret = false;
+	int intf_fd = -1;
+	int dev_fd = -1;
+
+	if (!syspath)
+		return false;
+
+	intf_fd = open(syspath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (intf_fd >= 0)
+		dev_fd = openat(intf_fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	if (intf_fd >= 0 && dev_fd >= 0)
+		ret = usbauth_snapshot_fill_sysfs(snap, intf_fd, dev_fd, params);
+
+	if (dev_fd >= 0)
+		close(dev_fd);
+
+	if (intf_fd >= 0)
+		close(intf_fd);
+
+	return ret;
+}
+
+uint32_t usbauth_auths_params(const struct Auth *auths, unsigned length) {
+	uint32_t ret = 0;
+	unsigned i, j;
+
+	for (i = 0; i < length; i++) {
+		for (j = 0; j < auths[i].attr_len; j++) {
+			if (!auths[i].attr_array[j].anyChild)
+				ret |= PARAM_BIT(auths[i].attr_array[j].param);
+		}
+
+		for (j = 0; j < auths[i].cond_len; j++) {
+			if (!auths[i].cond_array[j].anyChild)
+				ret |= PARAM_BIT(auths[i].cond_array[j].param);
+		}
+	}
+
+	return ret & PARAM_BITS_SYSFS;
+}
+
+const char* usbauth_snapshot_get_valStr(const struct Snapshot *snap, enum Parameter param) {
+	if (param <= INVALID || param >= PARAM_NUM_ITEMS || snap->off[param] == SNAPSHOT_NONE)
+		return NULL;
+
+	return snap->buf + snap->off[param];
+}
+
+int usbauth_snapshot_get_val(const struct Snapshot *snap, enum Parameter param) {
+	if (param <= INVALID || param >= PARAM_NUM_ITEMS)
+		return -1;
+
+	return snap->val[param];
+}
+
+int usbauth_str_to_val(const char *valStr) {
 	int val = -1;
-	const char* valStr = usbauth_get_param_valStr(param, udevdev);
 	char* end = NULL;
 
 	if(valStr)
@@ -128,60 +398,110 @@ bool usbauth_convert_str_to_data(struct Data *d, const char *paramStr, const cha
 
 	d->val = valStr;
 
+	usbauth_data_parse_val(d);
+
 	return ret;
 }
 
-const char* usbauth_auth_to_str(const struct Auth *auth) {
-	const unsigned str_len = 512;
-	char *str = calloc(str_len + 1, sizeof(char));
-	char *v = calloc(str_len + 1, sizeof(char));
+void usbauth_data_parse_val(struct Data *d) {
+	d->ival = usbauth_str_to_val(d->val);
+
+	if (d->ival != -1)
+		d->cmp = CMP_INT;
+	else if (d->param == intfcount || d->param == devcount) // counters are compared only as integer
+		d->cmp = CMP_NONE;
+	else
+		d->cmp = CMP_STR;
+}
+
+// growable string buffer, every append is done at the known end
+struct str_buf {
+	char *buf;
+	size_t len;
+	size_t cap;
+	bool failed; // an allocation has failed, the content is incomplete
+};
+
+static void buf_append(struct str_buf *sb, const char *str) {
+	size_t len = strlen(str);
+
+	if (sb->failed)
+		return;
+
+	if (sb->len + len + 1 > sb->cap) {
+		size_t cap = sb->cap ? sb->cap : 256;
+		char *buf = NULL;
+
+		while (sb->len + len + 1 > cap)
+			cap *= 2;
+
+		buf = realloc(sb->buf, cap);
+		if (!buf) {
+			sb->failed = true;
+			return;
+		}
+
+		sb->buf = buf;
+		sb->cap = cap;
+	}
+
+	memcpy(sb->buf + sb->len, str, len + 1);
+	sb->len += len;
+}
+
+static void buf_append_data(struct str_buf *sb, const struct Data *d, bool anyChild) {
+	buf_append(sb, " ");
+	if (anyChild && d->anyChild)
+		buf_append(sb, "anyChild ");
+	buf_append(sb, parameter_strings[d->param]);
+	buf_append(sb, operator_strings[d->op]);
+	buf_append(sb, d->val ? d->val : "(null)");
+}
 
-	strcpy(str, "");
-	strcpy(v, "");
+static void buf_append_auth(struct str_buf *sb, const struct Auth *auth) {
+	unsigned i;
 
 	if (auth->type == COND)
-		strncat(str, "condition", usbauth_sub_length(str_len, strlen(str)));
+		buf_append(sb, "condition");
 	else if (auth->type == ALLOW)
-		strncat(str, "allow", usbauth_sub_length(str_len, strlen(str)));
+		buf_append(sb, "allow");
 	else if (auth->type == DENY)
-		strncat(str, "deny", usbauth_sub_length(str_len, strlen(str)));
+		buf_append(sb, "deny");
 
-	struct Data* cond_array = auth->cond_array;
 	if (auth->type == COND) {
-		int k;
-		for (k = 0; k < auth->cond_len; k++) {
-			strncat(str, " ", usbauth_sub_length(str_len, strlen(str)));
-			strncat(str, parameter_strings[cond_array[k].param], usbauth_sub_length(str_len, strlen(str)));
-			strncat(str, operator_strings[cond_array[k].op], usbauth_sub_length(str_len, strlen(str)));
-			snprintf(v, str_len, "%s", cond_array[k].val);
-			strncat(str, v, usbauth_sub_length(str_len, strlen(str)));
-		}
+		for (i = 0; i < auth->cond_len; i++)
+			buf_append_data(sb, &auth->cond_array[i], false);
 
-		strncat(str, " case", usbauth_sub_length(str_len, strlen(str)));
+		buf_append(sb, " case");
 	}
 
-	struct Data* attr_array = auth->attr_array;
-	int j;
-	for (j = 0; j < auth->attr_len; j++) {
-		strncat(str, " ", usbauth_sub_length(str_len, strlen(str)));
-		strncat(str, attr_array[j].anyChild ? "anyChild " : "", usbauth_sub_length(str_len, strlen(str)));
-		strncat(str, parameter_strings[attr_array[j].param], usbauth_sub_length(str_len, strlen(str)));
-		strncat(str, operator_strings[attr_array[j].op], usbauth_sub_length(str_len, strlen(str)));
-		snprintf(v, str_len, "%s", attr_array[j].val);
-		strncat(str, v, usbauth_sub_length(str_len, strlen(str)));
-	}
+	for (i = 0; i < auth->attr_len; i++)
+		buf_append_data(sb, &auth->attr_array[i], true);
 
 	if ((auth->type == ALLOW || auth->type == DENY) && auth->attr_len == 0)
-		strncat(str, " all", usbauth_sub_length(str_len, strlen(str)));
+		buf_append(sb, " all");
 
 	if(auth->comment) {
 		if(auth->type != COMMENT)
-			strncat(str, " ", usbauth_sub_length(str_len, strlen(str)));
-		strncat(str, "#", usbauth_sub_length(str_len, strlen(str)));
-		strncat(str, auth->comment, usbauth_sub_length(str_len, strlen(str)));
+			buf_append(sb, " ");
+		buf_append(sb, "#");
+		buf_append(sb, auth->comment);
+	}
+}
+
+const char* usbauth_auth_to_str(const struct Auth *auth) {
+	struct str_buf sb = {NULL, 0, 0, false};
+
+	// an empty string is returned for a comment rule without comment
+	buf_append(&sb, "");
+	buf_append_auth(&sb, auth);
+
+	if (sb.failed) {
+		free(sb.buf);
+		return NULL;
 	}
 
-	return str;
+	return sb.buf;
 }
 
 unsigned usbauth_sub_length(unsigned base, unsigned val) {
@@ -191,6 +511,23 @@ unsigned usbauth_sub_length(unsigned base, unsigned val) {
 		return 0;
 }
 
+static struct Data* copy_data_array(const struct Data *source, unsigned length) {
+	struct Data *arr = NULL;
+	unsigned i;
+
+	if (length)
+		arr = calloc(length, sizeof(struct Data));
+
+	if (arr) {
+		memcpy(arr, source, length * sizeof(struct Data));
+
+		for (i = 0; i < length; i++)
+			arr[i].val = source[i].val ? strdup(source[i].val) : NULL;
+	}
+
+	return arr;
+}
+
 void usbauth_allocate_and_copy(struct Auth** destination, const struct Auth* source, unsigned length) {
 	struct Auth *arr = NULL;
 
@@ -198,31 +535,180 @@ void usbauth_allocate_and_copy(struct Auth** destination, const struct Auth* sou
 		arr = calloc(length, sizeof(struct Auth));
 
 	if (arr) {
+		unsigned i;
 		memcpy(arr, source, length * sizeof(struct Auth));
 
-		arr->attr_array = NULL;
-		if (arr->attr_len)
-			arr->attr_array = calloc(arr->attr_len, sizeof(struct Data));
-		if (arr->attr_array)
-			memcpy(arr->attr_array, source->attr_array, arr->attr_len * sizeof(struct Data));
-
-		arr->cond_array = NULL;
-		if (arr->cond_len)
-			arr->cond_array = calloc(arr->cond_len, sizeof(struct Data));
-		if (arr->cond_array)
-			memcpy(arr->cond_array, source->cond_array, arr->cond_len * sizeof(struct Data));
+		// the copy owns all its arrays and strings, the source could be freed at once with its arena
+		for (i = 0; i < length; i++) {
+			arr[i].attr_array = copy_data_array(source[i].attr_array, source[i].attr_len);
+			arr[i].cond_array = copy_data_array(source[i].cond_array, source[i].cond_len);
+			arr[i].comment = source[i].comment ? strdup(source[i].comment) : NULL;
+		}
 	}
 
 	*destination = arr;
 }
 
+static void policy_free(struct usbauth_policy *policy) {
+	if (policy->arena)
+		usbauth_arena_free(policy->arena);
+	else if (policy->map.data)
+		free(policy->auths);
+	else
+		usbauth_config_free_auths(policy->auths, policy->length);
+
+	// the loaded rules point into the mapping, it is unmapped after them
+	usbauth_cache_unmap(&policy->map);
+	free(policy);
+}
+
+const struct usbauth_policy* usbauth_policy_acquire(const struct usbauth_policy *policy) {
+	if (policy)
+		atomic_fetch_add(&((struct usbauth_policy*) policy)->refs, 1);
+
+	return policy;
+}
+
+void usbauth_policy_release(const struct usbauth_policy *policy) {
+	if (policy && atomic_fetch_sub(&((struct usbauth_policy*) policy)->refs, 1) == 1)
+		policy_free((struct usbauth_policy*) policy);
+}
+
+void usbauth_policy_get_auths(const struct usbauth_policy *policy, const struct Auth **auths, unsigned *length) {
+	*auths = policy ? policy->auths : NULL;
+	*length = policy ? policy->length : 0;
+}
+
+uint64_t usbauth_policy_generation(const struct usbauth_policy *policy) {
+	return policy ? policy->generation : 0;
+}
+
+// replace the rules of a context, the old rules are released
+static void ctx_set(struct usbauth_config_ctx *ctx, struct Auth *auths, unsigned length, struct usbauth_arena *arena, struct cache_map *map) {
+	struct usbauth_policy *policy = NULL;
+
+	if (auths || arena)
+		policy = calloc(1, sizeof(struct usbauth_policy));
+
+	if (policy) {
+		atomic_init(&policy->refs, 1);
+		policy->generation = atomic_fetch_add(&policy_generation, 1) + 1;
+		policy->auths = auths;
+		policy->length = length;
+		policy->arena = arena;
+		if (map)
+			policy->map = *map;
+	} else if (arena) {
+		usbauth_arena_free(arena);
+	} else if (map) {
+		free(auths);
+		usbauth_cache_unmap(map);
+	} else {
+		usbauth_config_free_auths(auths, length);
+	}
+
+	usbauth_policy_release(ctx->policy);
+	ctx->policy = policy;
+}
+
+struct usbauth_config_ctx* usbauth_config_ctx_new() {
+	return calloc(1, sizeof(struct usbauth_config_ctx));
+}
+
+void usbauth_config_ctx_free(struct usbauth_config_ctx *ctx) {
+	if (!ctx)
+		return;
+
+	ctx_set(ctx, NULL, 0, NULL, NULL);
+	free(ctx);
+}
+
+static int ctx_parse_stream(struct usbauth_config_ctx *ctx, FILE *in) {
+	struct usbauth_arena *arena = usbauth_arena_new();
+	struct Auth *auths = NULL;
+	unsigned length = 0;
+	int ret = -1;
+
+	if (!arena)
+		return -1;
+
+	ret = usbauth_parse_stream(in, arena, &auths, &length);
+	ctx_set(ctx, auths, length, arena, NULL);
+
+	return ret;
+}
+
+int usbauth_config_ctx_parse_buffer(struct usbauth_config_ctx *ctx, const char *buf, size_t len) {
+	FILE *in = NULL;
+	int ret = -1;
+
+	// an empty buffer has no rules, fmemopen does not accept it
+	if (!len) {
+		ctx_set(ctx, NULL, 0, NULL, NULL);
+		return 0;
+	}
+
+	in = fmemopen((void*) buf, len, "r");
+	if (!in)
+		return -1;
+
+	ret = ctx_parse_stream(ctx, in);
+	fclose(in);
+
+	return ret;
+}
+
+int usbauth_config_ctx_parse_fd(struct usbauth_config_ctx *ctx, int fd) {
+	FILE *in = NULL;
+	int dupfd = dup(fd);
+	int ret = -1;
+
+	// the stream is closed after parsing, the caller keeps its file descriptor
+	if (dupfd >= 0)
+		in = fdopen(dupfd, "r");
+
+	if (!in) {
+		if (dupfd >= 0)
+			close(dupfd);
+		return -1;
+	}
+
+	ret = ctx_parse_stream(ctx, in);
+	fclose(in);
+
+	return ret;
+}
+
+int usbauth_config_ctx_parse_path(struct usbauth_config_ctx *ctx, const char *path) {
+	FILE *in = fopen(path, "r");
+	int ret = -1;
+
+	if (!in)
+		return -1;
+
+	ret = ctx_parse_stream(ctx, in);
+	fclose(in);
+
+	return ret;
+}
+
+void usbauth_config_ctx_get_auths(const struct usbauth_config_ctx *ctx, const struct Auth **auths, unsigned *length) {
+	usbauth_policy_get_auths(ctx->policy, auths, length);
+}
+
+const struct usbauth_policy* usbauth_config_ctx_acquire_policy(const struct usbauth_config_ctx *ctx) {
+	return usbauth_policy_acquire(ctx->policy);
+}
+
+const struct usbauth_policy* usbauth_config_acquire_policy() {
+	return usbauth_config_ctx_acquire_policy(&gen_ctx);
+}
+
 int usbauth_config_free() {
 	int ret = -1;
 
-	if(gen_auths) {
-		usbauth_config_free_auths(gen_auths, gen_length);
-		gen_auths = NULL;
-		gen_length = 0;
+	if(gen_ctx.policy) {
+		ctx_set(&gen_ctx, NULL, 0, NULL, NULL);
 		ret = 0;
 	}
 
@@ -230,54 +716,107 @@ int usbauth_config_free() {
 }
 
 int usbauth_config_read() {
-	usbauth_yyin = fopen(CONFIG_FILE, "r");
+	struct cache_src src;
+	struct cache_map map;
+	struct Auth *cached = NULL;
+	unsigned cached_length = 0;
+	int ret = -1;
 
-	if(!usbauth_yyin)
-		return -1;
+	if (!usbauth_cache_src_open(CONFIG_FILE, &src))
+		return usbauth_config_ctx_parse_path(&gen_ctx, CONFIG_FILE);
 
-	usbauth_config_free();
+	cached = usbauth_cache_load(CACHE_FILE, &src, &cached_length, &map);
 
-	int ret = usbauth_yyparse();
+	if (cached) {
+		ctx_set(&gen_ctx, cached, cached_length, NULL, &map);
+		ret = 0;
+	} else {
+		// parse the mapped content, so the stored hash belongs to the parsed rules
+		ret = usbauth_config_ctx_parse_buffer(&gen_ctx, src.data, src.size);
+
+		// failing to write the cache is not an error, example: called as non-root user
+		if (!ret && gen_ctx.policy)
+			usbauth_cache_store(CACHE_FILE, &src, gen_ctx.policy->auths, gen_ctx.policy->length);
+	}
 
-	fclose(usbauth_yyin);
+	usbauth_cache_src_close(&src);
 
 	return ret;
 }
 
 int usbauth_config_write() {
-	FILE* fout = fopen(CONFIG_FILE, "w");
+	struct str_buf sb = {NULL, 0, 0, false};
+	const struct Auth *auths = NULL;
+	unsigned length = 0;
+	unsigned i;
+	int ret = -1;
 
-	if(!fout)
-		return -1;
+	usbauth_config_ctx_get_auths(&gen_ctx, &auths, &length);
 
-	int i = 0;
-	for (i = 0; i < gen_length; i++) {
-		const char *str = usbauth_auth_to_str(&gen_auths[i]);
-		fprintf(fout, "%s\n", str);
-		free((char*)str);
-		str = NULL;
+	// all rules are serialized into one buffer that replaces the config file at once
+	buf_append(&sb, "");
+	for (i = 0; i < length; i++) {
+		buf_append_auth(&sb, &auths[i]);
+		buf_append(&sb, "\n");
 	}
-	fclose(fout);
 
-	return 0;
+	if (!sb.failed)
+		ret = usbauth_write_atomic(CONFIG_FILE, sb.buf, sb.len, 0644);
+
+	free(sb.buf);
+
+	return ret;
+}
+
+static void free_data_array(struct Data *arr, unsigned length) {
+	unsigned i;
+
+	if (!arr)
+		return;
+
+	for (i = 0; i < length; i++)
+		free((char*) arr[i].val);
+
+	free(arr);
 }
 
 void usbauth_config_free_auths(struct Auth* auths, unsigned length) {
 	unsigned i;
+
+	if (!auths)
+		return;
+
 	for (i = 0; i < length; i++) {
-		free(auths[i].attr_array);
+		free_data_array(auths[i].attr_array, auths[i].attr_len);
+		free_data_array(auths[i].cond_array, auths[i].cond_len);
+		free((char*) auths[i].comment);
 	}
 	free(auths);
 }
 
 void usbauth_config_get_auths(struct Auth** auths, unsigned *length) {
+	const struct Auth *gen_auths = NULL;
+	unsigned gen_length = 0;
+
+	usbauth_config_ctx_get_auths(&gen_ctx, &gen_auths, &gen_length);
 	usbauth_allocate_and_copy(auths, gen_auths, gen_length);
-	*length = gen_length;
+	*length = *auths ? gen_length : 0;
 }
 
 void usbauth_config_set_auths(struct Auth* auths, unsigned length) {
-	usbauth_config_free_auths(gen_auths, gen_length);
-	usbauth_allocate_and_copy(&gen_auths, auths, length);
-	gen_length = length;
+	struct Auth *copy = NULL;
+	unsigned i, j;
+
+	usbauth_allocate_and_copy(&copy, auths, length);
+
+	// the caller could have changed the string values, the copy is immutable after it is set
+	for (i = 0; copy && i < length; i++) {
+		for (j = 0; j < copy[i].attr_len; j++)
+			usbauth_data_parse_val(&copy[i].attr_array[j]);
+		for (j = 0; j < copy[i].cond_len; j++)
+			usbauth_data_parse_val(&copy[i].cond_array[j]);
+	}
+
+	ctx_set(&gen_ctx, copy, copy ? length : 0, NULL, NULL);
 }
 
@@ -27,7 +27,11 @@
 
 #include "generic.h"
 
+#include <stddef.h>
+
 struct udev_device;
+struct usbauth_config_ctx;
+struct usbauth_policy;
 
 /**
  * get a sysfs usb device parameter as string
@@ -49,6 +53,102 @@ const char* usbauth_get_param_valStr(enum Parameter param, struct udev_device *u
  */
 int usbauth_get_param_val(enum Parameter param, struct udev_device *udevdev);
 
+/**
+ * remove all values from a snapshot
+ *
+ * @snap: snapshot (out)
+ */
+void usbauth_snapshot_clear(struct Snapshot *snap);
+
+/**
+ * set a parameter value of a snapshot
+ * the string is copied and converted to a value
+ *
+ * @snap: snapshot (in/out)
+ * @param: parameter as enum
+ * @valStr: value string, NULL if not available
+ *
+ * Return: true at success, false if there is no space left
+ */
+bool usbauth_snapshot_set(struct Snapshot *snap, enum Parameter param, const char *valStr);
+
+/**
+ * read all sysfs parameters of an interface and its device into a snapshot
+ * intfcount and devcount are not read because they are not in sysfs
+ *
+ * @snap: snapshot (out)
+ * @udevdev: device structure, usually an usb_interface
+ *
+ * Return: true at success, false if a value was not stored
+ */
+bool usbauth_snapshot_fill(struct Snapshot *snap, struct udev_device *udevdev);
+
+/**
+ * read sysfs parameters of an interface and its device into a snapshot
+ * without libudev, the uevent files are parsed and other attributes are read with openat
+ *
+ * @snap: snapshot (out)
+ * @intf_fd: directory fd of the usb_interface in sysfs
+ * @dev_fd: directory fd of the interface's usb_device in sysfs
+ * @params: parameters to read, PARAM_BIT of each parameter or PARAM_BITS_SYSFS for all
+ *
+ * Return: true at success, false if a value was not stored
+ */
+bool usbauth_snapshot_fill_sysfs(struct Snapshot *snap, int intf_fd, int dev_fd, uint32_t params);
+
+/**
+ * read sysfs parameters of an interface and its device into a snapshot
+ * opens the directories and calls usbauth_snapshot_fill_sysfs
+ *
+ * @snap: snapshot (out)
+ * @syspath: sysfs path of an usb_interface
+ * @params: parameters to read, PARAM_BIT of each parameter or PARAM_BITS_SYSFS for all
+ *
+ * Return: true at success, false if the directories are not accessible or a value was not stored
+ */
+bool usbauth_snapshot_fill_syspath(struct Snapshot *snap, const char *syspath, uint32_t params);
+
+/**
+ * get the parameters used by rules
+ * anyChild parameters are not included because they are read from the siblings
+ *
+ * @auths: auth rules
+ * @length: auth rules length
+ *
+ * Return: PARAM_BIT of each used parameter
+ */
+uint32_t usbauth_auths_params(const struct Auth *auths, unsigned length);
+
+/**
+ * get a parameter from a snapshot as string
+ *
+ * @snap: snapshot
+ * @param: parameter as enum
+ *
+ * Return: string, NULL if not available
+ */
+const char* usbauth_snapshot_get_valStr(const struct Snapshot *snap, enum Parameter param);
+
+/**
+ * get a parameter from a snapshot as value
+ *
+ * @snap: snapshot
+ * @param: parameter as enum
+ *
+ * Return: converted value, -1 at error (example: not convertable, not available)
+ */
+int usbauth_snapshot_get_val(const struct Snapshot *snap, enum Parameter param);
+
+/**
+ * convert a hex string to a value
+ * the whole string must be convertable
+ *
+ * @valStr: string to convert
+ *
+ * Return: converted value, -1 at error (example: not convertable, NULL)
+ */
+int usbauth_str_to_val(const char *valStr);
+
 /**
  * convert string to enum
  *
@@ -119,13 +219,21 @@ const char* usbauth_op_to_str(enum Operator op);
  */
 bool usbauth_convert_str_to_data(struct Data *d, const char *paramStr, const char* opStr, const char *valStr);
 
+/**
+ * set the integer value and the compare type of a Data structure from its string value
+ * called by usbauth_convert_str_to_data, must be called again if param or val are changed
+ *
+ * @d: pointer to Data entry (in/out)
+ */
+void usbauth_data_parse_val(struct Data *d);
+
 /**
  * make from an auth rule a string
  * used by usbauth_config_write
  *
  * @auth: auth rule
  *
- * Return: string representation of a rule, caller must free pointer self
+ * Return: string representation of a rule without length limit, NULL at allocation failure, caller must free pointer self
  */
 const char* usbauth_auth_to_str(const struct Auth *auth);
 
@@ -141,6 +249,7 @@ unsigned usbauth_sub_length(unsigned base, unsigned val);
 
 /**
  * copy auth rules from source to destination. Destination will allocated first.
+ * The copy owns its Data arrays and strings, it must be freed with usbauth_config_free_auths().
  *
  * @destination: pointer to save allocated pointer in it (out)
  * @source: pointer to source auth rules (in)
@@ -150,6 +259,127 @@ unsigned usbauth_sub_length(unsigned base, unsigned val);
  */
 void usbauth_allocate_and_copy(struct Auth** destination, const struct Auth* source, unsigned length);
 
+/**
+ * create a parser context
+ *
+ * Any number of contexts could be used at once, also from different threads.
+ *
+ * Return: the context without rules, NULL at allocation failure
+ */
+struct usbauth_config_ctx* usbauth_config_ctx_new();
+
+/**
+ * free a parser context and its rules
+ *
+ * @ctx: the context, could be NULL
+ */
+void usbauth_config_ctx_free(struct usbauth_config_ctx *ctx);
+
+/**
+ * parse rules from a file, the previous rules of the context are replaced
+ *
+ * The complete rules are kept at a parse error, too.
+ *
+ * @ctx: the context
+ * @path: path of the config file
+ *
+ * Return: 0 at success, -1 at failure
+ */
+int usbauth_config_ctx_parse_path(struct usbauth_config_ctx *ctx, const char *path);
+
+/**
+ * parse rules from a file descriptor, the previous rules of the context are replaced
+ *
+ * @ctx: the context
+ * @fd: file descriptor to read from, it is not closed
+ *
+ * Return: 0 at success, -1 at failure
+ */
+int usbauth_config_ctx_parse_fd(struct usbauth_config_ctx *ctx, int fd);
+
+/**
+ * parse rules from memory, the previous rules of the context are replaced
+ *
+ * @ctx: the context
+ * @buf: rules in config file syntax, does not need to be terminated
+ * @len: length of buf
+ *
+ * Return: 0 at success, -1 at failure
+ */
+int usbauth_config_ctx_parse_buffer(struct usbauth_config_ctx *ctx, const char *buf, size_t len);
+
+/**
+ * get the rules of a context without copying them
+ *
+ * note: the rules are owned by the context, they are valid until the context is freed or parses again
+ *
+ * @ctx: the context
+ * @auths: pointer to save rules array pointer in it (out)
+ * @length: pointer of unsigned value to save array length in it (out)
+ *
+ */
+void usbauth_config_ctx_get_auths(const struct usbauth_config_ctx *ctx, const struct Auth **auths, unsigned *length);
+
+/**
+ * get a reference to the current rules of a context
+ *
+ * The policy is immutable and stays valid until it is released,
+ * even if the context parses again or is freed.
+ * note: must not be called while the same context parses in another thread
+ *
+ * @ctx: the context
+ *
+ * Return: the policy, NULL if the context has no rules
+ */
+const struct usbauth_policy* usbauth_config_ctx_acquire_policy(const struct usbauth_config_ctx *ctx);
+
+/**
+ * get a reference to the rules read by usbauth_config_read() or set by usbauth_config_set_auths()
+ *
+ * Return: the policy, NULL if there are no rules
+ */
+const struct usbauth_policy* usbauth_config_acquire_policy();
+
+/**
+ * get an additional reference to a policy
+ *
+ * @policy: the policy, could be NULL
+ *
+ * Return: the policy
+ */
+const struct usbauth_policy* usbauth_policy_acquire(const struct usbauth_policy *policy);
+
+/**
+ * release a reference to a policy, the policy is freed with its last reference
+ *
+ * @policy: the policy, could be NULL
+ */
+void usbauth_policy_release(const struct usbauth_policy *policy);
+
+/**
+ * get the rules of a policy without copying them
+ *
+ * note: the rules must not be changed, they are valid while the policy is referenced
+ *
+ * @policy: the policy, could be NULL
+ * @auths: pointer to save rules array pointer in it (out)
+ * @length: pointer of unsigned value to save array length in it (out)
+ *
+ */
+void usbauth_policy_get_auths(const struct usbauth_policy *policy, const struct Auth **auths, unsigned *length);
+
+/**
+ * get the generation of a policy
+ *
+ * Every parsed, loaded or set policy gets a new generation,
+ * so a caller could keep data derived from a policy while the generation is unchanged.
+ *
+ * @policy: the policy, could be NULL
+ *
+ * Return: generation greater than 0, 0 for NULL
+ */
+uint64_t usbauth_policy_generation(const struct usbauth_policy *policy);
+
 /**
  * free allocated memory of auth structures
  *
@@ -160,17 +390,24 @@ int usbauth_config_free();
 /**
  * parse the config file with flex/bison parser
  *
+ * If the compiled cache in /var/cache/usbauth belongs to the current config file,
+ * the rules are loaded from it without parsing. Otherwise the cache is written after parsing.
+ *
  * Return: 0 at success, -1 at failure
  */
 int usbauth_config_read();
 
 /**
  * write the auth structures to config file
+ *
+ * The config file is replaced atomically, so a reader never sees a partially written file.
+ *
+ * Return: 0 at success, -1 at failure
  */
 int usbauth_config_write();
 
 /**
- * free memory from rules
+ * free memory from rules, including their Data arrays and strings
  *
  * @auths: pointer of pointer to save rules array pointer in it (out)
  * @length: pointer of unsigned value to save array length in it (out)
@@ -183,6 +420,7 @@ void usbauth_config_free_auths(struct Auth* auths, unsigned length);
  *
  * note: call usbauth_config_read() before to parse config file
  * otherwise the pointer is NULL and the length 0
+ * the rules are copied, use usbauth_config_acquire_policy() to share them without copying
  *
  * @auths: pointer of pointer to save rules array pointer in it (out)
  * @length: pointer of unsigned value to save array length in it (out)
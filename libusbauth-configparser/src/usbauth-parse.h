@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2018 Stefan Koch <stefan.koch10@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2.1 of the GNU Lesser General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+
+/*
+ * Description : state of one run of the reentrant flex/bison parser
+ */
+
+#ifndef USBAUTH_PARSE_H_
+#define USBAUTH_PARSE_H_
+
+#include "generic.h"
+#include "usbauth-arena.h"
+
+#include <stdio.h>
+
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void* yyscan_t;
+#endif
+
+// position of a rule's data in data_vec, the pointers are set when parsing is finished
+struct rule_pos {
+	unsigned attr_idx;
+	unsigned cond_idx;
+};
+
+// all state of a parser run, used as extra data of the scanner as well
+struct usbauth_parse {
+	struct usbauth_arena *arena;
+
+	// the arrays grow by doubling their capacity
+	struct Auth *auth_vec;
+	struct rule_pos *pos_vec; // same length and capacity as auth_vec
+	unsigned auth_len;
+	unsigned auth_cap;
+	struct Data *data_vec;
+	unsigned data_len;
+	unsigned data_cap;
+
+	unsigned *data_array_length;
+	const char *paramStr;
+	const char *opStr;
+	bool anychild;
+	int tmpType;
+	bool eof; // the scanner has returned the newline that ends the last line
+};
+
+/**
+ * parse rules from a stream
+ *
+ * The complete rules are kept at a parse error, too.
+ *
+ * @in: stream to parse
+ * @arena: arena to allocate the rules and strings from
+ * @auths: the parsed rules allocated from the arena (out)
+ * @length: array length of the parsed rules (out)
+ *
+ * Return: 0 at success, -1 at failure
+ */
+int usbauth_parse_stream(FILE *in, struct usbauth_arena *arena, struct Auth **auths, unsigned *length);
+
+#endif /* USBAUTH_PARSE_H_ */
@@ -28,9 +28,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <libudev.h>
+#include <unistd.h>
 #include <dbus/dbus.h>
-#include <pthread.h>
+#include <glib-unix.h>
 #include <signal.h>
 #include <libintl.h>
 #include <locale.h>
@@ -39,16 +39,17 @@
 #include <grp.h>
 
 #include <usbauth/generic.h>
-#include <usbauth/usbauth-configparser.h>
 
 #include "usbauth-notifier.h"
 
 #define NPRIV_PATH "/usr/bin/usbauth-npriv"
+#define AUTHORIZE_TIMEOUT 2000 // milliseconds to wait for the reply of usbauth
+#define SETTLE_MS 500 // interfaces of one device received within this time are shown in one notification
 
-static bool work = true;
-static struct udev *udev = NULL;
 static DBusConnection *bus = NULL;
 static GMainLoop *loop = NULL;
+static guint dispatch_id = 0; // idle source that dispatches the received messages
+static GHashTable *groups = NULL; // devices within their settle window, key is the device's syspath
 
 char *classArray[] = { "PER_INTERFACE", "AUDIO", "COMM", "HID", "", "PHYSICAL", "STILL_IMAGE", "PRINTER", "MASS_STORAGE", "HUB" };
 
@@ -164,6 +165,119 @@ const char* get_info_string(unsigned cl, unsigned subcl, unsigned iprot, bool re
 	return ret;
 }
 
+static gboolean dbus_watch_callback(gint fd, GIOCondition condition, gpointer user_data) {
+	DBusWatch *watch = user_data;
+	unsigned flags = 0;
+
+	if (condition & G_IO_IN)
+		flags |= DBUS_WATCH_READABLE;
+	if (condition & G_IO_OUT)
+		flags |= DBUS_WATCH_WRITABLE;
+	if (condition & G_IO_ERR)
+		flags |= DBUS_WATCH_ERROR;
+	if (condition & G_IO_HUP)
+		flags |= DBUS_WATCH_HANGUP;
+
+	dbus_watch_handle(watch, flags);
+
+	return G_SOURCE_CONTINUE;
+}
+
+// the id of the GLib source is stored as data of the watch or timeout
+static void dbus_watch_attach(DBusWatch *watch) {
+	unsigned flags = dbus_watch_get_flags(watch);
+	GIOCondition condition = G_IO_ERR | G_IO_HUP;
+	guint id = 0;
+
+	if (flags & DBUS_WATCH_READABLE)
+		condition |= G_IO_IN;
+	if (flags & DBUS_WATCH_WRITABLE)
+		condition |= G_IO_OUT;
+
+	id = g_unix_fd_add(dbus_watch_get_unix_fd(watch), condition, dbus_watch_callback, watch);
+	dbus_watch_set_data(watch, GUINT_TO_POINTER(id), NULL);
+}
+
+static void dbus_watch_detach(DBusWatch *watch, void *data) {
+	guint id = GPOINTER_TO_UINT(dbus_watch_get_data(watch));
+
+	if (id)
+		g_source_remove(id);
+
+	dbus_watch_set_data(watch, NULL, NULL);
+}
+
+static dbus_bool_t dbus_watch_add(DBusWatch *watch, void *data) {
+	if (dbus_watch_get_enabled(watch))
+		dbus_watch_attach(watch);
+
+	return TRUE;
+}
+
+static void dbus_watch_toggle(DBusWatch *watch, void *data) {
+	dbus_watch_detach(watch, data);
+	dbus_watch_add(watch, data);
+}
+
+static gboolean dbus_timeout_callback(gpointer user_data) {
+	dbus_timeout_handle(user_data);
+
+	return G_SOURCE_CONTINUE;
+}
+
+static void dbus_timeout_detach(DBusTimeout *timeout, void *data) {
+	guint id = GPOINTER_TO_UINT(dbus_timeout_get_data(timeout));
+
+	if (id)
+		g_source_remove(id);
+
+	dbus_timeout_set_data(timeout, NULL, NULL);
+}
+
+static dbus_bool_t dbus_timeout_add(DBusTimeout *timeout, void *data) {
+	guint id = 0;
+
+	if (dbus_timeout_get_enabled(timeout)) {
+		id = g_timeout_add(dbus_timeout_get_interval(timeout), dbus_timeout_callback, timeout);
+		dbus_timeout_set_data(timeout, GUINT_TO_POINTER(id), NULL);
+	}
+
+	return TRUE;
+}
+
+static void dbus_timeout_toggle(DBusTimeout *timeout, void *data) {
+	dbus_timeout_detach(timeout, data);
+	dbus_timeout_add(timeout, data);
+}
+
+static gboolean dbus_dispatch_callback(gpointer user_data) {
+	// messages are passed to dbus_message_filter
+	while (dbus_connection_dispatch(bus) == DBUS_DISPATCH_DATA_REMAINS);
+
+	dispatch_id = 0;
+
+	return G_SOURCE_REMOVE;
+}
+
+static void dbus_dispatch_status(DBusConnection *connection, DBusDispatchStatus status, void *data) {
+	if (status == DBUS_DISPATCH_DATA_REMAINS && !dispatch_id)
+		dispatch_id = g_idle_add(dbus_dispatch_callback, NULL);
+}
+
+static DBusHandlerResult dbus_message_filter(DBusConnection *connection, DBusMessage *msg, void *data) {
+	struct DevGroup *group = NULL;
+
+	if (!dbus_message_is_signal(msg, "org.opensuse.usbauth.Message", "device"))
+		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+	group = receive_dbus(msg);
+
+	if (group)
+		group_add(group); // the notification is created after the settle window
+
+	return DBUS_HANDLER_RESULT_HANDLED;
+}
+
 bool init_dbus() {
 	bool ret = true;
 	DBusError error;
@@ -179,10 +293,35 @@ bool init_dbus() {
 	dbus_bus_add_match(bus, "type='signal',interface='org.opensuse.usbauth.Message'", &error);
 	ret &= no_error_check_dbus(&error);
 
+	if (!ret)
+		return false;
+
+	// the connection is served by the GMainLoop, the messages are received by the filter without polling
+	ret &= dbus_connection_add_filter(bus, dbus_message_filter, NULL, NULL);
+	ret &= dbus_connection_set_watch_functions(bus, dbus_watch_add, dbus_watch_detach, dbus_watch_toggle, NULL, NULL);
+	ret &= dbus_connection_set_timeout_functions(bus, dbus_timeout_add, dbus_timeout_detach, dbus_timeout_toggle, NULL, NULL);
+	dbus_connection_set_dispatch_status_function(bus, dbus_dispatch_status, NULL, NULL);
+
+	// messages could be queued already by the blocking calls above
+	dbus_dispatch_status(bus, dbus_connection_get_dispatch_status(bus), NULL);
+
 	return ret;
 }
 
 void deinit_dbus() {
+	if (!bus)
+		return;
+
+	dbus_connection_remove_filter(bus, dbus_message_filter, NULL);
+	dbus_connection_set_watch_functions(bus, NULL, NULL, NULL, NULL, NULL);
+	dbus_connection_set_timeout_functions(bus, NULL, NULL, NULL, NULL, NULL);
+	dbus_connection_set_dispatch_status_function(bus, NULL, NULL, NULL);
+
+	if (dispatch_id) {
+		g_source_remove(dispatch_id);
+		dispatch_id = 0;
+	}
+
 	dbus_connection_unref(bus);
 	bus=NULL;
 }
@@ -199,153 +338,337 @@ bool no_error_check_dbus(DBusError *error) {
 	return ret;
 }
 
-struct Dev* receive_dbus(bool *authorize) {
-	struct Dev *ret = NULL;
-	struct udev_device *udevdev = NULL;
-	int32_t authorize_int = 0;
-	int32_t devn_int = 0;
+static bool iter_get(DBusMessageIter *iter, int type, void *value) {
+	if (dbus_message_iter_get_arg_type(iter) != type)
+		return false;
+
+	dbus_message_iter_get_basic(iter, value);
+	dbus_message_iter_next(iter);
+
+	return true;
+}
+
+static struct Dev* receive_intf(DBusMessageIter *record) {
+	struct Dev *ret = calloc(1, sizeof(struct Dev));
+	dbus_bool_t authorize = FALSE;
 	const char *path = NULL;
-	DBusError error;
-	DBusMessage *msg = NULL;
-	dbus_error_init(&error);
-	dbus_connection_flush(bus);
-
-	while (work) { // receive dbus message
-		dbus_connection_read_write(bus, 1);
-		msg = dbus_connection_pop_message(bus);
-		if (msg) { // get interface udev_device from message path and devnum
-			if (dbus_message_is_signal(msg, "org.opensuse.usbauth.Message", "usbauth")) {
-				dbus_message_get_args(msg, &error, DBUS_TYPE_INT32, &authorize_int, DBUS_TYPE_INT32, &devn_int, DBUS_TYPE_STRING, &path, DBUS_TYPE_INVALID);
-				if (no_error_check_dbus(&error)) {
-					syslog(LOG_NOTICE, "successful received dbus message\n");
-					udevdev = udev_device_new_from_syspath(udev, path);
-					if (udevdev)
-						ret = calloc(1, sizeof(struct Dev));
-
-					if (ret) {
-						*authorize = authorize_int;
-						ret->udevdev = udevdev;
-						ret->devnum = devn_int;
-					}
-				}
-				dbus_message_unref(msg);
-				msg = NULL;
-				break;
-			}
+	const char *conf = NULL;
+	const char *num = NULL;
+	int32_t cl = 0;
+	int32_t subcl = 0;
+	int32_t iprot = 0;
+	bool valid = ret;
+
+	// (boolean authorize, string path, string bConfigurationValue, string bInterfaceNumber, int32 class, int32 subclass, int32 protocol)
+	valid = valid && iter_get(record, DBUS_TYPE_BOOLEAN, &authorize) && iter_get(record, DBUS_TYPE_STRING, &path);
+	valid = valid && iter_get(record, DBUS_TYPE_STRING, &conf) && iter_get(record, DBUS_TYPE_STRING, &num);
+	valid = valid && iter_get(record, DBUS_TYPE_INT32, &cl) && iter_get(record, DBUS_TYPE_INT32, &subcl) && iter_get(record, DBUS_TYPE_INT32, &iprot);
+
+	if (valid) {
+		ret->authorize = authorize;
+		ret->syspath = strdup(path);
+		ret->conf = strdup(conf);
+		ret->num = strdup(num);
+		// an unknown class is sent as -1 and shown as vendor specific
+		ret->cl = cl < 0 ? 255 : cl;
+		ret->subcl = subcl < 0 ? 255 : subcl;
+		ret->iprot = iprot < 0 ? 0 : iprot;
+		valid = ret->syspath && ret->conf && ret->num;
+	}
+
+	if (!valid) {
+		dev_free(ret);
+		ret = NULL;
+	}
+
+	return ret;
+}
+
+struct DevGroup* receive_dbus(DBusMessage *msg) {
+	struct DevGroup *ret = calloc(1, sizeof(struct DevGroup));
+	DBusMessageIter iter;
+	DBusMessageIter array;
+	const char *device = NULL;
+	const char *busn = NULL;
+	const char *devp = NULL;
+	int32_t devn = 0;
+	int32_t vId = 0;
+	int32_t pId = 0;
+	bool valid = ret && dbus_message_iter_init(msg, &iter);
+
+	// device(string device, int32 devnum, string busnum, string devpath, int32 idVendor, int32 idProduct, array of interface records)
+	valid = valid && iter_get(&iter, DBUS_TYPE_STRING, &device) && iter_get(&iter, DBUS_TYPE_INT32, &devn);
+	valid = valid && iter_get(&iter, DBUS_TYPE_STRING, &busn) && iter_get(&iter, DBUS_TYPE_STRING, &devp);
+	valid = valid && iter_get(&iter, DBUS_TYPE_INT32, &vId) && iter_get(&iter, DBUS_TYPE_INT32, &pId);
+	valid = valid && dbus_message_iter_get_arg_type(&iter) == DBUS_TYPE_ARRAY;
+
+	if (valid) {
+		ret->syspath = strdup(device);
+		ret->busnum = strdup(busn);
+		ret->devpath = strdup(devp);
+		ret->devnum = devn;
+		ret->vId = vId < 0 ? 0 : vId;
+		ret->pId = pId < 0 ? 0 : pId;
+		ret->intfs = g_ptr_array_new_with_free_func(dev_free);
+		valid = ret->syspath && ret->busnum && ret->devpath;
+	}
+
+	if (valid) {
+		dbus_message_iter_recurse(&iter, &array);
+
+		while (valid && dbus_message_iter_get_arg_type(&array) == DBUS_TYPE_STRUCT) {
+			DBusMessageIter record;
+			struct Dev *dev = NULL;
+
+			dbus_message_iter_recurse(&array, &record);
+			dev = receive_intf(&record);
+
+			if (dev)
+				g_ptr_array_add(ret->intfs, dev);
+			else
+				valid = false;
+
+			dbus_message_iter_next(&array);
 		}
-		usleep(100000);
+	}
+
+	if (valid) {
+		syslog(LOG_NOTICE, "successful received dbus message for %u interfaces\n", ret->intfs->len);
+	} else {
+		syslog(LOG_ERR, "invalid dbus message\n");
+		group_free(ret);
+		ret = NULL;
 	}
 
 	return ret;
 }
 
-void notification_action_callback(NotifyNotification *callback, char* action, gpointer user_data) {
-	const char *authstr = strcmp(action, "act_allow") ? "deny" : "allow";
-	struct Dev *dev = (struct Dev*) user_data;
-	struct udev_device *udevdev = dev->udevdev;
-	const char *syspath = NULL;
-	int devn = -1;
-	char sdevn[32];
+void dev_free(gpointer data) {
+	struct Dev *dev = data;
 
 	if (!dev)
 		return;
 
-	if (!udevdev) {
-		free(dev);
+	free(dev->syspath);
+	free(dev->conf);
+	free(dev->num);
+	free(dev);
+}
+
+void group_free(gpointer data) {
+	struct DevGroup *group = data;
+
+	if (!group)
+		return;
+
+	if (group->timeout_id)
+		g_source_remove(group->timeout_id);
+
+	if (group->intfs)
+		g_ptr_array_free(group->intfs, TRUE);
+
+	free(group->syspath);
+	free(group->busnum);
+	free(group->devpath);
+	free(group);
+}
+
+void group_add(struct DevGroup *received) {
+	struct DevGroup *group = NULL;
+	unsigned i;
+
+	if (!groups)
+		groups = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, group_free);
+
+	group = g_hash_table_lookup(groups, received->syspath);
+
+	// the window starts with the first signal, so a notification is not delayed by further devices
+	if (!group) {
+		received->timeout_id = g_timeout_add(SETTLE_MS, group_settled, received);
+		g_hash_table_insert(groups, received->syspath, received);
 		return;
 	}
 
-	devn = dev->devnum;
-	syspath = udev_device_get_syspath(udevdev);
-	snprintf(sdevn, sizeof(sdevn), "%x", devn);
+	// usbauth sends a device's interfaces in one signal, further signals within the window are merged
+	for (i = 0; i < received->intfs->len; i++)
+		g_ptr_array_add(group->intfs, g_ptr_array_index(received->intfs, i));
+
+	g_ptr_array_set_free_func(received->intfs, NULL);
+	group_free(received);
+}
+
+gboolean group_settled(gpointer user_data) {
+	struct DevGroup *group = user_data;
+
+	// the source is removed by returning G_SOURCE_REMOVE
+	group->timeout_id = 0;
+	g_hash_table_steal(groups, group->syspath);
+
+	notification_create(group);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void npriv_exited(GPid pid, gint status, gpointer user_data) {
+	g_spawn_close_pid(pid);
+}
+
+void authorize_npriv(bool authorize, int32_t devnum, const char *syspath) {
+	const char *authstr = authorize ? "allow" : "deny";
+	char sdevn[32];
+	pid_t pid = -1;
+
+	snprintf(sdevn, sizeof(sdevn), "%x", devnum);
 
 	// /usr/bin/usbauth-npriv allow/deny DEVNUM PATH
 	syslog(LOG_NOTICE, "execute %s %s %s %s\n", NPRIV_PATH, authstr, sdevn, syspath);
-	if (fork())
-		wait(NULL);
-	else
+	pid = fork();
+
+	if (pid == 0) {
 		execl(NPRIV_PATH, NPRIV_PATH, authstr, sdevn, syspath, NULL);
+		_exit(EXIT_FAILURE);
+	}
 
-	udev_device_unref(udevdev);
-	free(dev);
+	// the child is reaped by the main loop, so the loop is not blocked
+	if (pid > 0)
+		g_child_watch_add(pid, npriv_exited, NULL);
+	else
+		syslog(LOG_ERR, "fork error\n");
+}
+
+static void authorize_call_free(void *data) {
+	struct AuthorizeCall *call = data;
+
+	free(call->syspath);
+	free(call);
+}
+
+static void authorize_reply(DBusPendingCall *pending, void *data) {
+	struct AuthorizeCall *call = data;
+	DBusMessage *reply = dbus_pending_call_steal_reply(pending);
+	DBusError error;
+
+	dbus_error_init(&error);
+
+	if (!reply) {
+		authorize_npriv(call->authorize, call->devnum, call->syspath);
+	} else if (dbus_set_error_from_message(&error, reply)) {
+		// invalid arguments are rejected by usbauth itself, other errors mean that no resident usbauth could serve the call
+		if (!dbus_error_has_name(&error, DBUS_ERROR_INVALID_ARGS))
+			authorize_npriv(call->authorize, call->devnum, call->syspath);
+
+		no_error_check_dbus(&error);
+	} else {
+		syslog(LOG_NOTICE, "usbauth has %s %s\n", call->authorize ? "allowed" : "denied", call->syspath);
+	}
+
+	if (reply)
+		dbus_message_unref(reply);
+}
+
+void authorize_dbus(bool authorize, int32_t devnum, const char *syspath) {
+	DBusMessage *msg = NULL;
+	DBusPendingCall *pending = NULL;
+	struct AuthorizeCall *call = calloc(1, sizeof(struct AuthorizeCall));
+	dbus_bool_t allow = authorize;
+
+	if (call) {
+		call->authorize = authorize;
+		call->devnum = devnum;
+		call->syspath = strdup(syspath);
+	}
+
+	if (call && call->syspath)
+		msg = dbus_message_new_method_call("org.opensuse.usbauth", "/org/opensuse/usbauth", "org.opensuse.usbauth", "Authorize");
+
+	if (msg && dbus_message_append_args(msg, DBUS_TYPE_BOOLEAN, &allow, DBUS_TYPE_INT32, &devnum, DBUS_TYPE_STRING, &syspath, DBUS_TYPE_INVALID)
+			&& dbus_connection_send_with_reply(bus, msg, &pending, AUTHORIZE_TIMEOUT) && pending
+			&& dbus_pending_call_set_notify(pending, authorize_reply, call, authorize_call_free)) {
+		call = NULL; // freed with the pending call
+	} else {
+		authorize_npriv(authorize, devnum, syspath);
+	}
+
+	if (pending)
+		dbus_pending_call_unref(pending);
+
+	if (msg)
+		dbus_message_unref(msg);
+
+	if (call)
+		authorize_call_free(call);
+}
+
+void notification_action_callback(NotifyNotification *callback, char* action, gpointer user_data) {
+	bool authorize = strcmp(action, "act_allow") == 0;
+	struct DevGroup *group = (struct DevGroup*) user_data;
+	unsigned i;
+
+	if (!group)
+		return;
+
+	// the action applies to all interfaces of the device, the calls are answered asynchronously
+	for (i = 0; i < group->intfs->len; i++) {
+		struct Dev *dev = g_ptr_array_index(group->intfs, i);
+
+		authorize_dbus(authorize, group->devnum, dev->syspath);
+	}
+
+	// the group is freed with the notification
 	g_object_unref(G_OBJECT(callback));
 }
 
-void notification_create(const struct Dev* dev, bool authorize) {
-	struct udev_device *udevdev = dev->udevdev;
-	int32_t devn = dev->devnum;
-	char titleMsg[48];
-	char detailedMsg[128];
-	unsigned cl = 255;
-	unsigned subcl = 255;
-	unsigned iprot = 0;
-	unsigned vId = 0;
-	unsigned pId = 0;
-	const char *busn = 0;
-	const char *devp = 0;
-	const char *conf = 0;
-	const char *intf = 0;
-	const char *titleStr = "";
-	struct Dev *dev_heap = NULL;
+void notification_create(struct DevGroup *group) {
+	char titleMsg[64];
+	GString *detailedMsg = NULL;
+	const char *icon = NULL;
 	NotifyNotification *notification = NULL;
-	const char *type = udev_device_get_devtype(udevdev);
+	unsigned i;
 
-	dev_heap = calloc(1, sizeof(struct Dev));
-
-	if (!type || !dev_heap) {
-		syslog(LOG_ERR, "error at creating notification\n");
+	if (!group->intfs->len) {
+		group_free(group);
 		return;
 	}
 
-	if (strcmp(type, "usb_interface") == 0) { // values from interface
-		cl = usbauth_get_param_val(bInterfaceClass, udevdev);
-		subcl = usbauth_get_param_val(bInterfaceSubClass, udevdev);
-		iprot = usbauth_get_param_val(bInterfaceProtocol, udevdev);
-		titleStr = gettext("New USB interface");
+	// values from interfaces parent, as sent by usbauth
+	snprintf(titleMsg, sizeof(titleMsg), "%s (%s-%s)", group->intfs->len > 1 ? gettext("New USB device") : gettext("New USB interface"), group->busnum, group->devpath);
+
+	detailedMsg = g_string_new(NULL);
+	g_string_append_printf(detailedMsg, "<b>%s:</b> %04x:%04x", "ID", group->vId, group->pId);
+
+	// one line for every interface, values from interface
+	for (i = 0; i < group->intfs->len; i++) {
+		const struct Dev *dev = g_ptr_array_index(group->intfs, i);
+
+		// the icon is taken from the first interface
+		if (!icon)
+			icon = get_info_string(dev->cl, dev->subcl, dev->iprot, true);
+
+		g_string_append_printf(detailedMsg, "\n<b>%s:</b> %s-%s:%s.%s <b>%s:</b> %s <b>%s:</b> %s",
+				gettext("Name"), group->busnum, group->devpath, dev->conf, dev->num,
+				gettext("Type"), get_info_string(dev->cl, dev->subcl, dev->iprot, false),
+				gettext("Default"), dev->authorize ? gettext("Allow") : gettext("Deny"));
 	}
 
-	// values from interfaces parent
-	vId = usbauth_get_param_val(idVendor, udevdev);
-	pId = usbauth_get_param_val(idProduct, udevdev);
-	busn = usbauth_get_param_valStr(busnum, udevdev);
-	devp = usbauth_get_param_valStr(devpath, udevdev);
-	conf = usbauth_get_param_valStr(bConfigurationValue, udevdev);
-	intf = usbauth_get_param_valStr(bInterfaceNumber, udevdev);
-
-	snprintf(titleMsg, sizeof(titleMsg), "%s (%s-%s:%s.%s)", titleStr, busn, devp, conf, intf);
-	snprintf(detailedMsg, sizeof(detailedMsg), "<b>%s:</b> %s\n<b>%s:</b> %s\n<b>%s:</b> %04x:%04x\n<b>%s:</b> %s-%s:%s.%s", gettext("Default"), authorize ? gettext("Allow") : gettext("Deny"), gettext("Type"), get_info_string(cl, subcl, iprot, false), "ID", vId, pId, gettext("Name"), busn, devp, conf, intf);
-
-	// pointer of dev heap gets back at callback so stack would be then out of context
-	dev_heap->udevdev = udevdev;
-	dev_heap->devnum = devn;
-	notification = notify_notification_new(titleMsg, detailedMsg, get_info_string(cl, subcl, iprot, true));
-	notify_notification_add_action(notification, "act_allow", gettext("Allow"), (NotifyActionCallback) notification_action_callback, dev_heap, NULL);
-	notify_notification_add_action(notification, "act_deny", gettext("Deny"), (NotifyActionCallback) notification_action_callback, dev_heap, NULL);
+	// pointer of group gets back at callback, the group is freed once with the notification
+	notification = notify_notification_new(titleMsg, detailedMsg->str, icon);
+	notify_notification_add_action(notification, "act_allow", gettext("Allow"), (NotifyActionCallback) notification_action_callback, group, group_free);
+	notify_notification_add_action(notification, "act_deny", gettext("Deny"), (NotifyActionCallback) notification_action_callback, group, NULL);
 	notify_notification_show(notification, NULL);
 
-	syslog(LOG_INFO, "show notification for syspath %s\n", udev_device_get_syspath(udevdev));
-}
-
-void* notification_thread_loop(void *arg) {
-	loop = g_main_loop_new(NULL, FALSE);
-	if (loop)
-		g_main_loop_run(loop);
+	syslog(LOG_INFO, "show notification for %u interfaces of syspath %s\n", group->intfs->len, group->syspath);
 
-	g_thread_exit(NULL);
-	return NULL;
+	g_string_free(detailedMsg, TRUE);
 }
 
-void signal_handler(int sig) {
-	work = false;
+gboolean signal_handler(gpointer user_data) {
+	g_main_loop_quit(loop);
+
+	return G_SOURCE_CONTINUE;
 }
 
 int main(int argc, char **argv) {
 	struct group *gr = NULL;
-	GThread *thread = NULL;
-
-	// set signal handler for SIGINT and SIGTERM, the handler sets work to false
-	signal(SIGINT, signal_handler);
-	signal(SIGTERM, signal_handler);
 
 	// connect to syslog
 	openlog("usbauth-notifier", LOG_PERROR | LOG_PID, LOG_USER);
@@ -366,13 +689,17 @@ int main(int argc, char **argv) {
 	setlocale(LC_ALL, "");
 	textdomain("usbauth-notifier");
 
-	udev = udev_new();
+	loop = g_main_loop_new(NULL, FALSE);
 
-	if (!udev) {
-		syslog(LOG_ERR, "udev error\n");
+	if (!loop) {
+		syslog(LOG_ERR, "main loop error\n");
 		return EXIT_FAILURE;
 	}
 
+	// SIGINT and SIGTERM quit the main loop
+	g_unix_signal_add(SIGINT, signal_handler, NULL);
+	g_unix_signal_add(SIGTERM, signal_handler, NULL);
+
 	if (!init_dbus()) {
 		syslog(LOG_ERR, "dbus init error\n");
 		return EXIT_FAILURE;
@@ -383,30 +710,22 @@ int main(int argc, char **argv) {
 		return EXIT_FAILURE;
 	}
 
-	thread = g_thread_new("thread", notification_thread_loop, NULL); // thread for g_main_loop
-
 	syslog(LOG_NOTICE, "usbauth-notifier started\n");
 
-	// work until SIGINT or SIGTERM
-	while(work) {
-		bool authorize = false;
-		struct Dev *dev = receive_dbus(&authorize); // receive dbus message from USB firewall
+	// dbus messages and notification actions are handled until SIGINT or SIGTERM
+	g_main_loop_run(loop);
 
-		if (dev) {
-			notification_create(dev, authorize); // create notification according interface device from dbus message
-			free(dev);
-		}
-	}
+	deinit_dbus();
 
-	g_main_loop_quit(loop); // exit g_main_loop
-	g_thread_join(thread); // exit g_main_loop thread
+	if (groups) {
+		g_hash_table_destroy(groups);
+		groups = NULL;
+	}
 
 	notify_uninit();
 
-	deinit_dbus();
-
-	udev_unref(udev);
-	udev = NULL;
+	g_main_loop_unref(loop);
+	loop = NULL;
 
 	syslog(LOG_NOTICE, "usbauth-notifier stopped\n");
 
@@ -27,12 +27,37 @@
 
 #include <stdint.h>
 #include <stdbool.h>
-#include <libudev.h>
+#include <dbus/dbus.h>
 #include <libnotify/notify.h>
 
+// an interface as sent by usbauth, the values are not read again from sysfs
 struct Dev {
-	struct udev_device *udevdev;
+	char *syspath; // syspath of the usb_interface
+	char *conf; // bConfigurationValue
+	char *num; // bInterfaceNumber
+	unsigned cl;
+	unsigned subcl;
+	unsigned iprot;
+	bool authorize; // decision of the USB firewall
+};
+
+// interfaces of one device that are shown in one notification
+struct DevGroup {
+	char *syspath; // syspath of the usb_device
+	char *busnum;
+	char *devpath;
+	int32_t devnum;
+	unsigned vId;
+	unsigned pId;
+	GPtrArray *intfs; // struct Dev* of the interfaces
+	guint timeout_id; // end of the settle window, 0 after it has elapsed
+};
+
+// a pending call of the Authorize method
+struct AuthorizeCall {
+	bool authorize;
 	int32_t devnum;
+	char *syspath;
 };
 
 /**
@@ -67,14 +92,65 @@ void deinit_dbus();
 bool no_error_check_dbus(DBusError *error);
 
 /**
- * receive dbus message from USB firewall
- * will called when user clicked on allow or deny in notify pop up
+ * read the device signal from USB firewall
+ * will called by the dbus filter of the main loop when the message is received
+ *
+ * @msg: the usbauth signal with the device's values and a record per interface
+ *
+ * Return: DevGroup structure with the interfaces and the decisions of the USB firewall, NULL at error
+ */
+struct DevGroup* receive_dbus(DBusMessage *msg);
+
+/**
+ * free a Dev structure and its strings
+ *
+ * @data: struct Dev*
+ */
+void dev_free(gpointer data);
+
+/**
+ * free a DevGroup structure and its interfaces, stops the settle window
+ *
+ * @data: struct DevGroup*
+ */
+void group_free(gpointer data);
+
+/**
+ * add the interfaces of a received signal to the group of its device
+ * the first signal of a device starts the settle window
+ *
+ * @received: DevGroup structure from receive_dbus, it is taken or freed
+ */
+void group_add(struct DevGroup *received);
+
+/**
+ * called by the main loop at the end of the settle window, shows the notification of the group
+ *
+ * @user_data: struct DevGroup*
+ *
+ * Return: G_SOURCE_REMOVE
+ */
+gboolean group_settled(gpointer user_data);
+
+/**
+ * allow or deny an interface with usbauth-npriv, the fallback if no resident usbauth serves the Authorize method
+ * the child process is reaped by the main loop
  *
- * @authorize (output param): true if interface was authorized by the USB firewall, false if interface was not authorized by the USB firewall
+ * @authorize: true for allow, false for deny
+ * @devnum: devnum of interface
+ * @syspath: syspath of interface
+ */
+void authorize_npriv(bool authorize, int32_t devnum, const char *syspath);
+
+/**
+ * allow or deny an interface with the method org.opensuse.usbauth.Authorize of the usbauth daemon
+ * returns without waiting, if the call fails usbauth-npriv is used
  *
- * Return: Dev structure with udev_device from type "usb_interface" and devnum from sysfs tree
+ * @authorize: true for allow, false for deny
+ * @devnum: devnum of interface
+ * @syspath: syspath of interface
  */
-struct Dev* receive_dbus(bool *authorize);
+void authorize_dbus(bool authorize, int32_t devnum, const char *syspath);
 
 /**
  * callback handler from after action from notification
@@ -82,29 +158,26 @@ struct Dev* receive_dbus(bool *authorize);
  *
  * @callback: pointer to notify structure
  * @action: to differ from allow and deny actions
- * @user_data: pointer that is given to the notification message, and is returned back on callback; used to relate the interface from notification (struct Dev*)
+ * @user_data: pointer that is given to the notification message, and is returned back on callback; used to relate the interfaces from notification (struct DevGroup*)
  */
 void notification_action_callback(NotifyNotification *callback, char* action, gpointer user_data);
 
 /**
- * create a notification that will showed as pop up
- * will called when user clicked on allow or deny in notify pop up
+ * create one notification for the interfaces of a device that will showed as pop up
+ * the actions of the notification apply to all interfaces
  *
- * @dev: Dev structure with udev_device from type "usb_interface" and devnum from sysfs tree
- * @authorize: true if interface was authorized by the USB firewall, false if interface was not authorized by the USB firewall
+ * @group: DevGroup structure, freed with the notification
  */
-void notification_create(const struct Dev* intf, bool authorize);
-
-/**
- * Thread for g_main_loop needed for action_callback handler
- */
-void* notification_thread_loop(void *arg);
+void notification_create(struct DevGroup *group);
 
 /**
  * signal handler that catches SIGINT and SIGTERM to exit program
+ * called by the main loop, not in signal context
+ *
+ * @user_data: unused
  *
- * @int: signal type
+ * Return: G_SOURCE_CONTINUE
  */
-void signal_handler(int sig);
+gboolean signal_handler(gpointer user_data);
 
 #endif /* USBAUTH_NOTIFIER_H_ */
@@ -20,16 +20,47 @@
  * you may find current contact information at www.suse.com
  */
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <syslog.h>
+#include <limits.h>
 #include <sys/wait.h>
 
 #define USBAUTH_PATH "/usr/sbin/usbauth"
 #define NOTIFIER_PATH "/usr/lib/usbauth-notifier/usbauth-notifier"
 #define BUFSIZE 128
+#define SYSFS_PREFIX "/sys/"
+
+/**
+ * check the params, only allow/deny, a hex device number and a sysfs path are passed to usbauth
+ *
+ * @argc: number of params
+ * @argv: params
+ *
+ * Return: true if usbauth could be called with the params
+ */
+static bool args_valid(int argc, char **argv) {
+	const char *hex = "0123456789abcdefABCDEF";
+
+	if (argc != 4)
+		return false;
+
+	if (strcmp(argv[1], "allow") != 0 && strcmp(argv[1], "deny") != 0)
+		return false;
+
+	// DEVNUM: 1 to 8 hex digits, without sign or prefix
+	if (!*argv[2] || strlen(argv[2]) > 8 || argv[2][strspn(argv[2], hex)] != 0)
+		return false;
+
+	// PATH: a device in sysfs, usbauth resolves it and checks the device type
+	if (strncmp(argv[3], SYSFS_PREFIX, strlen(SYSFS_PREFIX)) != 0 || strlen(argv[3]) >= PATH_MAX)
+		return false;
+
+	return true;
+}
 
 /*
  * This program will installed with SUID bit set
@@ -50,7 +81,7 @@ int main(int argc, char **argv) {
 	int ret = EXIT_FAILURE;
 	char str_proc[BUFSIZE] = {0};
 	char str_path[BUFSIZE] = {0};
-	size_t len_str_path = 0;
+	ssize_t len_str_path = 0;
 	pid_t ppid = 0;
 
 	// connect to syslog
@@ -65,8 +96,15 @@ int main(int argc, char **argv) {
 
 	str_path[len_str_path] = 0;
 
-	// three params must be given and the caller must be the notifier
-	if (argc >= 4  && strncmp(NOTIFIER_PATH, str_path, BUFSIZE) == 0) {
+	// usbauth runs as root, so no other params than allow/deny DEVNUM PATH are passed
+	if (!args_valid(argc, argv)) {
+		syslog(LOG_ERR, "wrong syntax to call usbauth-npriv\n");
+		closelog();
+		return EXIT_FAILURE;
+	}
+
+	// the caller must be the notifier
+	if (strncmp(NOTIFIER_PATH, str_path, BUFSIZE) == 0) {
 		ret = setuid(0);
 
 		if (!ret)
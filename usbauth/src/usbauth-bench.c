@@ -0,0 +1,545 @@
+/*
+ * Copyright (c) 2018 Stefan Koch <stefan.koch10@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Description : benchmark of the rule evaluation over synthetic USB topologies
+ *
+ * Synthetic sysfs trees (hubs, composite devices) and synthetic rule sets
+ * (allow lists, conditions, anyChild rules) are generated at several sizes.
+ * Every result is printed as one line of key=value pairs, times are in nanoseconds.
+ *
+ * start:    process start of usbauth up to its exit, including the config parsing
+ * parse:    parsing a rule set
+ * snapshot: reading the parameters of one interface from the synthetic sysfs tree
+ * decide:   evaluation of one interface
+ * init:     evaluation of all interfaces, like usbauth init without authorizing
+ * add:      handling of a plugged interface, like usbauth udev-add
+ *
+ * The synthetic trees are written by usbauth-fixture.h and accessed through the fixture backend of usbauth-device.h.
+ */
+
+#include "usbauth.h"
+#include "usbauth-counts.h"
+#include "usbauth-device.h"
+#include "usbauth-fixture.h"
+
+#include <usbauth/usbauth-configparser.h>
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <syslog.h>
+#include <getopt.h>
+#include <sys/wait.h>
+
+// bus number of the synthetic tree
+#define BENCH_BUSNUM 1
+
+struct bench_topology {
+	const char *name;
+	unsigned hubs; // external hubs at the root hub
+	unsigned devices; // composite devices per hub
+	unsigned intfs; // interfaces per composite device
+};
+
+enum bench_rules_kind { RULES_ALLOWLIST, RULES_COND, RULES_ANYCHILD };
+
+struct bench_rules {
+	const char *name;
+	enum bench_rules_kind kind;
+	unsigned rules;
+};
+
+static const struct bench_topology topologies[] = {
+	{ "small", 1, 4, 2 },
+	{ "medium", 4, 8, 4 },
+	{ "large", 16, 8, 8 },
+};
+
+static const struct bench_rules rule_sets[] = {
+	{ "allowlist", RULES_ALLOWLIST, 10 },
+	{ "allowlist", RULES_ALLOWLIST, 100 },
+	{ "allowlist", RULES_ALLOWLIST, 1000 },
+	{ "cond", RULES_COND, 10 },
+	{ "cond", RULES_COND, 100 },
+	{ "cond", RULES_COND, 1000 },
+	{ "anychild", RULES_ANYCHILD, 10 },
+	{ "anychild", RULES_ANYCHILD, 100 },
+	{ "anychild", RULES_ANYCHILD, 1000 },
+};
+
+// interface classes of the composite devices: HID, mass storage, audio, video, CDC, vendor specific
+static const unsigned intf_classes[] = { 0x03, 0x08, 0x01, 0x0e, 0x02, 0xff };
+
+// collected durations of one benchmark
+struct bench_samples {
+	uint64_t *ns;
+	size_t len;
+	size_t cap;
+};
+
+// synthetic sysfs tree
+struct bench_tree {
+	char base[64];
+	char **intfs; // syspaths of the interfaces
+	size_t intf_len;
+	size_t intf_cap;
+};
+
+static FILE *out = NULL;
+static unsigned reps = 10;
+
+static uint64_t now_ns() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void samples_add(struct bench_samples *s, uint64_t ns) {
+	if (s->len == s->cap) {
+		size_t cap = s->cap ? s->cap * 2 : 256;
+		uint64_t *arr = realloc(s->ns, cap * sizeof(uint64_t));
+
+		if (!arr)
+			return;
+
+		s->ns = arr;
+		s->cap = cap;
+	}
+
+	s->ns[s->len++] = ns;
+}
+
+static int cmp_ns(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t*) a;
+	uint64_t y = *(const uint64_t*) b;
+
+	return x < y ? -1 : x > y;
+}
+
+// print one result line and reset the samples
+static void samples_report(struct bench_samples *s, const char *bench, const char *labels) {
+	uint64_t sum = 0;
+	size_t i;
+
+	if (!s->len) {
+		fprintf(out, "bench=%s %s samples=0\n", bench, labels);
+		return;
+	}
+
+	qsort(s->ns, s->len, sizeof(uint64_t), cmp_ns);
+
+	for (i = 0; i < s->len; i++)
+		sum += s->ns[i];
+
+	fprintf(out, "bench=%s %s samples=%zu min_ns=%" PRIu64 " p50_ns=%" PRIu64 " p99_ns=%" PRIu64 " max_ns=%" PRIu64 " mean_ns=%" PRIu64 "\n",
+			bench, labels, s->len, s->ns[0], s->ns[s->len / 2], s->ns[(s->len * 99) / 100], s->ns[s->len - 1], sum / s->len);
+	fflush(out);
+
+	s->len = 0;
+}
+
+static bool tree_add_device(const char *path, unsigned devnum, unsigned vendor, unsigned product, unsigned dev_class, const char *devpath) {
+	char serial[32];
+	char name[32];
+	struct fixture_device dev = { BENCH_BUSNUM, devnum, vendor, product, dev_class, 1, devpath, "480", serial, name, "hotplug" };
+
+	snprintf(serial, sizeof(serial), "BENCH%08u", devnum);
+	snprintf(name, sizeof(name), "bench device %u", devnum);
+
+	return fixture_tree_add_device(path, &dev);
+}
+
+static bool tree_add_interface(struct bench_tree *tree, const char *dev_path, const char *name, unsigned vendor, unsigned product, unsigned dev_class, unsigned num, unsigned intf_class) {
+	char path[PATH_MAX];
+	struct fixture_device dev = { .busnum = BENCH_BUSNUM, .vendor = vendor, .product = product, .dev_class = dev_class };
+	struct fixture_interface intf = { num, intf_class, 0, 0, 2 };
+
+	snprintf(path, sizeof(path), "%s/%s", dev_path, name);
+
+	if (!fixture_tree_add_interface(path, &dev, &intf))
+		return false;
+
+	if (tree->intf_len == tree->intf_cap) {
+		size_t cap = tree->intf_cap ? tree->intf_cap * 2 : 64;
+		char **arr = realloc(tree->intfs, cap * sizeof(char*));
+
+		if (!arr)
+			return false;
+
+		tree->intfs = arr;
+		tree->intf_cap = cap;
+	}
+
+	tree->intfs[tree->intf_len] = strdup(path);
+
+	if (!tree->intfs[tree->intf_len])
+		return false;
+
+	tree->intf_len++;
+
+	return true;
+}
+
+/*
+ * the tree is laid out like /sys/devices/pci.../usb1:
+ * usb1, usb1/1-H (hubs), usb1/1-H/1-H.D (composite devices), usb1/1-H/1-H.D/1-H.D:1.I (interfaces)
+ */
+static bool tree_create(struct bench_tree *tree, const struct bench_topology *topo) {
+	char root[128];
+	unsigned devnum = 1;
+	unsigned h, d, i;
+
+	memset(tree, 0, sizeof(struct bench_tree));
+
+	if (!fixture_tree_create(tree->base, sizeof(tree->base), "usbauth-bench"))
+		return false;
+
+	snprintf(root, sizeof(root), "%s/usb%u", tree->base, BENCH_BUSNUM);
+
+	if (!tree_add_device(root, devnum++, 0x1d6b, 0x0002, 0x09, "0"))
+		return false;
+
+	if (!tree_add_interface(tree, root, "1-0:1.0", 0x1d6b, 0x0002, 0x09, 0, 0x09))
+		return false;
+
+	for (h = 1; h <= topo->hubs; h++) {
+		char hub[256];
+		char name[64];
+
+		snprintf(hub, sizeof(hub), "%s/%u-%u", root, BENCH_BUSNUM, h);
+		snprintf(name, sizeof(name), "%u", h);
+
+		if (!tree_add_device(hub, devnum++, 0x05e3, 0x0608, 0x09, name))
+			return false;
+
+		snprintf(name, sizeof(name), "%u-%u:1.0", BENCH_BUSNUM, h);
+
+		if (!tree_add_interface(tree, hub, name, 0x05e3, 0x0608, 0x09, 0, 0x09))
+			return false;
+
+		for (d = 1; d <= topo->devices; d++) {
+			char dev[PATH_MAX];
+			unsigned vendor = 0x1000 + devnum % 64;
+			unsigned product = 0x2000 + devnum;
+
+			snprintf(dev, sizeof(dev), "%s/%u-%u.%u", hub, BENCH_BUSNUM, h, d);
+			snprintf(name, sizeof(name), "%u.%u", h, d);
+
+			if (!tree_add_device(dev, devnum, vendor, product, 0x00, name))
+				return false;
+
+			for (i = 0; i < topo->intfs; i++) {
+				unsigned intf_class = intf_classes[(devnum + i) % (sizeof(intf_classes) / sizeof(intf_classes[0]))];
+
+				snprintf(name, sizeof(name), "%u-%u.%u:1.%u", BENCH_BUSNUM, h, d, i);
+
+				if (!tree_add_interface(tree, dev, name, vendor, product, 0x00, i, intf_class))
+					return false;
+			}
+
+			devnum++;
+		}
+	}
+
+	return true;
+}
+
+static void tree_free(struct bench_tree *tree) {
+	size_t i;
+
+	fixture_tree_remove(tree->base);
+
+	for (i = 0; i < tree->intf_len; i++)
+		free(tree->intfs[i]);
+
+	free(tree->intfs);
+	memset(tree, 0, sizeof(struct bench_tree));
+}
+
+// the rules refer to the vendor and product IDs used by tree_create
+static char* rules_create(const struct bench_rules *set, size_t *len) {
+	char *buf = NULL;
+	FILE *f = open_memstream(&buf, len);
+	unsigned i;
+
+	if (!f)
+		return NULL;
+
+	fprintf(f, "# synthetic rule set %s with %u rules\n", set->name, set->rules);
+	fprintf(f, "deny all\n");
+	fprintf(f, "allow bDeviceClass==09 bInterfaceClass==09\n");
+
+	for (i = 0; i < set->rules; i++) {
+		unsigned vendor = 0x1000 + i % 64;
+		unsigned product = 0x2000 + i;
+		unsigned intf_class = intf_classes[i % (sizeof(intf_classes) / sizeof(intf_classes[0]))];
+
+		if (set->kind == RULES_COND && i % 4 == 3)
+			fprintf(f, "condition devcount<=%x case bInterfaceClass==%02x\n", 2 + i % 8, intf_class);
+		else if (set->kind == RULES_ANYCHILD && i % 2 == 1)
+			fprintf(f, "deny idVendor==%04x anyChild bInterfaceClass==%02x bInterfaceClass!=%02x\n", vendor, intf_class, intf_class);
+		else
+			fprintf(f, "allow idVendor==%04x idProduct==%04x bInterfaceClass==%02x # device %u\n", vendor, product, intf_class, i);
+	}
+
+	if (fclose(f)) {
+		free(buf);
+		return NULL;
+	}
+
+	return buf;
+}
+
+// parse a rule set into a mutable copy, the counts of the copy are changed by the evaluation
+static bool rules_parse(const struct bench_rules *set, struct Auth **auths, unsigned *length) {
+	struct usbauth_config_ctx *ctx = usbauth_config_ctx_new();
+	const struct Auth *parsed = NULL;
+	size_t len = 0;
+	char *buf = rules_create(set, &len);
+	bool ret = false;
+
+	*auths = NULL;
+	*length = 0;
+
+	if (ctx && buf && usbauth_config_ctx_parse_buffer(ctx, buf, len) == 0) {
+		usbauth_config_ctx_get_auths(ctx, &parsed, length);
+		usbauth_allocate_and_copy(auths, parsed, *length);
+		ret = *auths != NULL;
+	}
+
+	usbauth_config_ctx_free(ctx);
+	free(buf);
+
+	return ret;
+}
+
+static void bench_start(const char *usbauth_path) {
+	struct bench_samples s = { NULL, 0, 0 };
+	unsigned i;
+
+	if (access(usbauth_path, X_OK)) {
+		fprintf(stderr, "%s is not executable, skip start benchmark\n", usbauth_path);
+		return;
+	}
+
+	for (i = 0; i < reps; i++) {
+		uint64_t start = now_ns();
+		int status = 0;
+		pid_t pid = fork();
+
+		if (pid == 0) {
+			int fd = open("/dev/null", O_WRONLY);
+
+			if (fd >= 0) {
+				dup2(fd, STDOUT_FILENO);
+				dup2(fd, STDERR_FILENO);
+			}
+
+			// without arguments usbauth connects to udev and D-Bus, parses the config file and exits
+			execl(usbauth_path, usbauth_path, NULL);
+			_exit(127);
+		}
+
+		if (pid < 0 || waitpid(pid, &status, 0) < 0)
+			break;
+
+		samples_add(&s, now_ns() - start);
+	}
+
+	samples_report(&s, "start", "topology=none rules=none size=0");
+	free(s.ns);
+}
+
+static void bench_parse() {
+	struct bench_samples s = { NULL, 0, 0 };
+	char labels[128];
+	unsigned i, j;
+
+	for (i = 0; i < sizeof(rule_sets) / sizeof(rule_sets[0]); i++) {
+		size_t len = 0;
+		char *buf = rules_create(&rule_sets[i], &len);
+
+		if (!buf)
+			continue;
+
+		for (j = 0; j < reps; j++) {
+			struct usbauth_config_ctx *ctx = usbauth_config_ctx_new();
+			uint64_t start = now_ns();
+
+			if (ctx && usbauth_config_ctx_parse_buffer(ctx, buf, len) == 0)
+				samples_add(&s, now_ns() - start);
+
+			usbauth_config_ctx_free(ctx);
+		}
+
+		snprintf(labels, sizeof(labels), "topology=none rules=%s size=%u", rule_sets[i].name, rule_sets[i].rules);
+		samples_report(&s, "parse", labels);
+		free(buf);
+	}
+
+	free(s.ns);
+}
+
+static void bench_snapshot(const struct bench_topology *topo, const struct bench_tree *tree) {
+	struct bench_samples s = { NULL, 0, 0 };
+	char labels[128];
+	unsigned j;
+	size_t k;
+
+	for (j = 0; j < reps; j++) {
+		for (k = 0; k < tree->intf_len; k++) {
+			struct Snapshot snap;
+			uint64_t start = now_ns();
+
+			if (device_snapshot_read(&snap, tree->intfs[k], PARAM_BITS_SYSFS))
+				samples_add(&s, now_ns() - start);
+		}
+	}
+
+	snprintf(labels, sizeof(labels), "topology=%s rules=none size=%zu", topo->name, tree->intf_len);
+	samples_report(&s, "snapshot", labels);
+	free(s.ns);
+}
+
+static void bench_rules(const struct bench_topology *topo, const struct bench_tree *tree, const struct bench_rules *set) {
+	struct bench_samples decide = { NULL, 0, 0 };
+	struct bench_samples init = { NULL, 0, 0 };
+	struct bench_samples add = { NULL, 0, 0 };
+	struct Auth *auths = NULL;
+	unsigned length = 0;
+	char labels[128];
+	unsigned j;
+	size_t k;
+
+	if (!rules_parse(set, &auths, &length))
+		return;
+
+	rules_prepare(auths, length);
+
+	for (j = 0; j < reps; j++) {
+		const char *plugged = tree->intfs[tree->intf_len - 1];
+		char parent[PATH_MAX];
+		uint64_t start = now_ns();
+
+		counts_clear();
+		perform_rules_devices(auths, length, false);
+		samples_add(&init, now_ns() - start);
+
+		// like perform_interface without authorizing, the counts are taken from the init run
+		for (k = 0; k < tree->intf_len; k++) {
+			start = now_ns();
+			counts_begin_device(auths, length, device_parent(tree->intfs[k], parent, sizeof(parent)));
+			match_auths_interface(auths, length, tree->intfs[k]);
+			counts_commit_interface(device_sysname(tree->intfs[k]));
+			counts_end_device(auths, length);
+			samples_add(&decide, now_ns() - start);
+		}
+
+		// like usbauth udev-add for the last interface, the authorized attribute of the tree is written
+		start = now_ns();
+		perform_interface_add(auths, length, plugged);
+		samples_add(&add, now_ns() - start);
+	}
+
+	snprintf(labels, sizeof(labels), "topology=%s rules=%s size=%u", topo->name, set->name, set->rules);
+	samples_report(&decide, "decide", labels);
+	samples_report(&init, "init", labels);
+	samples_report(&add, "add", labels);
+
+	rules_release();
+	usbauth_config_free_auths(auths, length);
+	free(decide.ns);
+	free(init.ns);
+	free(add.ns);
+}
+
+static void bench_topology(const struct bench_topology *topo) {
+	struct bench_tree tree;
+	unsigned i;
+
+	if (!tree_create(&tree, topo) || !device_use_fixture(tree.base)) {
+		fprintf(stderr, "cannot create synthetic sysfs tree %s\n", topo->name);
+		tree_free(&tree);
+		return;
+	}
+
+	bench_snapshot(topo, &tree);
+
+	for (i = 0; i < sizeof(rule_sets) / sizeof(rule_sets[0]); i++)
+		bench_rules(topo, &tree, &rule_sets[i]);
+
+	tree_free(&tree);
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "usage: %s [-n repetitions] [-o output] [-x usbauth]\n", name);
+}
+
+int main(int argc, char **argv) {
+	const char *usbauth_path = "./usbauth";
+	const char *output = NULL;
+	unsigned i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:o:x:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			reps = strtoul(optarg, NULL, 10);
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'x':
+			usbauth_path = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (!reps)
+		reps = 1;
+
+	out = output ? fopen(output, "w") : stdout;
+
+	if (!out) {
+		fprintf(stderr, "cannot open %s\n", output);
+		return EXIT_FAILURE;
+	}
+
+	// the evaluation logs to syslog only, no D-Bus messages are sent because bus is not connected
+	// the notices of every evaluation would flood the system log
+	openlog("usbauth-bench", LOG_PID, LOG_LOCAL0);
+	setlogmask(LOG_UPTO(LOG_WARNING));
+
+	bench_start(usbauth_path);
+	bench_parse();
+
+	for (i = 0; i < sizeof(topologies) / sizeof(topologies[0]); i++)
+		bench_topology(&topologies[i]);
+
+	closelog();
+
+	if (out != stdout)
+		fclose(out);
+
+	return EXIT_SUCCESS;
+}
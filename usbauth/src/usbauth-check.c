@@ -0,0 +1,903 @@
+/*
+ * Copyright (c) 2018 Stefan Koch <stefan.koch10@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Description : equivalence tests of the rule evaluation on a fixture tree
+ *
+ * The results of usbauth are compared with a reference evaluator. The reference reads every
+ * value through the backend and matches every rule against every interface, like usbauth did
+ * without the rule index, the condition memo, the decision cache, the sibling summary and the
+ * parallel prefetch.
+ *
+ * init:     the authorized attributes and the counts after usbauth init, with and without authorizing
+ * add:      the authorized attribute and the counts after usbauth udev-add for every device
+ * prefetch: the snapshots read by parallel threads and by the backend
+ * backend:  init with a backend that has only read_attr and values that are not in the files
+ * memo:     the evaluations of every condition per interface, a condition without intfcount is evaluated once
+ * random:   init with random policies of anyChild rules and conditions
+ *
+ * Every rule set is checked without the decision cache, with a new and with a reopened cache file.
+ * The random policies are checked without the decision cache, a policy with a failed check is printed.
+ * A failed check is printed, the exit status is 1 if a check has failed.
+ */
+
+#include "usbauth.h"
+#include "usbauth-counts.h"
+#include "usbauth-dcache.h"
+#include "usbauth-device.h"
+#include "usbauth-fixture.h"
+#include "usbauth-prefetch.h"
+#include "usbauth-profile.h"
+
+#include <usbauth/usbauth-configparser.h>
+
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CHECK_MAX_INTFS 4
+#define CHECK_NOT_WRITTEN "2" // value of the authorized attributes before a check, usbauth writes 0 or 1
+#define CHECK_RANDOM_POLICIES 400
+#define CHECK_RANDOM_SEED 11
+
+// a device of the fixture tree with its interfaces
+struct check_device {
+	const char *path; // relative to the tree, the parents are listed before their childs
+	unsigned vendor;
+	unsigned product;
+	unsigned dev_class;
+	const char *serial; // NULL if the device has no serial
+	unsigned intf_len;
+	unsigned intf_classes[CHECK_MAX_INTFS];
+};
+
+struct check_rules {
+	const char *name;
+	const char *conf;
+};
+
+// decision of the reference evaluator
+struct ref_ret {
+	bool match;
+	bool allowed;
+};
+
+// fixture tree with all devices and interfaces
+struct check_tree {
+	char base[64];
+	struct device_list devs;
+	struct device_list intfs;
+};
+
+/*
+ * two root hubs, an external hub with a nested hub, composite devices,
+ * equal vendor and product IDs with different serials and devices without serial
+ */
+static const struct check_device devices[] = {
+	{ "usb1", 0x1d6b, 0x0002, 0x09, NULL, 1, { 0x09 } },
+	{ "usb1/1-1", 0x05e3, 0x0608, 0x09, NULL, 1, { 0x09 } },
+	{ "usb1/1-1/1-1.1", 0x046d, 0xc52b, 0x00, "A1", 3, { 0x03, 0x03, 0xff } },
+	{ "usb1/1-1/1-1.2", 0x0781, 0x5567, 0x00, NULL, 1, { 0x08 } },
+	{ "usb1/1-1/1-1.3", 0x05e3, 0x0608, 0x09, NULL, 1, { 0x09 } },
+	{ "usb1/1-1/1-1.3/1-1.3.1", 0x046d, 0xc52b, 0x00, "A2", 3, { 0x03, 0x03, 0xff } },
+	{ "usb1/1-1/1-1.3/1-1.3.2", 0x0bda, 0x8153, 0xef, "0001", 3, { 0xff, 0x02, 0x0a } },
+	{ "usb1/1-2", 0x0781, 0x5567, 0x00, "4C53", 1, { 0x08 } },
+	{ "usb2", 0x1d6b, 0x0003, 0x09, NULL, 1, { 0x09 } },
+	{ "usb2/2-1", 0x1050, 0x0407, 0x00, "0001", 3, { 0x03, 0x0b, 0x03 } },
+	{ "usb2/2-2", 0x04f2, 0xb604, 0xef, NULL, 4, { 0x0e, 0x0e, 0x01, 0x01 } },
+};
+
+/*
+ * index:    rules for vendor, product and interface class, the candidates of the rule index
+ * cond:     conditions with counts for multiple rules, the condition memo is invalidated by the intfcount
+ * anychild: anyChild rules, the sibling summary
+ * cache:    rules without counts and anyChild, the decisions are cached
+ * hub:      a denied nested hub, its devices are removed by the kernel before they are evaluated
+ * mixed:    conditions with anyChild, counts and string compares
+ */
+static const struct check_rules rule_sets[] = {
+	{ "index", "deny all\n"
+			"allow idVendor==046d idProduct==c52b\n"
+			"allow idVendor==0781 bInterfaceClass==08\n"
+			"allow bInterfaceClass==09\n"
+			"deny idVendor==046d bInterfaceClass==ff\n"
+			"allow idVendor==1050 idProduct!=0407\n"
+			"allow idProduct==b604 bInterfaceClass==0e\n"
+			"deny serial==A2\n" },
+	{ "cond", "allow all\n"
+			"condition intfcount<=1 case bInterfaceClass==03\n"
+			"condition devcount<=1 case idVendor==0781\n"
+			"condition bInterfaceProtocol==00 case bInterfaceClass==ff\n"
+			"allow bInterfaceClass==08 serial==4C53\n"
+			"allow bInterfaceClass==03 bNumEndpoints>=1\n"
+			"deny bInterfaceClass==03 intfcount>3\n" },
+	{ "anychild", "deny all\n"
+			"allow anyChild bInterfaceClass==03 bInterfaceClass!=03\n"
+			"allow anyChild bInterfaceClass==0e\n"
+			"deny anyChild bInterfaceClass==ff idVendor==046d\n"
+			"allow anyChild bInterfaceClass==09\n"
+			"allow anyChild bInterfaceProtocol==02 anyChild intfcount<=3\n" },
+	{ "cache", "deny all\n"
+			"allow idVendor==046d\n"
+			"allow bInterfaceClass==08 serial!=4C53\n"
+			"deny bInterfaceClass==ff\n"
+			"allow manufacturer==usbauth product>check\n"
+			"allow connectType==hotplug bInterfaceClass==0b\n"
+			"allow bDeviceClass==09 bInterfaceClass==09\n" },
+	{ "hub", "allow all\n"
+			"deny bInterfaceClass==09 devpath==1.3\n"
+			"deny idVendor==0781 devcount>1\n" },
+	{ "mixed", "allow all\n"
+			"deny bDeviceClass==ef\n"
+			"condition anyChild bInterfaceClass==02 case idVendor==0bda\n"
+			"allow bInterfaceClass==0a intfcount<=1\n"
+			"allow busnum==2 speed==480 devnum>a\n"
+			"condition devcount<2 case anyChild bInterfaceClass==03\n"
+			"allow idVendor==046d bInterfaceSubClass==01\n" },
+};
+
+// several ALLOW rules are applicable to an interface, only the last condition reads its intfcount
+static const struct check_rules memo_rules = { "memo", "allow all\n"
+		"allow bInterfaceClass==03\n"
+		"allow idVendor==046d\n"
+		"allow bInterfaceNumber<=01\n"
+		"condition bInterfaceProtocol<=02 case bInterfaceClass==03\n"
+		"condition serial!=A2 case idVendor==046d\n"
+		"condition intfcount<=8 case bInterfaceClass==03\n" };
+
+// data of the random policies, the values are interface classes and counts
+static const char *random_params[] = { "bInterfaceClass", "bInterfaceSubClass", "bInterfaceProtocol", "bInterfaceNumber", "idVendor", "intfcount" };
+static const char *random_ops[] = { "==", "!=", "<=", ">=", "<", ">" };
+static const char *random_vals[] = { "00", "01", "02", "03", "08", "09", "0e", "ff", "50", "1" };
+
+static unsigned checks = 0;
+static unsigned failures = 0;
+
+// the tree of the backend without snapshot_fill
+static const struct check_tree *attrs_tree = NULL;
+
+static void check(bool ok, const char *fmt, ...) {
+	va_list ap;
+
+	checks++;
+
+	if (ok)
+		return;
+
+	failures++;
+	printf("FAIL ");
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	printf("\n");
+}
+
+static bool tree_add_device(const char *base, const struct check_device *dev, unsigned devnum) {
+	const char *sysname = strrchr(dev->path, '/');
+	bool root = !sysname;
+	char path[PATH_MAX];
+	char name[32];
+	bool ret = true;
+	unsigned i;
+	struct fixture_device fdev = {
+		.busnum = strtoul(dev->path + 3, NULL, 10),
+		.devnum = devnum,
+		.vendor = dev->vendor,
+		.product = dev->product,
+		.dev_class = dev->dev_class,
+		.intf_len = dev->intf_len,
+		.serial = dev->serial,
+		.name = name,
+		.connect_type = root ? NULL : devnum % 2 ? "hotplug" : "hardwired", // the root hubs have no port
+	};
+
+	sysname = root ? dev->path : sysname + 1;
+	fdev.devpath = root ? "0" : strchr(sysname, '-') + 1;
+	fdev.speed = fdev.busnum == 2 ? "5000" : "480";
+	snprintf(name, sizeof(name), "check device %u", devnum);
+	snprintf(path, sizeof(path), "%s/%s", base, dev->path);
+
+	if (!fixture_tree_add_device(path, &fdev))
+		return false;
+
+	for (i = 0; ret && i < dev->intf_len; i++) {
+		char intf[PATH_MAX + 32];
+		struct fixture_interface fintf = { i, dev->intf_classes[i], (i + 1) % 2, i, 1 + i % 3 };
+
+		// the interfaces of the root hubs are named N-0:1.I
+		if (root)
+			snprintf(intf, sizeof(intf), "%s/%u-0:1.%u", path, fdev.busnum, i);
+		else
+			snprintf(intf, sizeof(intf), "%s/%s:1.%u", path, sysname, i);
+
+		ret = fixture_tree_add_interface(intf, &fdev, &fintf);
+	}
+
+	return ret;
+}
+
+static bool tree_create(struct check_tree *tree) {
+	unsigned i;
+
+	memset(tree, 0, sizeof(struct check_tree));
+
+	if (!fixture_tree_create(tree->base, sizeof(tree->base), "usbauth-check"))
+		return false;
+
+	for (i = 0; i < sizeof(devices) / sizeof(devices[0]); i++) {
+		if (!tree_add_device(tree->base, &devices[i], i + 1))
+			return false;
+	}
+
+	return device_use_fixture(tree->base) && device_enumerate(NULL, "usb_device", &tree->devs)
+			&& device_enumerate(NULL, "usb_interface", &tree->intfs);
+}
+
+static void tree_free(struct check_tree *tree) {
+	fixture_tree_remove(tree->base);
+
+	device_list_free(&tree->devs);
+	device_list_free(&tree->intfs);
+	memset(tree, 0, sizeof(struct check_tree));
+}
+
+static bool tree_reset_authorized(const struct check_tree *tree) {
+	bool ret = true;
+	unsigned i;
+
+	for (i = 0; i < tree->intfs.len; i++)
+		ret &= fixture_tree_write_attr(tree->intfs.paths[i], "authorized", CHECK_NOT_WRITTEN);
+
+	return ret;
+}
+
+static int tree_intf_index(const struct check_tree *tree, const char *intf) {
+	unsigned i;
+
+	for (i = 0; i < tree->intfs.len; i++) {
+		if (strcmp(tree->intfs.paths[i], intf) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+// parse a rule set into a mutable copy, the counts of the copy are changed by the evaluation
+static bool rules_parse(const char *conf, struct Auth **auths, unsigned *length) {
+	struct usbauth_config_ctx *ctx = usbauth_config_ctx_new();
+	const struct Auth *parsed = NULL;
+	bool ret = false;
+
+	*auths = NULL;
+	*length = 0;
+
+	if (ctx && usbauth_config_ctx_parse_buffer(ctx, conf, strlen(conf)) == 0) {
+		usbauth_config_ctx_get_auths(ctx, &parsed, length);
+		usbauth_allocate_and_copy(auths, parsed, *length);
+		ret = *auths != NULL;
+	}
+
+	usbauth_config_ctx_free(ctx);
+
+	return ret;
+}
+
+static bool ref_match_vals(const struct Auth *rule, const struct Data *d, const char *intf) {
+	char buf[256];
+	const char *lval = NULL;
+	char *end = NULL;
+	int rval = 0;
+
+	if (d->param == intfcount || d->param == devcount) {
+		rval = strtol(d->val, &end, 16);
+
+		if (*end)
+			return false;
+
+		return match_valsInt((d->param == intfcount ? rule->intfcount : rule->devcount) + 1, d->op, rval);
+	}
+
+	lval = device_get_param_valStr(d->param, intf, buf, sizeof(buf));
+
+	return lval && match_vals(lval, d->op, d->val);
+}
+
+// the eligible interfaces of the interface's device are enumerated for every check
+static bool ref_match_any_child(const struct Auth *rule, const struct Data *d, const char *intf) {
+	struct device_list intfs;
+	char parent[PATH_MAX];
+	bool ret = false;
+	int dev_class = 0;
+	unsigned i;
+
+	if (!device_parent(intf, parent, sizeof(parent)) || !device_enumerate(parent, "usb_interface", &intfs))
+		return false;
+
+	dev_class = device_get_param_val(bDeviceClass, parent);
+
+	for (i = 0; i < intfs.len; i++) {
+		if (dev_class == 9 && device_get_param_val(bInterfaceClass, intfs.paths[i]) != 9)
+			continue;
+
+		ret |= ref_match_vals(rule, d, intfs.paths[i]);
+	}
+
+	device_list_free(&intfs);
+
+	return ret;
+}
+
+static bool ref_match_data(const struct Auth *rule, const struct Data *d, const char *intf) {
+	return d->anyChild ? ref_match_any_child(rule, d, intf) : ref_match_vals(rule, d, intf);
+}
+
+static struct match_ret ref_match_auth(const struct Auth *rule, const char *intf) {
+	struct match_ret ret = { true, true, true };
+	unsigned i;
+
+	if (rule->type == COMMENT) {
+		ret.match_attrs = ret.match_conds = ret.match_attrs_nocnts = false;
+		return ret;
+	}
+
+	for (i = 0; i < rule->attr_len; i++) {
+		const struct Data *d = &rule->attr_array[i];
+		bool match = ref_match_data(rule, d, intf);
+
+		ret.match_attrs &= match;
+
+		if (d->param != devcount && d->param != intfcount)
+			ret.match_attrs_nocnts &= match;
+	}
+
+	for (i = 0; i < rule->cond_len && ret.match_attrs; i++)
+		ret.match_conds &= ref_match_data(rule, &rule->cond_array[i], intf);
+
+	return ret;
+}
+
+// every rule and every condition is matched again for every interface
+static struct ref_ret ref_match_auths(struct Auth *auths, unsigned length, const char *intf, bool *counted) {
+	struct ref_ret ret = { false, false };
+	unsigned i, j;
+
+	for (i = 0; i < length; i++) {
+		struct match_ret r1 = ref_match_auth(&auths[i], intf);
+		bool applicable = r1.match_attrs_nocnts;
+
+		if (auths[i].type == COND || !applicable)
+			continue;
+
+		for (j = 0; j < length && auths[i].type == ALLOW; j++) {
+			struct match_ret r = { false, false, false };
+
+			if (auths[j].type != COND)
+				continue;
+
+			r = ref_match_auth(&auths[j], intf);
+
+			if (r.match_attrs && r.match_conds) {
+				auths[j].intfcount++;
+				counted[j] = true;
+			} else if (r.match_attrs) {
+				applicable = false;
+			}
+		}
+
+		if (applicable) {
+			auths[i].intfcount++;
+			counted[i] = true;
+
+			if (r1.match_attrs) {
+				ret.match = true;
+				ret.allowed = auths[i].type == ALLOW;
+			}
+		}
+	}
+
+	return ret;
+}
+
+static bool path_below(const char *path, const char *dir) {
+	size_t len = strlen(dir);
+
+	return strncmp(path, dir, len) == 0 && path[len] == '/';
+}
+
+/*
+ * like usbauth init: the devices one by one, the devcount is incremented after a device,
+ * if the decisions are written, the devices below a denied hub interface are removed before they are reached,
+ * expected gets the authorized values, or CHECK_NOT_WRITTEN
+ */
+static void ref_scan(struct Auth *auths, unsigned length, const struct check_tree *tree, const char *exclude, bool apply, const char **expected) {
+	struct device_list removed = { NULL, 0 };
+	bool *counted = calloc(length ? length : 1, sizeof(bool));
+	unsigned i, j, k;
+
+	for (i = 0; counted && i < tree->devs.len; i++) {
+		const char *dev = tree->devs.paths[i];
+		struct device_list intfs;
+		int dev_class = 0;
+		bool skip = exclude && strcmp(dev, exclude) == 0;
+
+		for (k = 0; k < removed.len && !skip; k++)
+			skip = path_below(dev, removed.paths[k]);
+
+		if (skip || !device_enumerate(dev, "usb_interface", &intfs))
+			continue;
+
+		memset(counted, 0, length * sizeof(bool));
+		dev_class = device_get_param_val(bDeviceClass, dev);
+
+		for (j = 0; j < intfs.len; j++) {
+			const char *intf = intfs.paths[j];
+			int intf_class = device_get_param_val(bInterfaceClass, intf);
+			char parent[PATH_MAX];
+			struct ref_ret r;
+			char **arr = NULL;
+
+			if (dev_class == 9 && intf_class != 9)
+				continue;
+
+			r = ref_match_auths(auths, length, intf, counted);
+
+			if (!apply || !r.match)
+				continue;
+
+			expected[tree_intf_index(tree, intf)] = r.allowed ? "1" : "0";
+
+			// the kernel disconnects the hub driver, the devices at the hub's ports are removed
+			if (r.allowed || intf_class != 9 || !device_parent(intf, parent, sizeof(parent)))
+				continue;
+
+			arr = realloc(removed.paths, (removed.len + 1) * sizeof(char*));
+
+			if (arr) {
+				removed.paths = arr;
+				removed.paths[removed.len] = strdup(parent);
+				removed.len += removed.paths[removed.len] != NULL;
+			}
+		}
+
+		for (k = 0; k < length; k++)
+			auths[k].devcount += counted[k];
+
+		device_list_free(&intfs);
+	}
+
+	device_list_free(&removed);
+	free(counted);
+}
+
+static bool data_counts(const struct Data *arr, unsigned len) {
+	unsigned i;
+
+	for (i = 0; i < len; i++) {
+		if (arr[i].param == intfcount || arr[i].param == devcount)
+			return true;
+	}
+
+	return false;
+}
+
+// the counts are only compared if a rule reads them, a decision of the decision cache is not counted
+static void check_counts(const char *test, const char *labels, const struct Auth *auths, const struct Auth *ref, unsigned length) {
+	bool used = false;
+	unsigned i;
+
+	for (i = 0; i < length; i++)
+		used |= data_counts(auths[i].attr_array, auths[i].attr_len) || data_counts(auths[i].cond_array, auths[i].cond_len);
+
+	for (i = 0; i < length && used; i++) {
+		check(auths[i].intfcount == ref[i].intfcount && auths[i].devcount == ref[i].devcount,
+				"%s %s rule=%u intfcount=%u expected=%u devcount=%u expected=%u",
+				test, labels, i + 1, auths[i].intfcount, ref[i].intfcount, auths[i].devcount, ref[i].devcount);
+	}
+}
+
+static void check_authorized(const char *test, const char *labels, const struct check_tree *tree, const char **expected) {
+	char val[16];
+	unsigned i;
+
+	for (i = 0; i < tree->intfs.len; i++) {
+		if (!device_read_attr(tree->intfs.paths[i], "authorized", val, sizeof(val)))
+			strcpy(val, "none");
+
+		check(strcmp(val, expected[i]) == 0, "%s %s interface=%s authorized=%s expected=%s",
+				test, labels, device_sysname(tree->intfs.paths[i]), val, expected[i]);
+	}
+}
+
+// two copies of the rules, one is evaluated by usbauth, one by the reference
+static bool check_begin(const struct check_tree *tree, const struct check_rules *set, struct Auth **auths, struct Auth **ref, unsigned *length, const char **expected) {
+	unsigned ref_len = 0;
+	unsigned i;
+
+	for (i = 0; i < tree->intfs.len; i++)
+		expected[i] = CHECK_NOT_WRITTEN;
+
+	if (!rules_parse(set->conf, auths, length) || !rules_parse(set->conf, ref, &ref_len) || !tree_reset_authorized(tree))
+		return false;
+
+	rules_prepare(*auths, *length);
+
+	return true;
+}
+
+static void check_end(struct Auth *auths, struct Auth *ref, unsigned length) {
+	rules_release();
+
+	if (auths)
+		usbauth_config_free_auths(auths, length);
+
+	if (ref)
+		usbauth_config_free_auths(ref, length);
+}
+
+static void check_init(const struct check_tree *tree, const struct check_rules *set, const char *labels, bool add) {
+	const char **expected = calloc(tree->intfs.len, sizeof(char*));
+	const char *test = add ? "init" : "count";
+	struct Auth *auths = NULL;
+	struct Auth *ref = NULL;
+	unsigned length = 0;
+
+	if (!expected || !check_begin(tree, set, &auths, &ref, &length, expected)) {
+		check(false, "%s %s cannot prepare the check", test, labels);
+	} else {
+		perform_rules_devices(auths, length, add);
+		ref_scan(ref, length, tree, NULL, add, expected);
+
+		check_counts(test, labels, auths, ref, length);
+		check_authorized(test, labels, tree, expected);
+	}
+
+	check_end(auths, ref, length);
+	free(expected);
+}
+
+// every interface is plugged once, the other devices are counted before
+static void check_add(const struct check_tree *tree, const struct check_rules *set, const char *labels) {
+	const char **expected = calloc(tree->intfs.len, sizeof(char*));
+	unsigned i, j;
+
+	for (i = 0; expected && i < tree->intfs.len; i++) {
+		const char *intf = tree->intfs.paths[i];
+		bool *counted = NULL;
+		struct Auth *auths = NULL;
+		struct Auth *ref = NULL;
+		unsigned length = 0;
+		char parent[PATH_MAX];
+		struct ref_ret r;
+
+		if (!device_parent(intf, parent, sizeof(parent)) || !check_begin(tree, set, &auths, &ref, &length, expected)
+				|| !(counted = calloc(length ? length : 1, sizeof(bool)))) {
+			check(false, "add %s interface=%s cannot prepare the check", labels, device_sysname(intf));
+			check_end(auths, ref, length);
+			continue;
+		}
+
+		perform_interface_add(auths, length, intf);
+
+		ref_scan(ref, length, tree, parent, false, expected);
+		r = ref_match_auths(ref, length, intf, counted);
+
+		for (j = 0; j < length; j++)
+			ref[j].devcount += counted[j];
+
+		if (r.match)
+			expected[i] = r.allowed ? "1" : "0";
+
+		check_counts("add", labels, auths, ref, length);
+		check_authorized("add", labels, tree, expected);
+
+		check_end(auths, ref, length);
+		free(counted);
+	}
+
+	free(expected);
+}
+
+// the threads must read the same values as the backend
+static void check_prefetch(const struct check_tree *tree) {
+	struct prefetch_item *items = calloc(tree->intfs.len, sizeof(struct prefetch_item));
+	struct prefetch_item **ptrs = calloc(tree->intfs.len, sizeof(struct prefetch_item*));
+	unsigned i, param;
+
+	if (!items || !ptrs) {
+		check(false, "prefetch cannot prepare the check");
+		free(items);
+		free(ptrs);
+		return;
+	}
+
+	for (i = 0; i < tree->intfs.len; i++) {
+		items[i].syspath = tree->intfs.paths[i];
+		ptrs[i] = &items[i];
+	}
+
+	prefetch_snapshots(ptrs, tree->intfs.len, PARAM_BITS_SYSFS, PREFETCH_MAX_THREADS);
+
+	for (i = 0; i < tree->intfs.len; i++) {
+		const char *name = device_sysname(items[i].syspath);
+		struct Snapshot snap;
+
+		device_snapshot_fill(&snap, items[i].syspath);
+		check(items[i].filled, "prefetch interface=%s not filled", name);
+
+		for (param = INVALID + 1; param < PARAM_NUM_ITEMS; param++) {
+			const char *val = usbauth_snapshot_get_valStr(&items[i].snap, param);
+			const char *ref = usbauth_snapshot_get_valStr(&snap, param);
+
+			check((!val && !ref) || (val && ref && strcmp(val, ref) == 0), "prefetch interface=%s param=%s value=%s expected=%s",
+					name, usbauth_param_to_str(param), val ? val : "none", ref ? ref : "none");
+		}
+	}
+
+	free(items);
+	free(ptrs);
+}
+
+// the decisions must be equal to the reference and a condition is not evaluated again for every ALLOW rule
+static void check_memo(const struct check_tree *tree) {
+	const char **expected = calloc(tree->intfs.len, sizeof(char*));
+	bool *counted = NULL;
+	struct Auth *auths = NULL;
+	struct Auth *ref = NULL;
+	unsigned length = 0;
+	unsigned i, j;
+
+	if (!expected || !check_begin(tree, &memo_rules, &auths, &ref, &length, expected) || !(counted = calloc(length, sizeof(bool)))) {
+		check(false, "memo cannot prepare the check");
+		check_end(auths, ref, length);
+		free(expected);
+		return;
+	}
+
+	profiling = true;
+
+	for (i = 0; i < tree->intfs.len; i++) {
+		const char *intf = tree->intfs.paths[i];
+		struct ref_ret r = ref_match_auths(ref, length, intf, counted);
+		struct auth_ret ret;
+
+		profile_clear_rules();
+		ret = match_auths_interface(auths, length, intf);
+
+		check(ret.match == r.match && ret.allowed == r.allowed, "memo interface=%s match=%d allowed=%d expected match=%d allowed=%d",
+				device_sysname(intf), ret.match, ret.allowed, r.match, r.allowed);
+
+		for (j = 0; j < length; j++) {
+			if (auths[j].type == COND && !data_counts(auths[j].attr_array, auths[j].attr_len) && !data_counts(auths[j].cond_array, auths[j].cond_len))
+				check(profile_rule_evals(j) <= 1, "memo interface=%s rule=%u evaluations=%u expected=1",
+						device_sysname(intf), j + 1, profile_rule_evals(j));
+		}
+	}
+
+	check_counts("memo", "rules=memo", auths, ref, length);
+
+	profiling = false;
+	profile_free();
+	check_end(auths, ref, length);
+	free(counted);
+	free(expected);
+}
+
+// the devices are taken from the lists of the tree, like an in-memory backend
+static bool attrs_enumerate(const char *parent, const char *devtype, struct device_list *list) {
+	const struct device_list *all = strcmp(devtype, "usb_device") == 0 ? &attrs_tree->devs : &attrs_tree->intfs;
+	size_t len = parent ? strlen(parent) : 0;
+	unsigned i;
+
+	for (i = 0; i < all->len; i++) {
+		const char *path = all->paths[i];
+		char **arr = NULL;
+
+		if (parent && (strncmp(path, parent, len) != 0 || (path[len] != '/' && path[len] != 0)))
+			continue;
+
+		arr = realloc(list->paths, (list->len + 1) * sizeof(char*));
+		if (!arr)
+			return false;
+
+		list->paths = arr;
+		list->paths[list->len] = strdup(path);
+
+		if (!list->paths[list->len])
+			return false;
+
+		list->len++;
+	}
+
+	return true;
+}
+
+static bool attrs_read_attr(const char *syspath, const char *attr, char *buf, size_t size) {
+	char path[PATH_MAX];
+	FILE *f = NULL;
+	size_t len = 0;
+
+	snprintf(path, sizeof(path), "%s/%s", syspath, attr);
+	f = fopen(path, "r");
+
+	if (!f)
+		return false;
+
+	len = fread(buf, 1, size - 1, f);
+	fclose(f);
+
+	while (len > 0 && buf[len - 1] == '\n')
+		len--;
+	buf[len] = 0;
+
+	// a value that only the backend knows, a reader of the files gets another decision
+	if (strcmp(attr, "bInterfaceClass") == 0 && strcmp(buf, "08") == 0 && size > 2)
+		strcpy(buf, "ff");
+
+	return true;
+}
+
+static bool attrs_write_attr(const char *syspath, const char *attr, const char *val) {
+	return fixture_tree_write_attr(syspath, attr, "%s", val);
+}
+
+static bool attrs_probe(const struct device_list *intfs) {
+	return true;
+}
+
+static const struct device_ops attrs_ops = {
+	.name = "attrs",
+	.enumerate = attrs_enumerate,
+	.read_attr = attrs_read_attr,
+	.write_attr = attrs_write_attr,
+	.probe = attrs_probe,
+};
+
+// every value must be read through the backend, the mass storage interfaces are vendor specific for it
+static void check_backend(const struct check_tree *tree) {
+	unsigned i;
+
+	attrs_tree = tree;
+	device_set_ops(&attrs_ops);
+
+	for (i = 0; i < sizeof(rule_sets) / sizeof(rule_sets[0]); i++) {
+		char labels[64];
+
+		snprintf(labels, sizeof(labels), "rules=%s backend=attrs", rule_sets[i].name);
+
+		check_init(tree, &rule_sets[i], labels, true);
+	}
+
+	if (!device_use_fixture(tree->base))
+		check(false, "backend cannot use the fixture tree again");
+
+	attrs_tree = NULL;
+}
+
+// linear congruential generator, so the policies are equal on every system
+static unsigned random_next(unsigned *state, unsigned n) {
+	*state = *state * 1103515245 + 12345;
+
+	return (*state >> 16) % n;
+}
+
+// one to five rules or conditions with one to three data, each one could be anyChild
+static char* random_policy(unsigned *state) {
+	char *buf = NULL;
+	size_t len = 0;
+	FILE *f = open_memstream(&buf, &len);
+	unsigned rules = 1 + random_next(state, 5);
+	unsigned i, j;
+
+	if (!f)
+		return NULL;
+
+	for (i = 0; i < rules; i++) {
+		bool cond = random_next(state, 5) == 0;
+		unsigned data = 1 + random_next(state, 3);
+
+		fprintf(f, "%s", cond ? "condition" : random_next(state, 2) ? "allow" : "deny");
+
+		for (j = 0; j < data; j++) {
+			fprintf(f, " %s", random_next(state, 2) ? "anyChild " : "");
+			fprintf(f, "%s", random_params[random_next(state, sizeof(random_params) / sizeof(random_params[0]))]);
+			fprintf(f, "%s", random_ops[random_next(state, sizeof(random_ops) / sizeof(random_ops[0]))]);
+			fprintf(f, "%s", random_vals[random_next(state, sizeof(random_vals) / sizeof(random_vals[0]))]);
+		}
+
+		// the case of a condition is one of the interface descriptors
+		if (cond)
+			fprintf(f, " case %s%s==03", random_next(state, 2) ? "anyChild " : "", random_params[random_next(state, 4)]);
+
+		fprintf(f, "\n");
+	}
+
+	if (fclose(f)) {
+		free(buf);
+		return NULL;
+	}
+
+	return buf;
+}
+
+static void check_random(const struct check_tree *tree) {
+	unsigned state = CHECK_RANDOM_SEED;
+	unsigned i;
+
+	for (i = 0; i < CHECK_RANDOM_POLICIES; i++) {
+		struct check_rules set = { "random", random_policy(&state) };
+		unsigned failed = failures;
+		char labels[64];
+
+		if (!set.conf) {
+			check(false, "random policy=%u cannot create the policy", i);
+			continue;
+		}
+
+		snprintf(labels, sizeof(labels), "rules=random policy=%u", i);
+
+		check_init(tree, &set, labels, false);
+		check_init(tree, &set, labels, true);
+
+		if (failures != failed)
+			printf("policy %u:\n%s", i, set.conf);
+
+		free((char*) set.conf);
+	}
+}
+
+int main(int argc, char **argv) {
+	static const char *caches[] = { "none", "new", "reopened" };
+	struct check_tree tree;
+	char cache[PATH_MAX];
+	unsigned i, j;
+
+	if (!tree_create(&tree)) {
+		fprintf(stderr, "cannot create the fixture tree\n");
+		tree_free(&tree);
+		return EXIT_FAILURE;
+	}
+
+	snprintf(cache, sizeof(cache), "%s/decisions.cache", tree.base);
+	check_prefetch(&tree);
+
+	// the decisions of the first run with a cache file are looked up in the following runs
+	for (i = 0; i < sizeof(caches) / sizeof(caches[0]); i++) {
+		dcache_free();
+
+		if (i && !dcache_init(cache))
+			check(false, "cannot map the decision cache %s", cache);
+
+		for (j = 0; j < sizeof(rule_sets) / sizeof(rule_sets[0]); j++) {
+			char labels[64];
+
+			snprintf(labels, sizeof(labels), "rules=%s cache=%s", rule_sets[j].name, caches[i]);
+
+			check_init(&tree, &rule_sets[j], labels, false);
+			check_init(&tree, &rule_sets[j], labels, true);
+			check_add(&tree, &rule_sets[j], labels);
+		}
+	}
+
+	dcache_free();
+	check_backend(&tree);
+	check_memo(&tree);
+	check_random(&tree);
+	tree_free(&tree);
+
+	printf("checks=%u failures=%u\n", checks, failures);
+
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,329 @@
+/*
+ * Copyright (c) 2018 Stefan Koch <stefan.koch10@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Description : bookkeeping of the devcount and intfcount counters
+ */
+
+#include "usbauth-counts.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// rules that counted an interface, a condition could count an interface multiple times
+struct counted_intf {
+	char *sysname;
+	unsigned *rules;
+	unsigned rule_len;
+	bool fresh; // evaluated since counts_begin_device()
+};
+
+struct counted_dev {
+	char *syspath;
+	struct counted_intf *intfs;
+	unsigned intf_len;
+};
+
+static struct counted_dev *devs = NULL; // sorted by syspath
+static unsigned dev_len = 0;
+static struct counted_dev *open_dev = NULL;
+
+static unsigned *marks = NULL;
+static unsigned mark_len = 0;
+static unsigned mark_size = 0;
+
+static int cmp_unsigned(const void *a, const void *b) {
+	unsigned l = *(const unsigned*) a;
+	unsigned r = *(const unsigned*) b;
+
+	return l < r ? -1 : l > r;
+}
+
+// binary search, pos is set to the index of the device or where it is inserted
+static struct counted_dev* find_dev(const char *syspath, unsigned *pos) {
+	unsigned lo = 0;
+	unsigned hi = dev_len;
+
+	while (lo < hi) {
+		unsigned mid = lo + (hi - lo) / 2;
+		int cmp = strcmp(devs[mid].syspath, syspath);
+
+		if (cmp == 0) {
+			*pos = mid;
+			return &devs[mid];
+		}
+
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	*pos = lo;
+	return NULL;
+}
+
+static struct counted_intf* find_intf(struct counted_dev *dev, const char *sysname) {
+	unsigned i;
+	for (i = 0; i < dev->intf_len; i++) {
+		if (strcmp(dev->intfs[i].sysname, sysname) == 0)
+			return &dev->intfs[i];
+	}
+
+	return NULL;
+}
+
+static void add_intfcounts(struct Auth *auths, size_t length, const struct counted_intf *intf, int sign) {
+	unsigned i;
+	for (i = 0; i < intf->rule_len; i++) {
+		if (intf->rules[i] < length)
+			auths[intf->rules[i]].intfcount += sign;
+	}
+}
+
+// increments or decrements the devcount of every rule that counted at minimum one of the device's interfaces
+static void add_devcounts(struct Auth *auths, size_t length, const struct counted_dev *dev, int sign) {
+	unsigned *rules = NULL;
+	unsigned len = 0;
+	unsigned i;
+
+	for (i = 0; i < dev->intf_len; i++)
+		len += dev->intfs[i].rule_len;
+
+	if (!len)
+		return;
+
+	rules = calloc(len, sizeof(unsigned));
+	if (!rules)
+		return;
+
+	len = 0;
+	for (i = 0; i < dev->intf_len; i++) {
+		if (dev->intfs[i].rule_len)
+			memcpy(rules + len, dev->intfs[i].rules, dev->intfs[i].rule_len * sizeof(unsigned));
+		len += dev->intfs[i].rule_len;
+	}
+
+	qsort(rules, len, sizeof(unsigned), cmp_unsigned);
+
+	for (i = 0; i < len; i++) {
+		if ((i == 0 || rules[i] != rules[i-1]) && rules[i] < length)
+			auths[rules[i]].devcount += sign;
+	}
+
+	free(rules);
+}
+
+static void free_intf(struct counted_intf *intf) {
+	free(intf->sysname);
+	free(intf->rules);
+	intf->sysname = NULL;
+	intf->rules = NULL;
+	intf->rule_len = 0;
+}
+
+static void free_dev(struct counted_dev *dev) {
+	unsigned i;
+	for (i = 0; i < dev->intf_len; i++)
+		free_intf(&dev->intfs[i]);
+
+	free(dev->intfs);
+	free(dev->syspath);
+	dev->intfs = NULL;
+	dev->syspath = NULL;
+	dev->intf_len = 0;
+}
+
+static void delete_dev(struct counted_dev *dev) {
+	unsigned pos = dev - devs;
+
+	free_dev(dev);
+
+	// the following devices are moved, so the array stays sorted
+	memmove(dev, dev + 1, (--dev_len - pos) * sizeof(struct counted_dev));
+}
+
+void counts_mark(unsigned rule) {
+	if (mark_len == mark_size) {
+		unsigned size = mark_size ? 2 * mark_size : 16;
+		unsigned *arr = realloc(marks, size * sizeof(unsigned));
+
+		if (!arr)
+			return;
+
+		marks = arr;
+		mark_size = size;
+	}
+
+	marks[mark_len++] = rule;
+}
+
+void counts_begin_device(struct Auth *auths, size_t length, const char *syspath) {
+	struct counted_dev *arr = NULL;
+	char *copy = NULL;
+	unsigned pos = 0;
+	unsigned i;
+
+	mark_len = 0;
+	open_dev = NULL;
+
+	if (!syspath)
+		return;
+
+	open_dev = find_dev(syspath, &pos);
+
+	if (open_dev) {
+		for (i = 0; i < open_dev->intf_len; i++) {
+			add_intfcounts(auths, length, &open_dev->intfs[i], -1);
+			open_dev->intfs[i].fresh = false;
+		}
+		add_devcounts(auths, length, open_dev, -1);
+		return;
+	}
+
+	copy = strdup(syspath);
+	if (!copy)
+		return;
+
+	arr = realloc(devs, (dev_len + 1) * sizeof(struct counted_dev));
+	if (!arr) {
+		free(copy);
+		return;
+	}
+
+	devs = arr;
+	memmove(&devs[pos + 1], &devs[pos], (dev_len - pos) * sizeof(struct counted_dev));
+	dev_len++;
+
+	open_dev = &devs[pos];
+	memset(open_dev, 0, sizeof(struct counted_dev));
+	open_dev->syspath = copy;
+}
+
+void counts_commit_interface(const char *sysname) {
+	struct counted_intf *intf = NULL;
+
+	if (!open_dev || !sysname) {
+		mark_len = 0;
+		return;
+	}
+
+	intf = find_intf(open_dev, sysname);
+
+	if (!intf) {
+		struct counted_intf *arr = realloc(open_dev->intfs, (open_dev->intf_len + 1) * sizeof(struct counted_intf));
+		if (!arr) {
+			mark_len = 0;
+			return;
+		}
+
+		open_dev->intfs = arr;
+		intf = &open_dev->intfs[open_dev->intf_len];
+		memset(intf, 0, sizeof(struct counted_intf));
+		intf->sysname = strdup(sysname);
+
+		if (!intf->sysname) {
+			mark_len = 0;
+			return;
+		}
+
+		open_dev->intf_len++;
+	}
+
+	free(intf->rules);
+	intf->rules = NULL;
+	intf->rule_len = 0;
+
+	if (mark_len) {
+		intf->rules = calloc(mark_len, sizeof(unsigned));
+		if (intf->rules) {
+			memcpy(intf->rules, marks, mark_len * sizeof(unsigned));
+			intf->rule_len = mark_len;
+		}
+	}
+
+	// the intfcount was already incremented by the evaluation
+	intf->fresh = true;
+	mark_len = 0;
+}
+
+void counts_end_device(struct Auth *auths, size_t length) {
+	unsigned i;
+
+	mark_len = 0;
+
+	if (!open_dev)
+		return;
+
+	// restore the intfcount of interfaces that were not evaluated again
+	for (i = 0; i < open_dev->intf_len; i++) {
+		if (!open_dev->intfs[i].fresh)
+			add_intfcounts(auths, length, &open_dev->intfs[i], 1);
+		open_dev->intfs[i].fresh = false;
+	}
+
+	add_devcounts(auths, length, open_dev, 1);
+	open_dev = NULL;
+}
+
+void counts_remove_device(struct Auth *auths, size_t length, const char *syspath) {
+	unsigned pos = 0;
+	struct counted_dev *dev = syspath ? find_dev(syspath, &pos) : NULL;
+	unsigned i;
+
+	if (!dev)
+		return;
+
+	for (i = 0; i < dev->intf_len; i++)
+		add_intfcounts(auths, length, &dev->intfs[i], -1);
+	add_devcounts(auths, length, dev, -1);
+
+	delete_dev(dev);
+}
+
+void counts_remove_interface(struct Auth *auths, size_t length, const char *syspath, const char *sysname) {
+	unsigned pos = 0;
+	struct counted_dev *dev = syspath ? find_dev(syspath, &pos) : NULL;
+	struct counted_intf *intf = NULL;
+
+	if (!dev || !sysname)
+		return;
+
+	intf = find_intf(dev, sysname);
+	if (!intf)
+		return;
+
+	add_devcounts(auths, length, dev, -1);
+	add_intfcounts(auths, length, intf, -1);
+
+	free_intf(intf);
+	*intf = dev->intfs[--dev->intf_len];
+
+	add_devcounts(auths, length, dev, 1);
+}
+
+void counts_clear() {
+	unsigned i;
+	for (i = 0; i < dev_len; i++)
+		free_dev(&devs[i]);
+
+	free(devs);
+	devs = NULL;
+	dev_len = 0;
+	open_dev = NULL;
+
+	free(marks);
+	marks = NULL;
+	mark_len = 0;
+	mark_size = 0;
+}
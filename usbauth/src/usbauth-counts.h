@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2018 Stefan Koch <stefan.koch10@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Description : bookkeeping of the devcount and intfcount counters
+ *
+ * For every device the rules are stored that counted its interfaces.
+ * The counters of the rules are then updated incrementally at add and remove
+ * instead of matching all rules against all available devices again.
+ */
+
+#ifndef USBAUTH_COUNTS_H_
+#define USBAUTH_COUNTS_H_
+
+#include <usbauth/generic.h>
+
+#include <stddef.h>
+
+/**
+ * remember that a rule has counted the currently evaluated interface
+ * the intfcount of the rule must be incremented by the caller
+ *
+ * @rule: index of the rule within the rule array
+ */
+void counts_mark(unsigned rule);
+
+/**
+ * start the evaluation of a device's interfaces
+ * the counts of the device are subtracted from the rules,
+ * so the device's interfaces see only the counts of the other devices
+ *
+ * @auths: auth rules
+ * @length: auth rules length
+ * @syspath: syspath of the usb_device
+ */
+void counts_begin_device(struct Auth *auths, size_t length, const char *syspath);
+
+/**
+ * store the rules marked since the last commit for an interface
+ * of the device given to counts_begin_device()
+ *
+ * @sysname: sysname of the usb_interface
+ */
+void counts_commit_interface(const char *sysname);
+
+/**
+ * finish the evaluation of a device
+ * the devcount is incremented once for every rule that counted
+ * at minimum one interface of the device
+ *
+ * @auths: auth rules
+ * @length: auth rules length
+ */
+void counts_end_device(struct Auth *auths, size_t length);
+
+/**
+ * subtract the counts of a removed device and forget it
+ *
+ * @auths: auth rules
+ * @length: auth rules length
+ * @syspath: syspath of the usb_device
+ */
+void counts_remove_device(struct Auth *auths, size_t length, const char *syspath);
+
+/**
+ * subtract the counts of a removed interface and forget it
+ *
+ * @auths: auth rules
+ * @length: auth rules length
+ * @syspath: syspath of the interface's usb_device
+ * @sysname: sysname of the usb_interface
+ */
+void counts_remove_interface(struct Auth *auths, size_t length, const char *syspath, const char *sysname);
+
+/**
+ * forget all devices, example: the rules were reloaded
+ */
+void counts_clear();
+
+#endif /* USBAUTH_COUNTS_H_ */
@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) 2018 Stefan Koch <stefan.koch10@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Description : persistent cache of the decisions for interfaces
+ */
+
+#include "usbauth-dcache.h"
+
+#include <usbauth/usbauth-configparser.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define DCACHE_MAGIC "USBAUTHD"
+#define DCACHE_VERSION 2
+#define DCACHE_BYTE_ORDER 0x01020304
+#define DCACHE_SLOTS 4096
+#define DCACHE_PROBES 8 // slots searched after the home slot of a key
+#define DCACHE_KEY_SIZE 236 // a slot has 256 bytes, interfaces with a longer key are not cached
+
+// parameters that identify an interface, used in every key
+#define PARAM_BITS_FINGERPRINT (PARAM_BIT(idVendor) | PARAM_BIT(idProduct) | PARAM_BIT(bcdDevice) | PARAM_BIT(serial) \
+		| PARAM_BIT(bInterfaceNumber) | PARAM_BIT(bInterfaceClass) | PARAM_BIT(bInterfaceSubClass) | PARAM_BIT(bInterfaceProtocol))
+
+// layout of the file: header, slots
+struct dcache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order; // written in host byte order to detect a foreign file
+	uint64_t policy; // hash of the rules that the decisions belong to
+	uint32_t slots;
+	uint32_t reserved;
+};
+
+struct dcache_slot {
+	uint64_t hash; // hash of the key, only selects the home slot
+	int32_t rule; // index of the deciding rule, -1 if no rule has matched
+	uint32_t allowed;
+	uint32_t key_len; // 0 if the slot is empty
+	uint8_t key[DCACHE_KEY_SIZE]; // the parameters of the interface, compared at lookup
+};
+
+// canonical key of an interface
+struct dcache_key {
+	uint64_t hash;
+	uint32_t len;
+	uint8_t data[DCACHE_KEY_SIZE];
+};
+
+static int cache_fd = -1;
+static struct dcache_header *header = NULL;
+static struct dcache_slot *slots = NULL;
+static size_t map_len = 0;
+static uint64_t policy = 0; // hash of the prepared rules, 0 if the cache is not used
+static uint32_t key_params = 0;
+static size_t rules_len = 0;
+
+// 64 bit FNV-1a hash, continued from hash
+static uint64_t hash_data(uint64_t hash, const void *data, size_t size) {
+	const uint8_t *p = data;
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		hash ^= p[i];
+		hash *= UINT64_C(1099511628211);
+	}
+
+	return hash;
+}
+
+static uint64_t hash_init() {
+	return UINT64_C(14695981039346656037);
+}
+
+static bool header_valid(const struct dcache_header *hdr) {
+	return memcmp(hdr->magic, DCACHE_MAGIC, sizeof(hdr->magic)) == 0 && hdr->version == DCACHE_VERSION
+			&& hdr->byte_order == DCACHE_BYTE_ORDER && hdr->slots == DCACHE_SLOTS;
+}
+
+bool dcache_init(const char *path) {
+	struct dcache_header hdr;
+	struct stat st;
+	size_t len = sizeof(struct dcache_header) + DCACHE_SLOTS * sizeof(struct dcache_slot);
+	void *map = MAP_FAILED;
+	bool valid = false;
+	int fd = -1;
+
+	if (header)
+		return true;
+
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return false;
+
+	// an invalid file is initialized once, other processes wait for it
+	if (flock(fd, LOCK_EX)) {
+		close(fd);
+		return false;
+	}
+
+	valid = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size == (off_t) len
+			&& pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) && header_valid(&hdr);
+
+	if (valid || ftruncate(fd, len) == 0)
+		map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	// the file is not shrunk to 0 before, so the mappings of other processes stay accessible
+	if (!valid && map != MAP_FAILED) {
+		memset(map, 0, len);
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(hdr.magic, DCACHE_MAGIC, sizeof(hdr.magic));
+		hdr.version = DCACHE_VERSION;
+		hdr.byte_order = DCACHE_BYTE_ORDER;
+		hdr.slots = DCACHE_SLOTS;
+		memcpy(map, &hdr, sizeof(hdr));
+	}
+
+	flock(fd, LOCK_UN);
+
+	if (map == MAP_FAILED) {
+		syslog(LOG_ERR, "cannot map decision cache %s\n", path);
+		close(fd);
+		return false;
+	}
+
+	cache_fd = fd;
+	header = map;
+	slots = (struct dcache_slot*) (header + 1);
+	map_len = len;
+
+	return true;
+}
+
+static bool data_independent(const struct Data *arr, unsigned len) {
+	unsigned i;
+
+	for (i = 0; i < len; i++) {
+		if (arr[i].anyChild || arr[i].param == devcount || arr[i].param == intfcount)
+			return false;
+	}
+
+	return true;
+}
+
+uint32_t dcache_prepare(const struct Auth *auths, size_t length) {
+	uint64_t hash = hash_init();
+	size_t i;
+
+	policy = 0;
+	key_params = 0;
+	rules_len = length;
+
+	if (!header)
+		return 0;
+
+	for (i = 0; i < length; i++) {
+		const char *str = NULL;
+
+		// the decision of an interface must depend only on its own parameters
+		if (!data_independent(auths[i].attr_array, auths[i].attr_len) || !data_independent(auths[i].cond_array, auths[i].cond_len)) {
+			syslog(LOG_NOTICE, "decision cache not used, rule %u depends on other interfaces\n", (unsigned) i + 1);
+			return 0;
+		}
+
+		str = usbauth_auth_to_str(&auths[i]);
+		if (!str)
+			return 0;
+
+		hash = hash_data(hash, str, strlen(str) + 1);
+		free((char*) str);
+	}
+
+	key_params = usbauth_auths_params(auths, length) | PARAM_BITS_FINGERPRINT;
+	hash = hash_data(hash, &key_params, sizeof(key_params));
+
+	// 0 marks an unused cache
+	policy = hash ? hash : 1;
+
+	return key_params;
+}
+
+static bool key_append(struct dcache_key *key, const void *data, size_t size) {
+	if (size > DCACHE_KEY_SIZE - key->len)
+		return false;
+
+	memcpy(key->data + key->len, data, size);
+	key->len += size;
+
+	return true;
+}
+
+/*
+ * the key is the sequence of param, flag and value with its terminating 0 for every key parameter,
+ * the flag is 0 for a missing value, then no value follows
+ */
+static bool key_build(const struct Snapshot *snap, struct dcache_key *key) {
+	unsigned param;
+
+	key->len = 0;
+
+	for (param = INVALID + 1; param < PARAM_NUM_ITEMS; param++) {
+		const char *str = NULL;
+		uint8_t head[2] = {param, 0};
+
+		if (!(key_params & PARAM_BIT(param)))
+			continue;
+
+		str = usbauth_snapshot_get_valStr(snap, param);
+		head[1] = str != NULL;
+
+		if (!key_append(key, head, sizeof(head)) || (str && !key_append(key, str, strlen(str) + 1)))
+			return false;
+	}
+
+	key->hash = hash_data(hash_init(), key->data, key->len);
+
+	return true;
+}
+
+static bool key_equal(const struct dcache_slot *slot, const struct dcache_key *key) {
+	return slot->key_len == key->len && memcmp(slot->key, key->data, key->len) == 0;
+}
+
+bool dcache_lookup(const struct Snapshot *snap, struct auth_ret *r) {
+	struct dcache_key key;
+	bool ret = false;
+	unsigned i;
+
+	if (!policy || !snap || !key_build(snap, &key))
+		return false;
+
+	if (flock(cache_fd, LOCK_SH))
+		return false;
+
+	// the decisions of other rules are not used, another process could have written them
+	for (i = 0; header->policy == policy && i <= DCACHE_PROBES && !ret; i++) {
+		const struct dcache_slot *slot = &slots[(key.hash + i) % DCACHE_SLOTS];
+
+		// the hash could collide, so the whole key is compared
+		if (key_equal(slot, &key) && slot->rule < (int32_t) rules_len) {
+			r->match = slot->rule >= 0;
+			r->allowed = r->match && slot->allowed;
+			r->rule = slot->rule;
+			ret = true;
+		}
+	}
+
+	flock(cache_fd, LOCK_UN);
+
+	return ret;
+}
+
+void dcache_store(const struct Snapshot *snap, const struct auth_ret *r) {
+	struct dcache_slot *slot = NULL;
+	struct dcache_key key;
+	unsigned i;
+
+	if (!policy || !snap || !key_build(snap, &key))
+		return;
+
+	if (flock(cache_fd, LOCK_EX))
+		return;
+
+	if (header->policy != policy) {
+		memset(slots, 0, DCACHE_SLOTS * sizeof(struct dcache_slot));
+		header->policy = policy;
+	}
+
+	// the slot of the key or the first empty slot, if all are used the home slot is replaced
+	for (i = 0; i <= DCACHE_PROBES && !slot; i++) {
+		struct dcache_slot *s = &slots[(key.hash + i) % DCACHE_SLOTS];
+
+		if (!s->key_len || key_equal(s, &key))
+			slot = s;
+	}
+
+	if (!slot)
+		slot = &slots[key.hash % DCACHE_SLOTS];
+
+	slot->hash = key.hash;
+	slot->key_len = key.len;
+	memcpy(slot->key, key.data, key.len);
+	slot->rule = r->match ? r->rule : -1;
+	slot->allowed = r->match && r->allowed;
+
+	flock(cache_fd, LOCK_UN);
+}
+
+void dcache_free() {
+	if (header)
+		munmap(header, map_len);
+
+	if (cache_fd >= 0)
+		close(cache_fd);
+
+	cache_fd = -1;
+	header = NULL;
+	slots = NULL;
+	map_len = 0;
+	policy = 0;
+	key_params = 0;
+	rules_len = 0;
+}
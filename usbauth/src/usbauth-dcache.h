@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2018 Stefan Koch <stefan.koch10@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Description : persistent cache of the decisions for interfaces
+ *
+ * The cache file is a hash table with a fixed number of slots, mapped shared by every usbauth process.
+ * The key of an interface are its vendor, product, bcdDevice, serial and interface descriptors and
+ * all other parameters the rules read, so equal keys are always decided equally. The key is stored
+ * in the slot and compared at lookup, its hash only selects the slot.
+ * The file is tagged with a hash of the rules, a table of other rules is cleared before it is written.
+ * Rules with devcount, intfcount or anyChild depend on other interfaces, with them the cache is not used.
+ */
+
+#ifndef USBAUTH_DCACHE_H_
+#define USBAUTH_DCACHE_H_
+
+#include <usbauth/generic.h>
+
+#include <stddef.h>
+
+/**
+ * map the cache file, it is created if it does not exist
+ *
+ * @path: the cache file, example /var/lib/usbauth/decisions.cache
+ *
+ * Return: true at success
+ */
+bool dcache_init(const char *path);
+
+/**
+ * use the cache for the rules, called again after the rules were reloaded
+ *
+ * @auths: auth rules
+ * @length: auth rules length
+ *
+ * Return: parameters that must be in the snapshots for the keys, 0 if the cache is not used for the rules
+ */
+uint32_t dcache_prepare(const struct Auth *auths, size_t length);
+
+/**
+ * look up the decision for an interface
+ *
+ * @snap: parameters of the interface, read with the parameters from dcache_prepare
+ * @r: the decision (out)
+ *
+ * Return: true if the decision is known
+ */
+bool dcache_lookup(const struct Snapshot *snap, struct auth_ret *r);
+
+/**
+ * store the decision for an interface, an older entry is replaced if the slots are used
+ *
+ * @snap: parameters of the interface, read with the parameters from dcache_prepare
+ * @r: the decision
+ */
+void dcache_store(const struct Snapshot *snap, const struct auth_ret *r);
+
+/**
+ * unmap the cache file
+ */
+void dcache_free();
+
+#endif /* USBAUTH_DCACHE_H_ */
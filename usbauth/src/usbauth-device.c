@@ -0,0 +1,543 @@
+/*
+ * Copyright (c) 2018 Stefan Koch <stefan.koch10@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Description : access to the USB devices through a backend
+ */
+
+#include "usbauth-device.h"
+#include "usbauth-metrics.h"
+#include "usbauth-profile.h"
+
+#include <usbauth/usbauth-configparser.h>
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define PROBE_FILE "/sys/bus/usb/drivers_probe"
+#define UDEV_CACHE_LEN 2 // an interface and its device, a parameter is looked up in both
+
+static const struct device_ops *ops = NULL;
+static struct udev *udev_ctx = NULL;
+static struct udev_device *udev_cache[UDEV_CACHE_LEN];
+static unsigned udev_cache_next = 0;
+static char fixture_root[PATH_MAX];
+
+static bool list_add(struct device_list *list, const char *path) {
+	char **arr = realloc(list->paths, (list->len + 1) * sizeof(char*));
+
+	if (!arr)
+		return false;
+
+	list->paths = arr;
+	list->paths[list->len] = strdup(path);
+
+	if (!list->paths[list->len])
+		return false;
+
+	list->len++;
+
+	return true;
+}
+
+static int cmp_path(const void *a, const void *b) {
+	return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+// search the DEVTYPE line in the content of an uevent file
+static bool uevent_has_devtype(const char *uevent, const char *devtype) {
+	size_t len = strlen(devtype);
+	const char *line = uevent;
+
+	while (line && *line) {
+		if (strncmp(line, "DEVTYPE=", 8) == 0)
+			return strncmp(line + 8, devtype, len) == 0 && (line[8 + len] == '\n' || line[8 + len] == 0);
+
+		line = strchr(line, '\n');
+		if (line)
+			line++;
+	}
+
+	return false;
+}
+
+static bool read_file(const char *syspath, const char *attr, char *buf, size_t size) {
+	char path[PATH_MAX];
+	ssize_t len = 0;
+	int fd = -1;
+
+	if (snprintf(path, sizeof(path), "%s/%s", syspath, attr) >= (int) sizeof(path))
+		return false;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	len = read(fd, buf, size - 1);
+	close(fd);
+
+	if (len < 0)
+		return false;
+
+	while (len > 0 && buf[len - 1] == '\n')
+		len--;
+	buf[len] = 0;
+
+	return true;
+}
+
+static bool udev_enumerate_paths(const char *parent, const char *devtype, struct device_list *list) {
+	struct udev_enumerate *enumerate = NULL;
+	struct udev_device *parent_dev = NULL;
+	struct udev_list_entry *entry = NULL;
+	bool ret = true;
+
+	enumerate = udev_enumerate_new(udev_ctx);
+
+	if (!enumerate)
+		return false;
+
+	if (parent) {
+		parent_dev = udev_device_new_from_syspath(udev_ctx, parent);
+
+		if (!parent_dev) {
+			udev_enumerate_unref(enumerate);
+			return false;
+		}
+
+		udev_enumerate_add_match_parent(enumerate, parent_dev);
+	} else {
+		udev_enumerate_add_match_subsystem(enumerate, "usb");
+	}
+
+	udev_enumerate_add_match_property(enumerate, "DEVTYPE", devtype);
+	udev_enumerate_scan_devices(enumerate);
+
+	udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(enumerate))
+	{
+		const char *path = udev_list_entry_get_name(entry);
+
+		if (path && !list_add(list, path)) {
+			ret = false;
+			break;
+		}
+	}
+
+	udev_enumerate_unref(enumerate);
+
+	if (parent_dev)
+		udev_device_unref(parent_dev);
+
+	return ret;
+}
+
+// the device objects of the last syspaths are kept for the following reads, the oldest one is replaced
+static struct udev_device* udev_cached_device(const char *syspath) {
+	struct udev_device *udevdev = NULL;
+	unsigned i;
+
+	for (i = 0; i < UDEV_CACHE_LEN; i++) {
+		if (udev_cache[i] && strcmp(udev_device_get_syspath(udev_cache[i]), syspath) == 0)
+			return udev_cache[i];
+	}
+
+	udevdev = udev_device_new_from_syspath(udev_ctx, syspath);
+
+	if (!udevdev)
+		return NULL;
+
+	if (udev_cache[udev_cache_next])
+		udev_device_unref(udev_cache[udev_cache_next]);
+
+	udev_cache[udev_cache_next] = udevdev;
+	udev_cache_next = (udev_cache_next + 1) % UDEV_CACHE_LEN;
+
+	return udevdev;
+}
+
+static bool udev_read_attr(const char *syspath, const char *attr, char *buf, size_t size) {
+	struct udev_device *udevdev = udev_cached_device(syspath);
+	const char *val = NULL;
+	bool ret = false;
+
+	if (!udevdev)
+		return false;
+
+	// libudev keeps the value in the device object as well, device_flush drops it
+	val = udev_device_get_sysattr_value(udevdev, attr);
+
+	if (val && strlen(val) < size) {
+		strcpy(buf, val);
+		ret = true;
+	}
+
+	return ret;
+}
+
+static bool udev_write_attr(const char *syspath, const char *attr, const char *val) {
+	struct udev_device *udevdev = NULL;
+	bool ret = false;
+
+	// a written attribute can change other ones, example: the interfaces of an authorized device
+	device_flush();
+
+	udevdev = udev_device_new_from_syspath(udev_ctx, syspath);
+
+	if (!udevdev)
+		return false;
+
+	ret = udev_device_set_sysattr_value(udevdev, attr, val) == 0;
+	udev_device_unref(udevdev);
+
+	return ret;
+}
+
+// every name needs an own write call
+static bool write_probe(const char *probe_path, const struct device_list *intfs) {
+	int probefd = -1;
+	bool ret = true;
+	unsigned i;
+
+	if (!intfs->len)
+		return true;
+
+	probefd = open(probe_path, O_WRONLY | O_APPEND | O_CLOEXEC);
+
+	if (probefd < 0)
+		return false;
+
+	for (i = 0; i < intfs->len; i++) {
+		const char *name = device_sysname(intfs->paths[i]);
+
+		if (write(probefd, name, strlen(name)) < 0)
+			ret = false;
+	}
+
+	close(probefd);
+
+	return ret;
+}
+
+static bool udev_probe(const struct device_list *intfs) {
+	return write_probe(PROBE_FILE, intfs);
+}
+
+// the snapshots are read from sysfs directly, libudev is not thread-safe
+static const struct device_ops udev_ops = {
+	.name = "udev",
+	.enumerate = udev_enumerate_paths,
+	.read_attr = udev_read_attr,
+	.snapshot_fill = usbauth_snapshot_fill_syspath,
+	.write_attr = udev_write_attr,
+	.probe = udev_probe,
+};
+
+// walk the directories below path, symbolic links are not followed
+static bool fixture_walk(const char *path, const char *devtype, struct device_list *list) {
+	struct dirent *entry = NULL;
+	char uevent[1024];
+	DIR *dir = NULL;
+	bool ret = true;
+
+	if (read_file(path, "uevent", uevent, sizeof(uevent)) && uevent_has_devtype(uevent, devtype))
+		ret = list_add(list, path);
+
+	dir = opendir(path);
+	if (!dir)
+		return ret;
+
+	while (ret && (entry = readdir(dir))) {
+		char child[PATH_MAX];
+		struct stat st;
+
+		if (entry->d_name[0] == '.')
+			continue;
+
+		if (snprintf(child, sizeof(child), "%s/%s", path, entry->d_name) >= (int) sizeof(child))
+			continue;
+
+		if (entry->d_type == DT_DIR || (entry->d_type == DT_UNKNOWN && lstat(child, &st) == 0 && S_ISDIR(st.st_mode)))
+			ret = fixture_walk(child, devtype, list);
+	}
+
+	closedir(dir);
+
+	return ret;
+}
+
+static bool fixture_enumerate(const char *parent, const char *devtype, struct device_list *list) {
+	bool ret = fixture_walk(parent ? parent : fixture_root, devtype, list);
+
+	// sorted by syspath like the udev enumeration
+	if (list->len > 1)
+		qsort(list->paths, list->len, sizeof(char*), cmp_path);
+
+	return ret;
+}
+
+static bool fixture_write_attr(const char *syspath, const char *attr, const char *val) {
+	char path[PATH_MAX];
+	bool ret = false;
+	int fd = -1;
+
+	if (snprintf(path, sizeof(path), "%s/%s", syspath, attr) >= (int) sizeof(path))
+		return false;
+
+	// like sysfs only existing attributes are writable
+	fd = open(path, O_WRONLY | O_TRUNC | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	ret = write(fd, val, strlen(val)) == (ssize_t) strlen(val);
+	close(fd);
+
+	return ret;
+}
+
+static bool fixture_probe(const struct device_list *intfs) {
+	char path[PATH_MAX + 16];
+
+	snprintf(path, sizeof(path), "%s/drivers_probe", fixture_root);
+
+	if (access(path, F_OK))
+		return true;
+
+	return write_probe(path, intfs);
+}
+
+static const struct device_ops fixture_ops = {
+	.name = "fixture",
+	.enumerate = fixture_enumerate,
+	.read_attr = read_file,
+	.snapshot_fill = usbauth_snapshot_fill_syspath, // the directory is laid out like sysfs
+	.write_attr = fixture_write_attr,
+	.probe = fixture_probe,
+};
+
+void device_set_ops(const struct device_ops *new_ops) {
+	device_flush();
+	ops = new_ops;
+}
+
+void device_use_udev(struct udev *udev) {
+	device_flush();
+	udev_ctx = udev;
+	ops = &udev_ops;
+}
+
+bool device_use_fixture(const char *root) {
+	struct stat st;
+
+	if (!root || stat(root, &st) || !S_ISDIR(st.st_mode))
+		return false;
+
+	if (snprintf(fixture_root, sizeof(fixture_root), "%s", root) >= (int) sizeof(fixture_root))
+		return false;
+
+	device_flush();
+	ops = &fixture_ops;
+
+	return true;
+}
+
+void device_flush() {
+	unsigned i;
+
+	for (i = 0; i < UDEV_CACHE_LEN; i++) {
+		if (udev_cache[i])
+			udev_device_unref(udev_cache[i]);
+
+		udev_cache[i] = NULL;
+	}
+
+	udev_cache_next = 0;
+}
+
+const char* device_backend_name() {
+	return ops ? ops->name : "none";
+}
+
+bool device_enumerate(const char *parent, const char *devtype, struct device_list *list) {
+	uint64_t start = 0;
+	bool ret = false;
+
+	list->paths = NULL;
+	list->len = 0;
+
+	if (!ops || !devtype)
+		return false;
+
+	start = profile_begin();
+	ret = ops->enumerate(parent, devtype, list);
+	profile_end(PHASE_ENUMERATE, start);
+
+	if (!ret) {
+		metrics_error(METRICS_ERROR_ENUMERATE);
+		device_list_free(list);
+	}
+
+	return ret;
+}
+
+void device_list_free(struct device_list *list) {
+	unsigned i;
+
+	for (i = 0; i < list->len; i++)
+		free(list->paths[i]);
+
+	free(list->paths);
+	list->paths = NULL;
+	list->len = 0;
+}
+
+bool device_read_attr(const char *syspath, const char *attr, char *buf, size_t size) {
+	uint64_t start = 0;
+	bool ret = false;
+
+	if (!ops || !syspath || !size)
+		return false;
+
+	start = profile_begin();
+	ret = ops->read_attr(syspath, attr, buf, size);
+	profile_end(PHASE_SYSFS, start);
+
+	return ret;
+}
+
+bool device_write_attr(const char *syspath, const char *attr, const char *val) {
+	uint64_t start = 0;
+	bool ret = false;
+
+	if (!ops || !syspath)
+		return false;
+
+	start = profile_begin();
+	ret = ops->write_attr(syspath, attr, val);
+	profile_end(PHASE_AUTHORIZE, start);
+
+	if (!ret)
+		metrics_error(METRICS_ERROR_WRITE);
+
+	return ret;
+}
+
+bool device_probe(const struct device_list *intfs) {
+	uint64_t start = 0;
+	bool ret = false;
+
+	if (!ops)
+		return false;
+
+	start = profile_begin();
+	ret = ops->probe(intfs);
+	profile_end(PHASE_PROBE, start);
+
+	if (!ret)
+		metrics_error(METRICS_ERROR_PROBE);
+
+	return ret;
+}
+
+bool device_is_devtype(const char *syspath, const char *devtype) {
+	char uevent[1024];
+
+	if (!device_read_attr(syspath, "uevent", uevent, sizeof(uevent)))
+		return false;
+
+	return uevent_has_devtype(uevent, devtype);
+}
+
+const char* device_parent(const char *syspath, char *buf, size_t size) {
+	const char *slash = NULL;
+	size_t len = 0;
+
+	if (!syspath)
+		return NULL;
+
+	len = strlen(syspath);
+
+	// a trailing slash is not a component
+	while (len > 1 && syspath[len - 1] == '/')
+		len--;
+
+	for (slash = syspath + len - 1; slash > syspath && *slash != '/'; slash--);
+
+	len = slash - syspath;
+
+	if (!len || len >= size)
+		return NULL;
+
+	memcpy(buf, syspath, len);
+	buf[len] = 0;
+
+	return buf;
+}
+
+const char* device_sysname(const char *syspath) {
+	const char *slash = strrchr(syspath, '/');
+
+	return slash ? slash + 1 : syspath;
+}
+
+const char* device_get_param_valStr(enum Parameter param, const char *syspath, char *buf, size_t size) {
+	char parent[PATH_MAX];
+	const char *attr = usbauth_param_to_str(param);
+
+	// connectType is in a subdir
+	if (connectType == param)
+		attr = "port/connect_type";
+
+	if (!attr)
+		return NULL;
+
+	if (device_read_attr(syspath, attr, buf, size))
+		return buf;
+
+	if (device_parent(syspath, parent, sizeof(parent)) && device_read_attr(parent, attr, buf, size))
+		return buf;
+
+	return NULL;
+}
+
+int device_get_param_val(enum Parameter param, const char *syspath) {
+	char buf[256];
+
+	return usbauth_str_to_val(device_get_param_valStr(param, syspath, buf, sizeof(buf)));
+}
+
+bool device_snapshot_read(struct Snapshot *snap, const char *syspath, uint32_t params) {
+	return ops && ops->snapshot_fill && syspath && ops->snapshot_fill(snap, syspath, params);
+}
+
+bool device_snapshot_fill(struct Snapshot *snap, const char *syspath) {
+	bool ret = true;
+	char buf[256];
+	unsigned i;
+
+	usbauth_snapshot_clear(snap);
+
+	for (i = INVALID + 1; i < PARAM_NUM_ITEMS; i++) {
+		if (i == intfcount || i == devcount) // not in sysfs
+			continue;
+
+		ret &= usbauth_snapshot_set(snap, i, device_get_param_valStr(i, syspath, buf, sizeof(buf)));
+	}
+
+	return ret;
+}
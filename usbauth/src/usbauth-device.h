@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2018 Stefan Koch <stefan.koch10@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Description : access to the USB devices through a backend
+ *
+ * Devices are identified by their syspath. The evaluation uses only these functions,
+ * so it runs on libudev and sysfs or on a fixture directory that is laid out like sysfs.
+ * The fixture directory is used by benchmarks and tests without USB hardware and root.
+ */
+
+#ifndef USBAUTH_DEVICE_H_
+#define USBAUTH_DEVICE_H_
+
+#include <usbauth/generic.h>
+
+#include <libudev.h>
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// syspaths found by device_enumerate
+struct device_list {
+	char **paths;
+	unsigned len;
+};
+
+// operations of a backend
+struct device_ops {
+	const char *name;
+
+	// syspaths with the devtype below parent, including parent itself, or of all USB devices if parent is NULL
+	bool (*enumerate)(const char *parent, const char *devtype, struct device_list *list);
+
+	// value of an attribute without the trailing newline
+	bool (*read_attr)(const char *syspath, const char *attr, char *buf, size_t size);
+
+	// parameters of an interface and its device, called by the prefetch threads, so it must be thread-safe,
+	// NULL if the backend reads them only with read_attr
+	bool (*snapshot_fill)(struct Snapshot *snap, const char *syspath, uint32_t params);
+
+	bool (*write_attr)(const char *syspath, const char *attr, const char *val);
+
+	// let the drivers probe the interfaces
+	bool (*probe)(const struct device_list *intfs);
+};
+
+/**
+ * use a backend, example: an in-memory mock
+ *
+ * @ops: operations of the backend, must stay valid while used
+ */
+void device_set_ops(const struct device_ops *ops);
+
+/**
+ * use libudev and sysfs
+ *
+ * @udev: udev context, must stay valid while used
+ */
+void device_use_udev(struct udev *udev);
+
+/**
+ * use a fixture directory that is laid out like sysfs
+ * the devtype of a directory is taken from the DEVTYPE line of its uevent file,
+ * probed interfaces are appended to the file drivers_probe in root if it exists
+ *
+ * @root: directory with the devices, the syspaths are within this directory
+ *
+ * Return: true at success, false if the directory is not accessible
+ */
+bool device_use_fixture(const char *root);
+
+/**
+ * drop the values that the backend keeps from earlier reads,
+ * called before an event is handled, so the values of a replaced device are not used
+ */
+void device_flush();
+
+/**
+ * get the name of the backend in use
+ *
+ * Return: name of the backend, "none" if no backend is used
+ */
+const char* device_backend_name();
+
+/**
+ * find devices, see struct device_ops
+ *
+ * @parent: syspath of the parent device or NULL
+ * @devtype: "usb_device" or "usb_interface"
+ * @list: the found syspaths, must be freed with device_list_free (out)
+ *
+ * Return: true at success
+ */
+bool device_enumerate(const char *parent, const char *devtype, struct device_list *list);
+
+/**
+ * free a list filled by device_enumerate
+ *
+ * @list: the list
+ */
+void device_list_free(struct device_list *list);
+
+/**
+ * read an attribute of a device
+ *
+ * @syspath: syspath of the device
+ * @attr: name of the attribute, example "bInterfaceClass" or "port/connect_type"
+ * @buf: buffer for the value (out)
+ * @size: size of buf
+ *
+ * Return: true at success
+ */
+bool device_read_attr(const char *syspath, const char *attr, char *buf, size_t size);
+
+/**
+ * write an attribute of a device
+ *
+ * @syspath: syspath of the device
+ * @attr: name of the attribute, example "authorized"
+ * @val: the value
+ *
+ * Return: true at success
+ */
+bool device_write_attr(const char *syspath, const char *attr, const char *val);
+
+/**
+ * let the drivers probe the interfaces
+ *
+ * @intfs: syspaths of the interfaces
+ *
+ * Return: true at success
+ */
+bool device_probe(const struct device_list *intfs);
+
+/**
+ * check the devtype of a device
+ *
+ * @syspath: syspath of the device
+ * @devtype: "usb_device" or "usb_interface"
+ *
+ * Return: true if the device has the devtype
+ */
+bool device_is_devtype(const char *syspath, const char *devtype);
+
+/**
+ * get the syspath of the parent device
+ *
+ * @syspath: syspath of the device
+ * @buf: buffer for the parent's syspath (out)
+ * @size: size of buf
+ *
+ * Return: buf, NULL if there is no parent
+ */
+const char* device_parent(const char *syspath, char *buf, size_t size);
+
+/**
+ * get the sysname of a device, the last component of the syspath
+ *
+ * @syspath: syspath of the device
+ *
+ * Return: pointer into syspath
+ */
+const char* device_sysname(const char *syspath);
+
+/**
+ * get a parameter, from the device itself or from its parent
+ * like usbauth_get_param_valStr without libudev
+ *
+ * @param: the parameter
+ * @syspath: syspath of the device
+ * @buf: buffer for the value (out)
+ * @size: size of buf
+ *
+ * Return: buf, NULL if the parameter is not available
+ */
+const char* device_get_param_valStr(enum Parameter param, const char *syspath, char *buf, size_t size);
+
+/**
+ * get a parameter as value, see device_get_param_valStr
+ *
+ * @param: the parameter
+ * @syspath: syspath of the device
+ *
+ * Return: the value converted from hex, -1 if not available or not convertable
+ */
+int device_get_param_val(enum Parameter param, const char *syspath);
+
+/**
+ * read the parameters of an interface and its device into a snapshot with the backend's snapshot_fill
+ * it is thread-safe, if it fails the caller could use device_snapshot_fill
+ *
+ * @snap: snapshot (out)
+ * @syspath: syspath of the usb_interface
+ * @params: parameters to read, see usbauth_snapshot_fill_sysfs
+ *
+ * Return: true at success, false if the backend has no snapshot_fill
+ */
+bool device_snapshot_read(struct Snapshot *snap, const char *syspath, uint32_t params);
+
+/**
+ * read all parameters of an interface and its device into a snapshot with the backend's read_attr
+ * like usbauth_snapshot_fill without libudev
+ *
+ * @snap: snapshot (out)
+ * @syspath: syspath of the usb_interface
+ *
+ * Return: true at success
+ */
+bool device_snapshot_fill(struct Snapshot *snap, const char *syspath);
+
+#endif /* USBAUTH_DEVICE_H_ */
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2018 Stefan Koch <stefan.koch10@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Description : writer of fixture trees for the fixture backend
+ */
+
+// nftw is needed to remove the fixture trees
+#define _GNU_SOURCE
+
+#include "usbauth-fixture.h"
+
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+bool fixture_tree_create(char *base, size_t size, const char *name) {
+	if (snprintf(base, size, "/tmp/%s.XXXXXX", name) >= (int) size) {
+		*base = 0;
+		return false;
+	}
+
+	if (!mkdtemp(base)) {
+		*base = 0;
+		return false;
+	}
+
+	return true;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+	return remove(path);
+}
+
+void fixture_tree_remove(const char *base) {
+	if (base[0])
+		nftw(base, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+bool fixture_tree_write_attr(const char *dir, const char *name, const char *fmt, ...) {
+	char path[PATH_MAX];
+	FILE *f = NULL;
+	va_list ap;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	f = fopen(path, "w");
+
+	if (!f)
+		return false;
+
+	va_start(ap, fmt);
+	vfprintf(f, fmt, ap);
+	va_end(ap);
+
+	return fclose(f) == 0;
+}
+
+bool fixture_tree_add_device(const char *path, const struct fixture_device *dev) {
+	char port[PATH_MAX + 8];
+	bool ret = true;
+
+	if (mkdir(path, 0755))
+		return false;
+
+	ret &= fixture_tree_write_attr(path, "uevent", "DEVTYPE=usb_device\nPRODUCT=%x/%x/100\nTYPE=%u/0/0\nBUSNUM=%03u\nDEVNUM=%03u\n",
+			dev->vendor, dev->product, dev->dev_class, dev->busnum, dev->devnum);
+	ret &= fixture_tree_write_attr(path, "idVendor", "%04x\n", dev->vendor);
+	ret &= fixture_tree_write_attr(path, "idProduct", "%04x\n", dev->product);
+	ret &= fixture_tree_write_attr(path, "bcdDevice", "0100\n");
+	ret &= fixture_tree_write_attr(path, "bDeviceClass", "%02x\n", dev->dev_class);
+	ret &= fixture_tree_write_attr(path, "bDeviceSubClass", "00\n");
+	ret &= fixture_tree_write_attr(path, "bDeviceProtocol", "00\n");
+	ret &= fixture_tree_write_attr(path, "bConfigurationValue", "1\n");
+	ret &= fixture_tree_write_attr(path, "bNumInterfaces", "%2u\n", dev->intf_len);
+	ret &= fixture_tree_write_attr(path, "busnum", "%u\n", dev->busnum);
+	ret &= fixture_tree_write_attr(path, "devnum", "%u\n", dev->devnum);
+	ret &= fixture_tree_write_attr(path, "devpath", "%s\n", dev->devpath);
+	ret &= fixture_tree_write_attr(path, "speed", "%s\n", dev->speed);
+	ret &= fixture_tree_write_attr(path, "manufacturer", "usbauth\n");
+	ret &= fixture_tree_write_attr(path, "product", "%s\n", dev->name);
+
+	if (dev->serial)
+		ret &= fixture_tree_write_attr(path, "serial", "%s\n", dev->serial);
+
+	if (dev->connect_type) {
+		snprintf(port, sizeof(port), "%s/port", path);
+		ret &= mkdir(port, 0755) == 0;
+		ret &= fixture_tree_write_attr(port, "connect_type", "%s\n", dev->connect_type);
+	}
+
+	return ret;
+}
+
+bool fixture_tree_add_interface(const char *path, const struct fixture_device *dev, const struct fixture_interface *intf) {
+	bool ret = true;
+
+	if (mkdir(path, 0755))
+		return false;
+
+	// like the kernel the uevent has the same values as the attributes
+	ret &= fixture_tree_write_attr(path, "uevent", "DEVTYPE=usb_interface\nPRODUCT=%x/%x/100\nTYPE=%u/0/0\nINTERFACE=%u/%u/%u\n",
+			dev->vendor, dev->product, dev->dev_class, intf->intf_class, intf->subclass, intf->protocol);
+	ret &= fixture_tree_write_attr(path, "bInterfaceNumber", "%02x\n", intf->num);
+	ret &= fixture_tree_write_attr(path, "bInterfaceClass", "%02x\n", intf->intf_class);
+	ret &= fixture_tree_write_attr(path, "bInterfaceSubClass", "%02x\n", intf->subclass);
+	ret &= fixture_tree_write_attr(path, "bInterfaceProtocol", "%02x\n", intf->protocol);
+	ret &= fixture_tree_write_attr(path, "bAlternateSetting", " 0\n");
+	ret &= fixture_tree_write_attr(path, "bNumEndpoints", "%02x\n", intf->endpoints);
+	ret &= fixture_tree_write_attr(path, "authorized", "1\n");
+
+	return ret;
+}
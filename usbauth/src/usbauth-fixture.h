@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2018 Stefan Koch <stefan.koch10@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Description : writer of fixture trees for the fixture backend
+ *
+ * A fixture tree is a temporary directory laid out like sysfs, with the attributes and
+ * uevent files of the kernel. It is used by usbauth-bench and usbauth-check through
+ * device_use_fixture() of usbauth-device.h, so no USB hardware and no root are needed.
+ */
+
+#ifndef USBAUTH_FIXTURE_H_
+#define USBAUTH_FIXTURE_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// attributes of a usb_device
+struct fixture_device {
+	unsigned busnum;
+	unsigned devnum;
+	unsigned vendor;
+	unsigned product;
+	unsigned dev_class;
+	unsigned intf_len; // bNumInterfaces
+	const char *devpath; // "0" for a root hub
+	const char *speed;
+	const char *serial; // NULL if the device has no serial
+	const char *name; // the product attribute
+	const char *connect_type; // NULL if the device has no port, example: a root hub
+};
+
+// attributes of a usb_interface
+struct fixture_interface {
+	unsigned num;
+	unsigned intf_class;
+	unsigned subclass;
+	unsigned protocol;
+	unsigned endpoints;
+};
+
+/**
+ * create an empty fixture tree in /tmp
+ *
+ * @base: buffer for the directory of the tree (out)
+ * @size: size of base
+ * @name: prefix of the directory name, example "usbauth-check"
+ *
+ * Return: true at success
+ */
+bool fixture_tree_create(char *base, size_t size, const char *name);
+
+/**
+ * remove a fixture tree with all its devices
+ *
+ * @base: directory of the tree, nothing is removed if it is empty
+ */
+void fixture_tree_remove(const char *base);
+
+/**
+ * write an attribute file
+ *
+ * @dir: directory of the device
+ * @name: name of the attribute
+ * @fmt: printf format of the value
+ *
+ * Return: true at success
+ */
+bool fixture_tree_write_attr(const char *dir, const char *name, const char *fmt, ...);
+
+/**
+ * add a usb_device, its parent directory must exist
+ *
+ * @path: directory of the device, example BASE/usb1/1-1
+ * @dev: the attributes
+ *
+ * Return: true at success
+ */
+bool fixture_tree_add_device(const char *path, const struct fixture_device *dev);
+
+/**
+ * add a usb_interface to a usb_device, the uevent has the same values as the attributes
+ *
+ * @path: directory of the interface, example BASE/usb1/1-1/1-1:1.0
+ * @dev: the attributes of the interface's usb_device
+ * @intf: the attributes
+ *
+ * Return: true at success
+ */
+bool fixture_tree_add_interface(const char *path, const struct fixture_device *dev, const struct fixture_interface *intf);
+
+#endif /* USBAUTH_FIXTURE_H_ */
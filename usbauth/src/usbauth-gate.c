@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2018 Stefan Koch <stefan.koch10@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Description : gate the interfaces with the root hubs' interface_authorized_default
+ */
+
+#include "usbauth-gate.h"
+#include "usbauth-device.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define GATE_ATTR "interface_authorized_default"
+#define GATE_RECORD_PREFIX "gate-" // a record per root hub: gate-SYSNAME holds the value and the syspath
+
+struct gate_hub {
+	char *syspath;
+	char value[16]; // value before the hub was gated
+};
+
+bool gate_active = false;
+
+static struct gate_hub *hubs = NULL;
+static unsigned hubs_len = 0;
+static char record_dir[PATH_MAX];
+
+static bool record_path(const char *sysname, char *buf, size_t size) {
+	return *record_dir && snprintf(buf, size, "%s/" GATE_RECORD_PREFIX "%s", record_dir, sysname) < (int) size;
+}
+
+// read a record, the value and the syspath are separated by a newline
+static bool record_read(const char *path, char *value, size_t value_size, char *syspath, size_t syspath_size) {
+	char buf[16 + PATH_MAX];
+	char *sep = NULL;
+	ssize_t len = 0;
+	int fd = open(path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+
+	if (fd < 0)
+		return false;
+
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+
+	if (len <= 0)
+		return false;
+
+	buf[len] = 0;
+	sep = strchr(buf, '\n');
+
+	if (!sep || (size_t) (sep - buf) >= value_size || strlen(sep + 1) >= syspath_size)
+		return false;
+
+	*sep = 0;
+	strcpy(value, buf);
+	strcpy(syspath, sep + 1);
+
+	return true;
+}
+
+// the record is replaced atomically, so a killed daemon leaves a complete one
+static bool record_write(const char *usb_device, const char *value) {
+	char path[PATH_MAX];
+	char tmp[PATH_MAX + 4];
+	bool ret = false;
+	int fd = -1;
+
+	if (!record_path(device_sysname(usb_device), path, sizeof(path)))
+		return false;
+
+	snprintf(tmp, sizeof(tmp), "%s.new", path);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, 0600);
+
+	if (fd < 0)
+		return false;
+
+	ret = dprintf(fd, "%s\n%s", value, usb_device) > 0;
+	close(fd);
+
+	if (ret)
+		ret = rename(tmp, path) == 0;
+
+	if (!ret)
+		unlink(tmp);
+
+	return ret;
+}
+
+static void record_remove(const char *usb_device) {
+	char path[PATH_MAX];
+
+	if (record_path(device_sysname(usb_device), path, sizeof(path)))
+		unlink(path);
+}
+
+bool gate_hub(const char *usb_device) {
+	struct gate_hub *arr = NULL;
+	char value[16];
+	char recorded[16];
+	char recorded_path[PATH_MAX];
+	char path[PATH_MAX];
+	unsigned i;
+
+	// root hubs are named usbN by the kernel, every host controller has one
+	if (!usb_device || strncmp(device_sysname(usb_device), "usb", 3) != 0)
+		return false;
+
+	for (i = 0; i < hubs_len; i++) {
+		if (strcmp(hubs[i].syspath, usb_device) == 0)
+			return true;
+	}
+
+	if (!device_read_attr(usb_device, GATE_ATTR, value, sizeof(value)))
+		return false;
+
+	// a killed daemon has left the hub gated, the value before it is taken from its record
+	if (strcmp(value, "0") == 0 && record_path(device_sysname(usb_device), path, sizeof(path))
+			&& record_read(path, recorded, sizeof(recorded), recorded_path, sizeof(recorded_path))
+			&& strcmp(recorded_path, usb_device) == 0)
+		strcpy(value, recorded);
+	else if (!record_write(usb_device, value))
+		syslog(LOG_WARNING, "cannot record %s/%s, it is not restored if the daemon is killed\n", usb_device, GATE_ATTR);
+
+	arr = realloc(hubs, (hubs_len + 1) * sizeof(struct gate_hub));
+	if (!arr)
+		return false;
+
+	hubs = arr;
+	hubs[hubs_len].syspath = strdup(usb_device);
+
+	if (!hubs[hubs_len].syspath)
+		return false;
+
+	if (!device_write_attr(usb_device, GATE_ATTR, "0")) {
+		syslog(LOG_ERR, "cannot write %s/%s\n", usb_device, GATE_ATTR);
+		record_remove(usb_device);
+		free(hubs[hubs_len].syspath);
+		return false;
+	}
+
+	strcpy(hubs[hubs_len].value, value);
+	hubs_len++;
+	gate_active = true;
+
+	syslog(LOG_NOTICE, "gated interfaces of %s (%s was %s)\n", usb_device, GATE_ATTR, value);
+
+	return true;
+}
+
+bool gate_init(const char *dir) {
+	struct device_list devs;
+	unsigned i;
+
+	// without the directory the values are only kept in memory
+	if (mkdir(dir, 0700) && errno != EEXIST)
+		syslog(LOG_WARNING, "cannot create %s\n", dir);
+
+	if (snprintf(record_dir, sizeof(record_dir), "%s", dir) >= (int) sizeof(record_dir))
+		*record_dir = 0;
+
+	if (!device_enumerate(NULL, "usb_device", &devs))
+		return false;
+
+	for (i = 0; i < devs.len; i++)
+		gate_hub(devs.paths[i]);
+
+	device_list_free(&devs);
+
+	return gate_active;
+}
+
+void gate_restore() {
+	unsigned i;
+
+	// interfaces created after this are authorized by the kernel again
+	for (i = 0; i < hubs_len; i++) {
+		if (!device_write_attr(hubs[i].syspath, GATE_ATTR, hubs[i].value))
+			syslog(LOG_ERR, "cannot restore %s/%s\n", hubs[i].syspath, GATE_ATTR);
+		else
+			record_remove(hubs[i].syspath);
+	}
+
+	gate_release();
+}
+
+void gate_release() {
+	unsigned i;
+
+	for (i = 0; i < hubs_len; i++)
+		free(hubs[i].syspath);
+
+	free(hubs);
+	hubs = NULL;
+	hubs_len = 0;
+	gate_active = false;
+}
+
+bool gate_restore_recorded(const char *dir) {
+	struct dirent *entry = NULL;
+	DIR *d = opendir(dir);
+	bool ret = true;
+
+	if (!d)
+		return errno == ENOENT;
+
+	while ((entry = readdir(d))) {
+		char path[PATH_MAX];
+		char value[16];
+		char syspath[PATH_MAX];
+
+		if (strncmp(entry->d_name, GATE_RECORD_PREFIX, strlen(GATE_RECORD_PREFIX)) != 0)
+			continue;
+
+		if (snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name) >= (int) sizeof(path))
+			continue;
+
+		// a removed root hub has no attribute to restore, its record is outdated
+		if (!record_read(path, value, sizeof(value), syspath, sizeof(syspath))) {
+			syslog(LOG_WARNING, "invalid record %s\n", path);
+		} else if (device_write_attr(syspath, GATE_ATTR, value)) {
+			syslog(LOG_NOTICE, "restored %s/%s to %s\n", syspath, GATE_ATTR, value);
+		} else if (device_is_devtype(syspath, "usb_device")) {
+			syslog(LOG_ERR, "cannot restore %s/%s\n", syspath, GATE_ATTR);
+			ret = false;
+			continue;
+		}
+
+		unlink(path);
+	}
+
+	closedir(d);
+
+	return ret;
+}
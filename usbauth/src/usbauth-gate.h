@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2018 Stefan Koch <stefan.koch10@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Description : gate the interfaces with the root hubs' interface_authorized_default
+ *
+ * While the gate is open the kernel creates new interfaces unauthorized, so no driver binds them
+ * before usbauth has decided. Then usbauth must also allow the interfaces that no rule matches.
+ * The previous values are kept in memory and are written back by gate_restore. They are also recorded
+ * in a directory below /run, so a restarted daemon keeps the values from before a killed one and
+ * gate_restore_recorded writes them back after the daemon has stopped, example by ExecStopPost.
+ */
+
+#ifndef USBAUTH_GATE_H_
+#define USBAUTH_GATE_H_
+
+#include <usbauth/generic.h>
+
+extern bool gate_active;
+
+/**
+ * set interface_authorized_default of a root hub to 0
+ *
+ * @usb_device: syspath of an usb_device, other devices than root hubs are ignored
+ *
+ * Return: true if the root hub is gated
+ */
+bool gate_hub(const char *usb_device);
+
+/**
+ * gate all available root hubs
+ *
+ * @dir: directory for the records of the previous values, example /run/usbauth
+ *
+ * Return: true if at least one root hub is gated, false if the kernel has no interface_authorized_default
+ */
+bool gate_init(const char *dir);
+
+/**
+ * write back the previous values of interface_authorized_default and free the gate
+ */
+void gate_restore();
+
+/**
+ * free the gate without writing back, the root hubs stay gated and their records are kept
+ * used if another daemon has started meanwhile, it uses the records of the previous values
+ */
+void gate_release();
+
+/**
+ * write back the values recorded by a daemon that was killed, the records are removed
+ *
+ * @dir: directory of the records, the same as for gate_init
+ *
+ * Return: false if a value of an available root hub could not be written back
+ */
+bool gate_restore_recorded(const char *dir);
+
+#endif /* USBAUTH_GATE_H_ */
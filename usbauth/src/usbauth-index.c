@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2018 Stefan Koch <stefan.koch10@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Description : index of allow/deny rules by their exact-match attributes
+ */
+
+#include "usbauth-index.h"
+
+#include <usbauth/usbauth-configparser.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// indexed parameters, the first available one of a rule is used as key
+static const enum Parameter index_params[] = { idProduct, idVendor, bInterfaceClass };
+#define INDEX_PARAMS_LEN (sizeof(index_params)/sizeof(index_params[0]))
+
+struct index_entry {
+	enum Parameter param; // INVALID for a free entry
+	int val;
+	unsigned *rules; // ascending rule indices
+	unsigned rule_len;
+};
+
+struct rule_index {
+	const struct Auth *auths;
+	size_t length;
+	struct index_entry *entries;
+	unsigned entry_size; // power of two
+	unsigned *generic; // ascending indices of rules without key
+	unsigned generic_len;
+	unsigned *conds; // ascending indices of conditions
+	unsigned cond_len;
+	unsigned *result; // buffer for index_candidates
+};
+
+static unsigned hash_key(enum Parameter param, int val) {
+	uint32_t h = (uint32_t) param * 0x9e3779b1u;
+
+	h ^= (uint32_t) val * 0x85ebca6bu;
+	h ^= h >> 16;
+
+	return h;
+}
+
+static struct index_entry* find_entry(const struct rule_index *index, enum Parameter param, int val) {
+	unsigned mask = index->entry_size - 1;
+	unsigned pos = hash_key(param, val) & mask;
+
+	// linear probing, the table has always free entries
+	while (index->entries[pos].param != INVALID) {
+		if (index->entries[pos].param == param && index->entries[pos].val == val)
+			break;
+		pos = (pos + 1) & mask;
+	}
+
+	return &index->entries[pos];
+}
+
+// get the attribute used as key, a rule could only match if the interface has this value
+static const struct Data* rule_key(const struct Auth *auth) {
+	unsigned i, j;
+
+	for (i = 0; i < INDEX_PARAMS_LEN; i++) {
+		for (j = 0; j < auth->attr_len; j++) {
+			const struct Data *d = &auth->attr_array[j];
+
+			if (d->param == index_params[i] && d->op == eq && d->cmp == CMP_INT && !d->anyChild && d->val)
+				return d;
+		}
+	}
+
+	return NULL;
+}
+
+static bool append(unsigned **arr, unsigned *len, unsigned val) {
+	unsigned *tmp = realloc(*arr, (*len + 1) * sizeof(unsigned));
+
+	if (!tmp)
+		return false;
+
+	tmp[(*len)++] = val;
+	*arr = tmp;
+
+	return true;
+}
+
+struct rule_index* index_build(const struct Auth *auths, size_t length) {
+	struct rule_index *index = calloc(1, sizeof(struct rule_index));
+	unsigned keys = 0;
+	unsigned i;
+
+	if (!index)
+		return NULL;
+
+	index->auths = auths;
+	index->length = length;
+
+	for (i = 0; i < length; i++) {
+		if (auths[i].type != COND && auths[i].type != COMMENT && rule_key(&auths[i]))
+			keys++;
+	}
+
+	index->entry_size = 16;
+	while (index->entry_size < 2 * keys)
+		index->entry_size *= 2;
+
+	index->entries = calloc(index->entry_size, sizeof(struct index_entry));
+	index->result = calloc(length + 1, sizeof(unsigned));
+
+	if (!index->entries || !index->result) {
+		index_free(index);
+		return NULL;
+	}
+
+	for (i = 0; i < length; i++) {
+		const struct Data *key = NULL;
+		bool ok = true;
+
+		if (auths[i].type == COMMENT)
+			continue;
+
+		key = rule_key(&auths[i]);
+
+		// conditions are evaluated separately for every applicable rule
+		if (auths[i].type == COND) {
+			ok = append(&index->conds, &index->cond_len, i);
+		} else if (key) {
+			struct index_entry *e = find_entry(index, key->param, key->ival);
+			e->param = key->param;
+			e->val = key->ival;
+			ok = append(&e->rules, &e->rule_len, i);
+		} else {
+			ok = append(&index->generic, &index->generic_len, i);
+		}
+
+		if (!ok) {
+			index_free(index);
+			return NULL;
+		}
+	}
+
+	return index;
+}
+
+void index_free(struct rule_index *index) {
+	unsigned i;
+
+	if (!index)
+		return;
+
+	if (index->entries) {
+		for (i = 0; i < index->entry_size; i++)
+			free(index->entries[i].rules);
+	}
+
+	free(index->entries);
+	free(index->generic);
+	free(index->conds);
+	free(index->result);
+	free(index);
+}
+
+bool index_valid(const struct rule_index *index, const struct Auth *auths, size_t length) {
+	return index && index->auths == auths && index->length == length;
+}
+
+const unsigned* index_candidates(struct rule_index *index, const struct Snapshot *snap, unsigned *len) {
+	const unsigned *lists[INDEX_PARAMS_LEN + 1];
+	unsigned lens[INDEX_PARAMS_LEN + 1];
+	unsigned pos[INDEX_PARAMS_LEN + 1];
+	unsigned list_len = 0;
+	unsigned n = 0;
+	unsigned i;
+
+	lists[list_len] = index->generic;
+	lens[list_len++] = index->generic_len;
+
+	for (i = 0; i < INDEX_PARAMS_LEN; i++) {
+		int val = usbauth_snapshot_get_val(snap, index_params[i]);
+		struct index_entry *e = NULL;
+
+		if (val == -1)
+			continue;
+
+		e = find_entry(index, index_params[i], val);
+		if (e->param != INVALID) {
+			lists[list_len] = e->rules;
+			lens[list_len++] = e->rule_len;
+		}
+	}
+
+	// merge the ascending lists to keep the order of the rules, a rule is only within one list
+	memset(pos, 0, sizeof(pos));
+	while (true) {
+		unsigned min = 0;
+		bool found = false;
+
+		for (i = 0; i < list_len; i++) {
+			if (pos[i] < lens[i] && (!found || lists[i][pos[i]] < lists[min][pos[min]])) {
+				min = i;
+				found = true;
+			}
+		}
+
+		if (!found)
+			break;
+
+		index->result[n++] = lists[min][pos[min]++];
+	}
+
+	*len = n;
+
+	return index->result;
+}
+
+const unsigned* index_conds(const struct rule_index *index, unsigned *len) {
+	*len = index->cond_len;
+
+	return index->conds;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2018 Stefan Koch <stefan.koch10@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Description : index of allow/deny rules by their exact-match attributes
+ *
+ * A rule with an attribute like idVendor==046d can only match interfaces
+ * with this value. Such rules are stored in a hash table by the value of
+ * idProduct, idVendor or bInterfaceClass. For an interface only the rules
+ * from the table entries of its values and the rules without such an
+ * attribute are evaluated, in the order of the rule array.
+ * The conditions are stored in a separate list.
+ */
+
+#ifndef USBAUTH_INDEX_H_
+#define USBAUTH_INDEX_H_
+
+#include <usbauth/generic.h>
+
+#include <stddef.h>
+
+struct rule_index;
+
+/**
+ * build the index for allow and deny rules
+ * conditions are not indexed
+ *
+ * @auths: auth rules
+ * @length: auth rules length
+ *
+ * Return: index, NULL at error
+ */
+struct rule_index* index_build(const struct Auth *auths, size_t length);
+
+/**
+ * free the index
+ *
+ * @index: index from index_build
+ */
+void index_free(struct rule_index *index);
+
+/**
+ * check whether the index was built for the rules
+ *
+ * @index: index from index_build, could be NULL
+ * @auths: auth rules
+ * @length: auth rules length
+ *
+ * Return: true if the index could be used for the rules
+ */
+bool index_valid(const struct rule_index *index, const struct Auth *auths, size_t length);
+
+/**
+ * get the allow and deny rules that could match an interface
+ *
+ * @index: index from index_build
+ * @snap: snapshot of the interface's parameters
+ * @len: number of returned rules (out)
+ *
+ * Return: ascending rule indices, valid until the next call
+ */
+const unsigned* index_candidates(struct rule_index *index, const struct Snapshot *snap, unsigned *len);
+
+/**
+ * get the conditions of the rules
+ *
+ * @index: index from index_build
+ * @len: number of returned conditions (out)
+ *
+ * Return: ascending rule indices of the conditions
+ */
+const unsigned* index_conds(const struct rule_index *index, unsigned *len);
+
+#endif /* USBAUTH_INDEX_H_ */
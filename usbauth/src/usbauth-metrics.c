@@ -0,0 +1,381 @@
+/*
+ * Copyright (c) 2018 Stefan Koch <stefan.koch10@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Description : counters and latency histogram in the Prometheus textfile format
+ */
+
+#include "usbauth-metrics.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <syslog.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#define FLUSH_INTERVAL_MS 1000
+#define NUM_BUCKETS (sizeof(bucket_ns) / sizeof(bucket_ns[0]))
+
+enum outcome { OUTCOME_ALLOW, OUTCOME_DENY, OUTCOME_NONE, OUTCOME_NUM_ITEMS };
+
+// upper bounds of the latency buckets, the last bucket is +Inf
+static const uint64_t bucket_ns[] = {
+	1000000, 2500000, 5000000, 10000000, 25000000, 50000000,
+	100000000, 250000000, 500000000, 1000000000, 2500000000
+};
+
+static const char *event_names[METRICS_EVENT_NUM_ITEMS] = {
+	[METRICS_EVENT_ADD] = "add",
+	[METRICS_EVENT_REMOVE] = "remove",
+	[METRICS_EVENT_INIT] = "init",
+	[METRICS_EVENT_NOTIFIER] = "notifier",
+	[METRICS_EVENT_RELOAD] = "reload",
+};
+
+static const char *outcome_names[OUTCOME_NUM_ITEMS] = {
+	[OUTCOME_ALLOW] = "allow",
+	[OUTCOME_DENY] = "deny",
+	[OUTCOME_NONE] = "none",
+};
+
+static const char *error_names[METRICS_ERROR_NUM_ITEMS] = {
+	[METRICS_ERROR_ENUMERATE] = "enumerate",
+	[METRICS_ERROR_WRITE] = "write",
+	[METRICS_ERROR_PROBE] = "probe",
+};
+
+struct family {
+	const char *name;
+	const char *type;
+	const char *help;
+};
+
+static const struct family families[] = {
+	{ "usbauth_events_total", "counter", "Events handled by usbauth." },
+	{ "usbauth_decisions_total", "counter", "Decisions for interfaces by outcome." },
+	{ "usbauth_rule_hits_total", "counter", "Decisions by rule number." },
+	{ "usbauth_sysfs_errors_total", "counter", "Failed sysfs accesses." },
+	{ "usbauth_authorize_latency_seconds", "histogram", "Time from the event to the authorized write." },
+};
+
+// all counters are deltas since the last flush, the buckets are cumulative like in the output
+struct counters {
+	uint64_t events[METRICS_EVENT_NUM_ITEMS];
+	uint64_t decisions[OUTCOME_NUM_ITEMS];
+	uint64_t errors[METRICS_ERROR_NUM_ITEMS];
+	uint64_t buckets[NUM_BUCKETS + 1];
+	uint64_t latency_sum_ns;
+	uint64_t *rule_hits;
+	unsigned rule_hits_len;
+};
+
+// called for every series, ns is true if the value is printed in seconds
+typedef void (*series_fn)(const struct family *family, const char *key, uint64_t *val, bool ns, void *data);
+
+bool metrics_enabled = false;
+
+static char metrics_path[PATH_MAX];
+static struct counters counters;
+static uint64_t event_start = 0;
+static uint64_t last_flush = 0;
+static bool dirty = false;
+
+static uint64_t now_ns() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool rule_hits_grow(unsigned len) {
+	uint64_t *arr = NULL;
+
+	if (len <= counters.rule_hits_len)
+		return true;
+
+	arr = realloc(counters.rule_hits, len * sizeof(uint64_t));
+	if (!arr)
+		return false;
+
+	memset(arr + counters.rule_hits_len, 0, (len - counters.rule_hits_len) * sizeof(uint64_t));
+	counters.rule_hits = arr;
+	counters.rule_hits_len = len;
+
+	return true;
+}
+
+static void series_foreach(series_fn fn, void *data) {
+	char key[128];
+	unsigned i;
+
+	for (i = 0; i < METRICS_EVENT_NUM_ITEMS; i++) {
+		snprintf(key, sizeof(key), "usbauth_events_total{event=\"%s\"}", event_names[i]);
+		fn(&families[0], key, &counters.events[i], false, data);
+	}
+
+	for (i = 0; i < OUTCOME_NUM_ITEMS; i++) {
+		snprintf(key, sizeof(key), "usbauth_decisions_total{outcome=\"%s\"}", outcome_names[i]);
+		fn(&families[1], key, &counters.decisions[i], false, data);
+	}
+
+	// the rule number is 1-based like in the profile report
+	for (i = 0; i < counters.rule_hits_len; i++) {
+		snprintf(key, sizeof(key), "usbauth_rule_hits_total{rule=\"%u\"}", i + 1);
+		fn(&families[2], key, &counters.rule_hits[i], false, data);
+	}
+
+	for (i = 0; i < METRICS_ERROR_NUM_ITEMS; i++) {
+		snprintf(key, sizeof(key), "usbauth_sysfs_errors_total{op=\"%s\"}", error_names[i]);
+		fn(&families[3], key, &counters.errors[i], false, data);
+	}
+
+	for (i = 0; i < NUM_BUCKETS; i++) {
+		snprintf(key, sizeof(key), "usbauth_authorize_latency_seconds_bucket{le=\"%g\"}", bucket_ns[i] / 1e9);
+		fn(&families[4], key, &counters.buckets[i], false, data);
+	}
+
+	fn(&families[4], "usbauth_authorize_latency_seconds_bucket{le=\"+Inf\"}", &counters.buckets[NUM_BUCKETS], false, data);
+	fn(&families[4], "usbauth_authorize_latency_seconds_sum", &counters.latency_sum_ns, true, data);
+	fn(&families[4], "usbauth_authorize_latency_seconds_count", &counters.buckets[NUM_BUCKETS], false, data);
+}
+
+struct load_line {
+	const char *key;
+	double val;
+	bool found;
+};
+
+static void load_series(const struct family *family, const char *key, uint64_t *val, bool ns, void *data) {
+	struct load_line *line = data;
+
+	// the +Inf bucket and the count are the same counter
+	if (line->found || strcmp(key, line->key))
+		return;
+
+	*val += ns ? (uint64_t) (line->val * 1e9 + 0.5) : (uint64_t) line->val;
+	line->found = true;
+}
+
+// add the values of the metrics file to the counters, unknown lines are ignored
+static void load_file() {
+	char buf[256];
+	FILE *file = fopen(metrics_path, "re");
+
+	if (!file)
+		return;
+
+	while (fgets(buf, sizeof(buf), file)) {
+		char key[128];
+		struct load_line line;
+		unsigned rule = 0;
+
+		if (buf[0] == '#' || sscanf(buf, "%127s %lf", key, &line.val) != 2)
+			continue;
+
+		if (strcmp(key, "usbauth_authorize_latency_seconds_count") == 0)
+			continue;
+
+		// make the rules of previous runs visible to series_foreach
+		if (sscanf(key, "usbauth_rule_hits_total{rule=\"%u\"}", &rule) == 1 && rule > 0)
+			rule_hits_grow(rule);
+
+		line.key = key;
+		line.found = false;
+		series_foreach(load_series, &line);
+	}
+
+	fclose(file);
+}
+
+struct write_state {
+	FILE *file;
+	const struct family *family;
+};
+
+static void write_series(const struct family *family, const char *key, uint64_t *val, bool ns, void *data) {
+	struct write_state *state = data;
+
+	if (state->family != family) {
+		fprintf(state->file, "# HELP %s %s\n# TYPE %s %s\n", family->name, family->help, family->name, family->type);
+		state->family = family;
+	}
+
+	if (ns)
+		fprintf(state->file, "%s %.9f\n", key, *val / 1e9);
+	else
+		fprintf(state->file, "%s %llu\n", key, (unsigned long long) *val);
+}
+
+// write to a temporary file in the same directory and rename it, so the collector never reads a partial file
+static bool write_file() {
+	char tmp[PATH_MAX + 8];
+	struct write_state state;
+	bool ret = false;
+	int fd = -1;
+
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", metrics_path);
+
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		return false;
+
+	fchmod(fd, 0644);
+
+	state.file = fdopen(fd, "w");
+	state.family = NULL;
+
+	if (!state.file) {
+		close(fd);
+		unlink(tmp);
+		return false;
+	}
+
+	series_foreach(write_series, &state);
+
+	ret = fflush(state.file) == 0 && !ferror(state.file);
+	ret &= fclose(state.file) == 0;
+
+	if (ret)
+		ret = rename(tmp, metrics_path) == 0;
+
+	if (!ret)
+		unlink(tmp);
+
+	return ret;
+}
+
+bool metrics_init(const char *path) {
+	if (!path || !*path || strlen(path) >= sizeof(metrics_path))
+		return false;
+
+	strcpy(metrics_path, path);
+	metrics_enabled = true;
+
+	return true;
+}
+
+void metrics_event(enum metrics_event event, uint64_t age_usec) {
+	if (!metrics_enabled || event >= METRICS_EVENT_NUM_ITEMS)
+		return;
+
+	counters.events[event]++;
+	event_start = now_ns() - age_usec * 1000;
+	dirty = true;
+}
+
+void metrics_decision(const struct auth_ret *r) {
+	if (!metrics_enabled)
+		return;
+
+	counters.decisions[!r->match ? OUTCOME_NONE : r->allowed ? OUTCOME_ALLOW : OUTCOME_DENY]++;
+
+	if (r->match && r->rule >= 0 && rule_hits_grow(r->rule + 1))
+		counters.rule_hits[r->rule]++;
+
+	dirty = true;
+}
+
+void metrics_authorized() {
+	uint64_t ns = 0;
+	unsigned i;
+
+	if (!metrics_enabled || !event_start)
+		return;
+
+	ns = now_ns() - event_start;
+
+	for (i = 0; i < NUM_BUCKETS; i++) {
+		if (ns <= bucket_ns[i])
+			counters.buckets[i]++;
+	}
+
+	counters.buckets[NUM_BUCKETS]++;
+	counters.latency_sum_ns += ns;
+	dirty = true;
+}
+
+void metrics_error(enum metrics_error error) {
+	if (!metrics_enabled || error >= METRICS_ERROR_NUM_ITEMS)
+		return;
+
+	counters.errors[error]++;
+	dirty = true;
+}
+
+int metrics_flush_timeout() {
+	uint64_t elapsed = 0;
+
+	if (!metrics_enabled || !dirty)
+		return -1;
+
+	elapsed = (now_ns() - last_flush) / 1000000;
+
+	return elapsed >= FLUSH_INTERVAL_MS ? 0 : FLUSH_INTERVAL_MS - elapsed;
+}
+
+bool metrics_flush() {
+	char lock_path[PATH_MAX + 8];
+	uint64_t *rule_hits = NULL;
+	bool ret = false;
+	int lockfd = -1;
+
+	if (!metrics_enabled)
+		return false;
+
+	// concurrent processes would lose their counters between reading and renaming the file
+	snprintf(lock_path, sizeof(lock_path), "%s.lock", metrics_path);
+	lockfd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+	if (lockfd < 0 || flock(lockfd, LOCK_EX)) {
+		syslog(LOG_ERR, "cannot lock %s\n", lock_path);
+
+		if (lockfd >= 0)
+			close(lockfd);
+
+		return false;
+	}
+
+	load_file();
+	ret = write_file();
+
+	if (!ret)
+		syslog(LOG_ERR, "cannot write metrics to %s\n", metrics_path);
+
+	close(lockfd);
+
+	// the file holds the totals now, at failure the counters are dropped and the file keeps the previous totals
+	// the rule array is kept to avoid reallocations
+	rule_hits = counters.rule_hits;
+	if (rule_hits)
+		memset(rule_hits, 0, counters.rule_hits_len * sizeof(uint64_t));
+	counters = (struct counters) { .rule_hits = rule_hits, .rule_hits_len = counters.rule_hits_len };
+
+	last_flush = now_ns();
+	dirty = false;
+
+	return ret;
+}
+
+void metrics_free() {
+	free(counters.rule_hits);
+	memset(&counters, 0, sizeof(counters));
+	metrics_enabled = false;
+	event_start = 0;
+	dirty = false;
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2018 Stefan Koch <stefan.koch10@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Description : counters and latency histogram in the Prometheus textfile format
+ *
+ * The counters are kept in memory and added to the values of the metrics file at a flush.
+ * So the one-shot modes like udev-add and the daemon accumulate into the same file.
+ * The file is replaced atomically, concurrent flushes are serialized by a lock file.
+ * If no metrics file is set, every function returns after one branch.
+ */
+
+#ifndef USBAUTH_METRICS_H_
+#define USBAUTH_METRICS_H_
+
+#include <usbauth/generic.h>
+
+enum metrics_event {
+	METRICS_EVENT_ADD, // an usb_interface was added
+	METRICS_EVENT_REMOVE, // an usb_interface or usb_device was removed
+	METRICS_EVENT_INIT, // usbauth init
+	METRICS_EVENT_NOTIFIER, // allow or deny by the notifier
+	METRICS_EVENT_RELOAD, // the daemon reloaded the config file
+	METRICS_EVENT_NUM_ITEMS
+};
+
+enum metrics_error {
+	METRICS_ERROR_ENUMERATE,
+	METRICS_ERROR_WRITE,
+	METRICS_ERROR_PROBE,
+	METRICS_ERROR_NUM_ITEMS
+};
+
+extern bool metrics_enabled;
+
+/**
+ * enable the metrics
+ *
+ * @path: the metrics file, example /var/lib/node_exporter/textfile_collector/usbauth.prom
+ *
+ * Return: true at success
+ */
+bool metrics_init(const char *path);
+
+/**
+ * count an event, the latency of the following authorized writes is measured from the event
+ *
+ * @event: the event
+ * @age_usec: time since the event happened, example udev's usec since initialized, 0 for now
+ */
+void metrics_event(enum metrics_event event, uint64_t age_usec);
+
+/**
+ * count the decision for an interface and the rule that has decided
+ *
+ * @r: result of the evaluation
+ */
+void metrics_decision(const struct auth_ret *r);
+
+/**
+ * observe the latency from the last event to now, called after the authorized attribute was written
+ */
+void metrics_authorized();
+
+/**
+ * count a failed sysfs access
+ *
+ * @error: the kind of access
+ */
+void metrics_error(enum metrics_error error);
+
+/**
+ * get the time until the daemon should flush, the flushes are limited to one per second
+ *
+ * Return: milliseconds, 0 if the flush is due, -1 if there is nothing to flush
+ */
+int metrics_flush_timeout();
+
+/**
+ * add the counters to the metrics file and reset them
+ *
+ * Return: true at success
+ */
+bool metrics_flush();
+
+/**
+ * free the metrics, counters that were not flushed are lost
+ */
+void metrics_free();
+
+#endif /* USBAUTH_METRICS_H_ */
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2018 Stefan Koch <stefan.koch10@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Description : parallel reading of interface snapshots through the device backend
+ */
+
+#include "usbauth-prefetch.h"
+#include "usbauth-device.h"
+
+#include <usbauth/usbauth-configparser.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+struct prefetch_job {
+	struct prefetch_item **items;
+	size_t len;
+	uint32_t params;
+	atomic_size_t next; // index of the next item to read
+};
+
+unsigned prefetch_threads() {
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (cpus < 1)
+		return 1;
+
+	if (cpus > PREFETCH_MAX_THREADS)
+		return PREFETCH_MAX_THREADS;
+
+	return cpus;
+}
+
+static void* prefetch_worker(void *arg) {
+	struct prefetch_job *job = arg;
+	size_t i;
+
+	// the items are taken one by one, so a slow sysfs read does not delay other items
+	while ((i = atomic_fetch_add(&job->next, 1)) < job->len) {
+		struct prefetch_item *item = job->items[i];
+		item->filled = device_snapshot_read(&item->snap, item->syspath, job->params);
+	}
+
+	return NULL;
+}
+
+void prefetch_snapshots(struct prefetch_item **items, size_t len, uint32_t params, unsigned threads) {
+	struct prefetch_job job;
+	pthread_t *tids = NULL;
+	unsigned started = 0;
+	unsigned i;
+
+	job.items = items;
+	job.len = len;
+	job.params = params;
+	atomic_init(&job.next, 0);
+
+	if (threads > len)
+		threads = len;
+
+	if (threads > 1)
+		tids = calloc(threads - 1, sizeof(pthread_t));
+
+	for (i = 0; tids && i < threads - 1; i++) {
+		if (pthread_create(&tids[started], NULL, prefetch_worker, &job) == 0)
+			started++;
+	}
+
+	prefetch_worker(&job);
+
+	for (i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+
+	free(tids);
+}
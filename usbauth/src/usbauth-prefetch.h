@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2018 Stefan Koch <stefan.koch10@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Description : parallel reading of interface snapshots through the device backend
+ *
+ * The snapshots of many interfaces are read by a pool of worker threads.
+ * The workers use only device_snapshot_read, the backend's thread-safe snapshot_fill.
+ * libudev is not thread-safe and is used by the caller only.
+ */
+
+#ifndef USBAUTH_PREFETCH_H_
+#define USBAUTH_PREFETCH_H_
+
+#include <usbauth/generic.h>
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define PREFETCH_MAX_THREADS 16
+
+// an interface whose snapshot is read
+struct prefetch_item {
+	const char *syspath; // sysfs path of the usb_interface (in)
+	bool filled; // true if the snapshot was read with device_snapshot_read (out)
+	struct Snapshot snap; // (out)
+};
+
+/**
+ * get the number of threads to use for prefetching
+ *
+ * Return: number of online CPUs, at least 1 and at most PREFETCH_MAX_THREADS
+ */
+unsigned prefetch_threads();
+
+/**
+ * read the snapshots of the items
+ *
+ * The calling thread is working as well, so all items are read
+ * even if no thread could be started.
+ *
+ * @items: pointers to the interfaces
+ * @len: number of items
+ * @params: parameters to read, see usbauth_snapshot_fill_sysfs
+ * @threads: maximum number of threads including the calling thread
+ */
+void prefetch_snapshots(struct prefetch_item **items, size_t len, uint32_t params, unsigned threads);
+
+#endif /* USBAUTH_PREFETCH_H_ */
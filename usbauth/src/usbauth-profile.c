@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2018 Stefan Koch <stefan.koch10@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Description : timing of the phases and rules for usbauth profile
+ */
+
+#include "usbauth-profile.h"
+
+#include <usbauth/usbauth-configparser.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct profile_count {
+	unsigned spans; // number of spans or evaluations
+	unsigned hits; // only used for rules
+	uint64_t ns; // total time
+};
+
+bool profiling = false;
+
+static const char *phase_names[PHASE_NUM_ITEMS] = {
+	[PHASE_CONFIG] = "config",
+	[PHASE_DBUS] = "dbus",
+	[PHASE_ENUMERATE] = "enumerate",
+	[PHASE_SYSFS] = "sysfs",
+	[PHASE_ANYCHILD] = "anyChild",
+	[PHASE_EVALUATE] = "evaluate",
+	[PHASE_AUTHORIZE] = "authorize",
+	[PHASE_PROBE] = "probe",
+};
+
+static struct profile_count phases[PHASE_NUM_ITEMS];
+static struct profile_count *rules = NULL;
+static unsigned rules_len = 0;
+
+// used by the sort functions, qsort has no user data
+static const struct profile_count *sort_counts = NULL;
+
+uint64_t profile_begin() {
+	struct timespec ts;
+
+	if (!profiling)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void profile_end(enum profile_phase phase, uint64_t start) {
+	if (!profiling || phase >= PHASE_NUM_ITEMS)
+		return;
+
+	phases[phase].spans++;
+	phases[phase].ns += profile_begin() - start;
+}
+
+void profile_rule(unsigned rule, bool hit, uint64_t start) {
+	uint64_t end = 0;
+
+	if (!profiling)
+		return;
+
+	end = profile_begin();
+
+	if (rule >= rules_len) {
+		unsigned len = rule + 1 > rules_len * 2 ? rule + 1 : rules_len * 2;
+		struct profile_count *arr = realloc(rules, len * sizeof(struct profile_count));
+
+		if (!arr)
+			return;
+
+		memset(arr + rules_len, 0, (len - rules_len) * sizeof(struct profile_count));
+		rules = arr;
+		rules_len = len;
+	}
+
+	rules[rule].spans++;
+	rules[rule].ns += end - start;
+
+	if (hit)
+		rules[rule].hits++;
+}
+
+unsigned profile_rule_evals(unsigned rule) {
+	return rule < rules_len ? rules[rule].spans : 0;
+}
+
+void profile_clear_rules() {
+	if (rules)
+		memset(rules, 0, rules_len * sizeof(struct profile_count));
+}
+
+static int cmp_count(const void *a, const void *b) {
+	uint64_t x = sort_counts[*(const unsigned*) a].ns;
+	uint64_t y = sort_counts[*(const unsigned*) b].ns;
+
+	// descending
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static unsigned* sorted(const struct profile_count *counts, unsigned len) {
+	unsigned *order = calloc(len ? len : 1, sizeof(unsigned));
+	unsigned i;
+
+	if (!order)
+		return NULL;
+
+	for (i = 0; i < len; i++)
+		order[i] = i;
+
+	sort_counts = counts;
+	qsort(order, len, sizeof(unsigned), cmp_count);
+	sort_counts = NULL;
+
+	return order;
+}
+
+void profile_report(FILE *out, const struct Auth *auths, unsigned length) {
+	unsigned *order = NULL;
+	unsigned i;
+
+	if (!profiling)
+		return;
+
+	order = sorted(phases, PHASE_NUM_ITEMS);
+	if (!order)
+		return;
+
+	fprintf(out, "%-10s %8s %12s %10s\n", "phase", "spans", "total_us", "mean_us");
+
+	for (i = 0; i < PHASE_NUM_ITEMS; i++) {
+		const struct profile_count *c = &phases[order[i]];
+
+		fprintf(out, "%-10s %8u %12.1f %10.2f\n", phase_names[order[i]], c->spans,
+				c->ns / 1000.0, c->spans ? c->ns / 1000.0 / c->spans : 0.0);
+	}
+
+	free(order);
+
+	if (length > rules_len)
+		length = rules_len;
+
+	order = sorted(rules, length);
+	if (!order)
+		return;
+
+	fprintf(out, "\n%-6s %8s %8s %12s %10s  %s\n", "rule", "evals", "hits", "total_us", "mean_us", "text");
+
+	for (i = 0; i < length; i++) {
+		const struct profile_count *c = &rules[order[i]];
+		const char *str = NULL;
+
+		if (!c->spans)
+			continue;
+
+		str = usbauth_auth_to_str(&auths[order[i]]);
+
+		// the rule number is the line within the config file if it has no empty lines
+		fprintf(out, "%-6u %8u %8u %12.1f %10.2f  %s\n", order[i] + 1, c->spans, c->hits,
+				c->ns / 1000.0, c->ns / 1000.0 / c->spans, str ? str : "");
+
+		free((char*) str);
+	}
+
+	free(order);
+}
+
+void profile_free() {
+	free(rules);
+	rules = NULL;
+	rules_len = 0;
+	memset(phases, 0, sizeof(phases));
+}
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2018 Stefan Koch <stefan.koch10@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of version 2 of the GNU General
+ * Public License as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Description : timing of the phases and rules for usbauth profile
+ *
+ * The spans are measured with the monotonic clock, only if profiling is enabled.
+ * Phases can be nested, example: anyChild contains enumerate and sysfs.
+ * All functions must be called from the main thread.
+ */
+
+#ifndef USBAUTH_PROFILE_H_
+#define USBAUTH_PROFILE_H_
+
+#include <usbauth/generic.h>
+
+#include <stdio.h>
+
+enum profile_phase {
+	PHASE_CONFIG, // parsing the config file
+	PHASE_DBUS, // connecting to the system bus
+	PHASE_ENUMERATE, // enumerating devices and interfaces
+	PHASE_SYSFS, // reading parameters of interfaces
+	PHASE_ANYCHILD, // evaluating anyChild parameters with the interface's siblings
+	PHASE_EVALUATE, // evaluating the rules for an interface
+	PHASE_AUTHORIZE, // writing the authorized attribute
+	PHASE_PROBE, // probing the drivers
+	PHASE_NUM_ITEMS
+};
+
+extern bool profiling;
+
+/**
+ * start a span
+ *
+ * Return: start time, 0 if profiling is disabled
+ */
+uint64_t profile_begin();
+
+/**
+ * end a span of a phase
+ *
+ * @phase: the phase
+ * @start: start time returned by profile_begin
+ */
+void profile_end(enum profile_phase phase, uint64_t start);
+
+/**
+ * end a span of a rule's evaluation for an interface
+ *
+ * @rule: index of the rule within the rule array
+ * @hit: true if the rule matches the interface, for a condition if it is also fulfilled
+ * @start: start time returned by profile_begin
+ */
+void profile_rule(unsigned rule, bool hit, uint64_t start);
+
+/**
+ * get the number of evaluations of a rule since the counts were cleared
+ *
+ * @rule: index of the rule within the rule array
+ *
+ * Return: the number of evaluations, 0 if profiling is disabled
+ */
+unsigned profile_rule_evals(unsigned rule);
+
+/**
+ * forget the counts of the rules, example: the rules were reloaded
+ */
+void profile_clear_rules();
+
+/**
+ * print the phases and the rules, sorted by their total time
+ *
+ * @out: output stream
+ * @auths: auth rules
+ * @length: auth rules length
+ */
+void profile_report(FILE *out, const struct Auth *auths, unsigned length);
+
+/**
+ * free the counts
+ */
+void profile_free();
+
+#endif /* USBAUTH_PROFILE_H_ */
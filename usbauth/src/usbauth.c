@@ -25,26 +25,132 @@
  */
 
 #include "usbauth.h"
+#include "usbauth-counts.h"
+#include "usbauth-dcache.h"
+#include "usbauth-index.h"
+#include "usbauth-prefetch.h"
+#include "usbauth-device.h"
+#include "usbauth-gate.h"
+#include "usbauth-metrics.h"
+#include "usbauth-profile.h"
 
 #include <usbauth/usbauth-configparser.h>
 
 #include <inttypes.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <syslog.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pwd.h>
+#include <grp.h>
 #include <sys/file.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 
 #define LOCK_FILE "/var/run/usbauth.pid"
-
-static FILE *logfile = NULL;
-
-static struct udev *udev = NULL;
+#define DCACHE_FILE "/var/lib/usbauth/decisions.cache"
+#define GATE_DIR "/run/usbauth" // records of the gated root hubs
+
+// the metrics file is fixed at build time, it is written by root and must not be chosen by the caller
+#ifndef METRICS_FILE
+#define METRICS_FILE "/var/lib/node_exporter/textfile_collector/usbauth.prom"
+#endif
+#define NOTIFIER_GROUP "usbauth-notifier"
+#define DBUS_CALL_TIMEOUT 1000 // milliseconds, the bus answers a call of the daemon at most this late
+#define DBUS_RETRY_TIMEOUT 10 // milliseconds, then the daemon tries again to send the queued messages
+
+// parameters sent to the notifier, read together with the parameters of the rules
+#define PARAM_BITS_NOTIFY (PARAM_BIT(busnum) | PARAM_BIT(devpath) | PARAM_BIT(idVendor) | PARAM_BIT(idProduct) | PARAM_BIT(devnum) \
+		| PARAM_BIT(bConfigurationValue) | PARAM_BIT(bInterfaceNumber) | PARAM_BIT(bInterfaceClass) | PARAM_BIT(bInterfaceSubClass) | PARAM_BIT(bInterfaceProtocol))
+
+struct udev *udev = NULL;
 DBusConnection *bus = NULL;
-struct udev_device *plug_usb_device = NULL;
-static bool *iscounted = NULL;
+static const char *plug_usb_device = NULL; // syspath of the plugged device, excluded from the counts
 static bool debuglog = false;
+static bool gating = false; // the daemon gates the root hubs with interface_authorized_default
+static char **probe_pending = NULL; // syspaths of devices to probe
+static unsigned probe_pending_len = 0;
+static struct rule_index *rule_index = NULL;
+static uint32_t rule_params = PARAM_BITS_SYSFS; // parameters read from sysfs for an evaluation
+static bool bus_named = false; // true if the name org.opensuse.usbauth is owned
+
+// an authorized interface with the parameters of its evaluation, sent to the notifier
+struct notify_intf {
+	char *interface;
+	bool authorize;
+	struct Snapshot snap;
+};
+
+// the interfaces of a device, sent in one signal
+struct notify_dev {
+	char *device;
+	struct notify_intf *intfs;
+	unsigned len;
+};
+
+static struct notify_dev *notify_pending = NULL;
+static unsigned notify_pending_len = 0;
+
+// condition results of the currently evaluated interface, valid if the stamp is unchanged,
+// for a condition that reads its own intfcount also if the intfcount is unchanged
+struct cond_memo {
+	unsigned stamp;
+	unsigned intfcount;
+	struct match_ret ret;
+};
+
+static struct cond_memo *cond_memo = NULL;
+static size_t cond_memo_len = 0;
+static unsigned cond_stamp = 0;
+static bool *cond_counted = NULL; // per rule, true if the rule reads its own intfcount
+static size_t cond_counted_len = 0;
+
+// values of the anyChild parameters across the eligible interfaces of a device, built once per evaluation of the device
+struct sibling_summary {
+	char device[PATH_MAX]; // syspath of the summarized usb_device, empty if it must be built again
+	uint32_t params; // parameters in the snapshots
+	struct Snapshot *snaps; // one per eligible interface
+	unsigned len;
+	unsigned cap;
+	unsigned *sets; // per parameter the indices of the snapshots with distinct values, sets[param * cap]
+	unsigned set_len[PARAM_NUM_ITEMS];
+};
+
+static struct sibling_summary siblings;
+static uint32_t anychild_params = 0; // parameters used by anyChild data of the rules
+
+// an interface collected by scan_device, evaluated with its prefetched snapshot
+struct scan_intf {
+	char *interface;
+	struct prefetch_item item;
+	struct auth_ret r;
+	bool write; // the decision is written by scan_apply
+};
+
+// a device and its interfaces from scan.intfs[first] to scan.intfs[first + len - 1]
+struct scan_dev {
+	char *device;
+	unsigned first;
+	unsigned len;
+	bool removed; // below a denied hub interface, in a serial pass the kernel has removed it before it is evaluated
+};
+
+// devices and interfaces in the order of the evaluation
+struct scan {
+	struct scan_dev *devs;
+	unsigned dev_len;
+	unsigned dev_cap;
+	struct scan_intf *intfs;
+	unsigned intf_len;
+	unsigned intf_cap;
+	bool apply; // the decisions are written after the evaluation
+	bool unauthorized_only; // only the decisions of the interfaces that are not authorized are written
+};
 
 bool match_valsStr(const char *lval, enum Operator op, const char *rval) {
 	bool ret = false;
@@ -112,94 +218,171 @@ bool match_vals(const char *lvalStr, enum Operator op, const char *rvalStr) {
 	return ret;
 }
 
-bool match_vals_interface(struct Auth *rule, struct Data *d, struct udev_device *interface) {
+bool match_vals_data(const char *lvalStr, int lval, const struct Data *d) {
 	bool ret = false;
-	const char* lvalStr = NULL;
-	const char* rvalStr = d->val;
-	const char *type = udev_device_get_devtype(interface);
-	char cntStr[16];
-	strcpy(cntStr, "");
 
-	if (!type || strcmp(type, "usb_interface") != 0)
+	if (!lvalStr || d->cmp == CMP_NONE)
 		return false;
 
+	// both values were converted before, the integer compare needs two valid values
+	if (d->cmp != CMP_INT)
+		lval = -1;
+
+	if (lval != -1)
+		ret = match_valsInt(lval, d->op, d->ival);
+	else
+		ret = match_valsStr(lvalStr, d->op, d->val);
+
+	if (debuglog)
+		syslog(LOG_DEBUG, "match_vals_data:%i (%s %s %s), (%i %s %i)\n", ret, lvalStr, usbauth_op_to_str(d->op), d->val, lval, usbauth_op_to_str(d->op), d->ival);
+
+	return ret;
+}
+
+bool match_vals_interface(struct Auth *rule, struct Data *d, const struct Snapshot *snap) {
+	bool ret = false;
+
 	if (intfcount == d->param) { // intfcount parameter is not in sysfs
-		char* rend = NULL;
-		int rval = strtol(rvalStr, &rend, 16);
-		if (rend && *rend != 0)
-			ret = false;
-		else
-			ret = match_valsInt(rule->intfcount + 1, d->op, rval);
+		ret = d->cmp == CMP_INT && match_valsInt(rule->intfcount + 1, d->op, d->ival);
 	} else if (devcount == d->param) { // devcount parameter is not in sysfs
-		char* rend = NULL;
-		int rval = strtol(rvalStr, &rend, 16);
-		if (rend && *rend != 0)
-			ret = false;
-		else
-			ret = match_valsInt(rule->devcount + 1, d->op, rval);
-	} else {
-		lvalStr = usbauth_get_param_valStr(d->param, interface); // get parameter from sysfs
-		ret = match_vals(lvalStr, d->op, rvalStr);
+		ret = d->cmp == CMP_INT && match_valsInt(rule->devcount + 1, d->op, d->ival);
+	} else { // get parameter from sysfs snapshot
+		ret = match_vals_data(usbauth_snapshot_get_valStr(snap, d->param), usbauth_snapshot_get_val(snap, d->param), d);
 	}
 
 	return ret;
 }
 
-bool match_vals_device(struct Auth *rule, struct Data *d, struct udev_device *device) {
-	bool matches = false;
-	const char *path = udev_device_get_syspath(device);
-	const char *type = udev_device_get_devtype(device);
-	struct udev_list_entry *devices = NULL, *entry = NULL;
-	struct udev_enumerate *enumerate = NULL;
-	int dev_class = 0;
+static bool same_valStr(const char *a, const char *b) {
+	return a == b || (a && b && strcmp(a, b) == 0);
+}
+
+static bool siblings_grow(unsigned len) {
+	struct Snapshot *snaps = NULL;
+	unsigned *sets = NULL;
+	unsigned cap = siblings.cap ? siblings.cap : 8;
+
+	if (len <= siblings.cap)
+		return true;
 
-	if (!path || !type || strcmp(type, "usb_device") != 0)
+	while (cap < len)
+		cap *= 2;
+
+	snaps = realloc(siblings.snaps, cap * sizeof(struct Snapshot));
+	if (!snaps)
 		return false;
 
-	enumerate = udev_enumerate_new(udev);
+	siblings.snaps = snaps;
 
-	if (!enumerate)
+	// the sets are filled after all snapshots, so they need not to be moved
+	sets = realloc(siblings.sets, PARAM_NUM_ITEMS * cap * sizeof(unsigned));
+	if (!sets)
 		return false;
 
-	udev_enumerate_add_match_parent(enumerate, device);
-	udev_enumerate_scan_devices(enumerate);
-	devices = udev_enumerate_get_list_entry(enumerate);
+	siblings.sets = sets;
+	siblings.cap = cap;
+
+	return true;
+}
 
-	if (!devices)
+// read the parameters of the device's interfaces once and group them by distinct values
+static bool siblings_build(const char *device, uint32_t params) {
+	struct device_list intfs;
+	char buf[256];
+	int dev_class = 0;
+	unsigned i, j, k;
+
+	siblings.device[0] = 0;
+	siblings.params = params;
+	siblings.len = 0;
+	memset(siblings.set_len, 0, sizeof(siblings.set_len));
+
+	if (strlen(device) >= sizeof(siblings.device) || !device_enumerate(device, "usb_interface", &intfs))
 		return false;
 
 	// get the current class from sysfs, because unmatched interfaces should be unchanged
-	dev_class = usbauth_get_param_val(bDeviceClass, device);
+	dev_class = device_get_param_val(bDeviceClass, device);
+
+	// iterate over the childs (usb_interface's) of the usb_device
+	for (i = 0; i < intfs.len; i++) {
+		const char *interface = intfs.paths[i];
+		struct Snapshot *snap = NULL;
 
-	// iterate over the childs (usb_interface's) of the udevdev (usb_device)
-	udev_list_entry_foreach(entry, devices)
-	{
-		const char *path = NULL;
-		struct udev_device *interface = NULL;
-		const char *type = NULL;
+		if (dev_class == 9 && device_get_param_val(bInterfaceClass, interface) != 9) // dev class is HUB and intf class is not HUB
+			continue; // skip device childs from hubs, use only hub's interfaces
 
-		if (entry)
-			path = udev_list_entry_get_name(entry);
+		if (!siblings_grow(siblings.len + 1)) {
+			device_list_free(&intfs);
+			return false;
+		}
+
+		// only the parameters of anyChild data are needed from the sibling, devcount and intfcount are not in sysfs
+		snap = &siblings.snaps[siblings.len++];
+		usbauth_snapshot_clear(snap);
+
+		for (j = INVALID + 1; j < PARAM_NUM_ITEMS; j++) {
+			if (params & PARAM_BITS_SYSFS & PARAM_BIT(j))
+				usbauth_snapshot_set(snap, j, device_get_param_valStr(j, interface, buf, sizeof(buf)));
+		}
+	}
+
+	device_list_free(&intfs);
+
+	for (j = INVALID + 1; j < PARAM_NUM_ITEMS; j++) {
+		unsigned *set = &siblings.sets[j * siblings.cap];
 
-		if (path)
-			interface = udev_device_new_from_syspath(udev, path);
+		if (!(params & PARAM_BIT(j)))
+			continue;
 
-		if (interface)
-			type = udev_device_get_devtype(interface);
+		for (i = 0; i < siblings.len; i++) {
+			const char *str = usbauth_snapshot_get_valStr(&siblings.snaps[i], j);
 
-		if (type && strcmp(type, "usb_interface") == 0) {
-			int intf_class = usbauth_get_param_val(bInterfaceClass, interface);
-			if (dev_class == 9 && intf_class != 9) // dev class is HUB and intf class is not HUB
-				continue; // skip device childs from hubs, use only hub's interfaces
+			for (k = 0; k < siblings.set_len[j] && !same_valStr(str, usbauth_snapshot_get_valStr(&siblings.snaps[set[k]], j)); k++);
 
-			matches |= match_vals_interface(rule, d, interface);
+			if (k == siblings.set_len[j])
+				set[siblings.set_len[j]++] = i;
 		}
+	}
+
+	strcpy(siblings.device, device);
+
+	return true;
+}
+
+// the summary is built again at the next anyChild check, example: a device with the same syspath was plugged
+static void siblings_reset() {
+	siblings.device[0] = 0;
+}
+
+static void siblings_free() {
+	free(siblings.snaps);
+	free(siblings.sets);
+	memset(&siblings, 0, sizeof(siblings));
+}
+
+bool match_vals_device(struct Auth *rule, struct Data *d, const char *device) {
+	bool matches = false;
+	const unsigned *set = NULL;
+	unsigned i;
+
+	uint64_t start = profile_begin();
 
-		if (interface)
-			udev_device_unref(interface);
+	// the summary holds all anyChild parameters of the rules, an unknown parameter is added
+	if (device && (strcmp(siblings.device, device) != 0 || !(siblings.params & PARAM_BIT(d->param))))
+		siblings_build(device, anychild_params | siblings.params | PARAM_BIT(d->param));
+
+	if (!device || strcmp(siblings.device, device) != 0) {
+		profile_end(PHASE_ANYCHILD, start);
+		return false;
 	}
 
-	udev_enumerate_unref(enumerate);
+	// the constraint is checked once per distinct value instead of once per interface
+	set = &siblings.sets[d->param * siblings.cap];
+
+	for (i = 0; i < siblings.set_len[d->param] && !matches; i++)
+		matches = match_vals_interface(rule, d, &siblings.snaps[set[i]]);
+
+	profile_end(PHASE_ANYCHILD, start);
 
 	if (debuglog)
 		syslog(LOG_DEBUG, "match_vals_device:%i\n", matches);
@@ -219,120 +402,275 @@ bool no_error_check_dbus(DBusError *error) {
 	return ret;
 }
 
-void send_dbus(struct udev_device *udevdev, int32_t authorize, int32_t devn) {
-	DBusMessage *msg = NULL;
+bool request_name_dbus() {
 	DBusError error;
-	bool dbusret = false;
-	const char *path = udev_device_get_syspath(udevdev);
 
-	if (!bus)
-		return;
+	if (!bus || bus_named)
+		return bus_named;
 
 	dbus_error_init(&error);
 	dbus_bus_request_name(bus, "org.opensuse.usbauth", DBUS_NAME_FLAG_REPLACE_EXISTING, &error);
+	bus_named = no_error_check_dbus(&error);
 
-	if (!no_error_check_dbus(&error))
-		return;
+	return bus_named;
+}
 
-	msg = dbus_message_new_signal("/usbauth/signal/Object", "org.opensuse.usbauth.Message", "usbauth");
+static const char* notify_str(const struct Snapshot *snap, enum Parameter param) {
+	const char *str = usbauth_snapshot_get_valStr(snap, param);
 
-	if (!msg || !path)
-		return;
+	return str ? str : "";
+}
 
-	dbusret = dbus_message_append_args(msg, DBUS_TYPE_INT32, &authorize, DBUS_TYPE_INT32, &devn, DBUS_TYPE_STRING, &path, DBUS_TYPE_INVALID);
+// device(string device, int32 devnum, string busnum, string devpath, int32 idVendor, int32 idProduct,
+//        array of (boolean authorize, string path, string bConfigurationValue, string bInterfaceNumber,
+//                  int32 bInterfaceClass, int32 bInterfaceSubClass, int32 bInterfaceProtocol))
+static bool send_dbus_device(const struct notify_dev *dev) {
+	const struct Snapshot *first = &dev->intfs[0].snap;
+	const char *busn = notify_str(first, busnum);
+	const char *devp = notify_str(first, devpath);
+	int32_t devn = usbauth_snapshot_get_val(first, devnum);
+	int32_t vId = usbauth_snapshot_get_val(first, idVendor);
+	int32_t pId = usbauth_snapshot_get_val(first, idProduct);
+	DBusMessageIter iter;
+	DBusMessageIter array;
+	DBusMessage *msg = NULL;
+	bool ret = false;
+	unsigned i;
 
-	if (dbusret)
-		dbusret = dbus_connection_send(bus, msg, NULL);
+	msg = dbus_message_new_signal("/usbauth/signal/Object", "org.opensuse.usbauth.Message", "device");
 
-	if (dbusret)
-		dbus_connection_flush(bus);
+	if (!msg)
+		return false;
+
+	dbus_message_iter_init_append(msg, &iter);
+	ret = dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &dev->device);
+	ret &= dbus_message_iter_append_basic(&iter, DBUS_TYPE_INT32, &devn);
+	ret &= dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &busn);
+	ret &= dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &devp);
+	ret &= dbus_message_iter_append_basic(&iter, DBUS_TYPE_INT32, &vId);
+	ret &= dbus_message_iter_append_basic(&iter, DBUS_TYPE_INT32, &pId);
+	ret &= dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "(bsssiii)", &array);
+
+	for (i = 0; ret && i < dev->len; i++) {
+		const struct notify_intf *intf = &dev->intfs[i];
+		dbus_bool_t authorize = intf->authorize;
+		const char *conf = notify_str(&intf->snap, bConfigurationValue);
+		const char *num = notify_str(&intf->snap, bInterfaceNumber);
+		int32_t cl = usbauth_snapshot_get_val(&intf->snap, bInterfaceClass);
+		int32_t subcl = usbauth_snapshot_get_val(&intf->snap, bInterfaceSubClass);
+		int32_t iprot = usbauth_snapshot_get_val(&intf->snap, bInterfaceProtocol);
+		DBusMessageIter record;
+
+		ret = dbus_message_iter_open_container(&array, DBUS_TYPE_STRUCT, NULL, &record);
+		ret &= dbus_message_iter_append_basic(&record, DBUS_TYPE_BOOLEAN, &authorize);
+		ret &= dbus_message_iter_append_basic(&record, DBUS_TYPE_STRING, &intf->interface);
+		ret &= dbus_message_iter_append_basic(&record, DBUS_TYPE_STRING, &conf);
+		ret &= dbus_message_iter_append_basic(&record, DBUS_TYPE_STRING, &num);
+		ret &= dbus_message_iter_append_basic(&record, DBUS_TYPE_INT32, &cl);
+		ret &= dbus_message_iter_append_basic(&record, DBUS_TYPE_INT32, &subcl);
+		ret &= dbus_message_iter_append_basic(&record, DBUS_TYPE_INT32, &iprot);
+		ret &= dbus_message_iter_close_container(&array, &record);
+	}
+
+	if (ret)
+		ret = dbus_message_iter_close_container(&iter, &array);
+
+	// queued without blocking, the daemon writes it from its event loop, other modes flush at exit
+	if (ret)
+		ret = dbus_connection_send(bus, msg, NULL);
 
 	dbus_message_unref(msg);
 
-	syslog(LOG_NOTICE, "send dbus message (path=%s)\n", path);
+	syslog(LOG_NOTICE, "send dbus message (device=%s, interfaces=%u)\n", dev->device, dev->len);
+
+	return ret;
 }
 
-void probe_interface(struct udev_device *interface) {
-	const char *type = udev_device_get_devtype(interface);
-	if (type && strcmp(type, "usb_interface") == 0) {
-		const char *name = udev_device_get_sysname(interface);
-		FILE *probe = fopen("/sys/bus/usb/drivers_probe", "w");
+// usbauth(int32 authorize, int32 devnum, string path), the signal per interface before the device signal
+// it is still sent for one release, so a notifier that was not updated yet keeps working
+static bool send_dbus_usbauth(const struct notify_intf *intf) {
+	int32_t authorize = intf->authorize;
+	int32_t devn = usbauth_snapshot_get_val(&intf->snap, devnum);
+	DBusMessage *msg = NULL;
+	bool ret = false;
+
+	msg = dbus_message_new_signal("/usbauth/signal/Object", "org.opensuse.usbauth.Message", "usbauth");
 
-		if (!name || !probe)
-			return;
+	if (!msg)
+		return false;
 
-		fprintf(probe, "%s", name);
-		fclose(probe);
-	}
+	ret = dbus_message_append_args(msg, DBUS_TYPE_INT32, &authorize, DBUS_TYPE_INT32, &devn, DBUS_TYPE_STRING, &intf->interface, DBUS_TYPE_INVALID);
+
+	if (ret)
+		ret = dbus_connection_send(bus, msg, NULL);
+
+	dbus_message_unref(msg);
+
+	return ret;
 }
 
-void probe_device(struct udev_device *udevdev) {
-	const char *path = udev_device_get_syspath(udevdev);
-	const char *type = udev_device_get_devtype(udevdev);
-	struct udev_list_entry *devices = NULL, *entry = NULL;
-	struct udev_enumerate *enumerate = NULL;
+void send_dbus_later(const char *interface, bool authorize, const struct Snapshot *snap) {
+	char parent[PATH_MAX];
+	struct notify_dev *dev = NULL;
+	struct notify_intf *intf = NULL;
+	unsigned i;
 
-	if (!path || !type || strcmp(type, "usb_device") != 0)
+	if (!bus || !device_parent(interface, parent, sizeof(parent)))
 		return;
 
-	enumerate = udev_enumerate_new(udev);
+	for (i = 0; i < notify_pending_len && !dev; i++) {
+		if (strcmp(notify_pending[i].device, parent) == 0)
+			dev = &notify_pending[i];
+	}
 
-	if (!enumerate)
+	if (!dev) {
+		dev = realloc(notify_pending, (notify_pending_len + 1) * sizeof(struct notify_dev));
+		if (!dev)
+			return;
+
+		notify_pending = dev;
+		dev = &notify_pending[notify_pending_len];
+		memset(dev, 0, sizeof(struct notify_dev));
+		dev->device = strdup(parent);
+
+		if (!dev->device)
+			return;
+
+		notify_pending_len++;
+	}
+
+	intf = realloc(dev->intfs, (dev->len + 1) * sizeof(struct notify_intf));
+	if (!intf)
 		return;
 
-	udev_enumerate_add_match_parent(enumerate, udevdev);
-	udev_enumerate_scan_devices(enumerate);
-	devices = udev_enumerate_get_list_entry(enumerate);
+	dev->intfs = intf;
+	intf = &dev->intfs[dev->len];
+	intf->interface = strdup(interface);
+	intf->authorize = authorize;
+	intf->snap = *snap;
+
+	if (intf->interface)
+		dev->len++;
+}
+
+void send_dbus_pending() {
+	unsigned i, j;
+
+	for (i = 0; i < notify_pending_len; i++) {
+		struct notify_dev *dev = &notify_pending[i];
+
+		if (dev->len && request_name_dbus()) {
+			send_dbus_device(dev);
+
+			for (j = 0; j < dev->len; j++)
+				send_dbus_usbauth(&dev->intfs[j]);
+		}
+
+		for (j = 0; j < dev->len; j++)
+			free(dev->intfs[j].interface);
 
-	if (!devices)
+		free(dev->intfs);
+		free(dev->device);
+	}
+
+	free(notify_pending);
+	notify_pending = NULL;
+	notify_pending_len = 0;
+}
+
+void probe_interface(const char *interface) {
+	struct device_list intfs;
+	char *path = (char*) interface;
+
+	intfs.paths = &path;
+	intfs.len = 1;
+
+	if (!device_probe(&intfs) && debuglog)
+		syslog(LOG_DEBUG, "probe of %s failed\n", interface);
+}
+
+void probe_device(const char *device) {
+	struct device_list intfs;
+
+	// the interfaces are probed together, the backend opens the probe file once
+	if (!device || !device_enumerate(device, "usb_interface", &intfs))
 		return;
 
-	// iterate over the childs (usb_interface's) of the udevdev (usb_device)
-	udev_list_entry_foreach(entry, devices)
-	{
-		const char *intfpath = NULL;
-		struct udev_device *interface = NULL;
+	if (!device_probe(&intfs) && debuglog)
+		syslog(LOG_DEBUG, "probe of %s failed\n", device);
+
+	device_list_free(&intfs);
+}
+
+void probe_device_later(const char *device) {
+	char **arr = NULL;
+	unsigned i;
+
+	if (!device)
+		return;
 
-		if (entry)
-			intfpath = udev_list_entry_get_name(entry);
+	for (i = 0; i < probe_pending_len; i++) {
+		if (strcmp(probe_pending[i], device) == 0)
+			return;
+	}
 
-		if (intfpath)
-			interface = udev_device_new_from_syspath(udev, intfpath);
+	arr = realloc(probe_pending, (probe_pending_len + 1) * sizeof(char*));
+	if (!arr) {
+		probe_device(device);
+		return;
+	}
 
-		if (interface)
-			type = udev_device_get_devtype(interface);
+	probe_pending = arr;
+	probe_pending[probe_pending_len] = strdup(device);
 
-		// probe interface
-		probe_interface(interface);
+	if (probe_pending[probe_pending_len])
+		probe_pending_len++;
+	else
+		probe_device(device);
+}
 
-		if (interface)
-			udev_device_unref(interface);
+void probe_devices_pending() {
+	unsigned i;
+	for (i = 0; i < probe_pending_len; i++) {
+		probe_device(probe_pending[i]);
+		free(probe_pending[i]);
 	}
-	udev_enumerate_unref(enumerate);
+
+	free(probe_pending);
+	probe_pending = NULL;
+	probe_pending_len = 0;
 }
 
-void authorize_interface(struct udev_device *interface, bool authorize, bool dbus) {
-	const char *path = udev_device_get_syspath(interface);
-	const char *type = udev_device_get_devtype(interface);
-	int32_t devn = usbauth_get_param_val(devnum, interface);
-	struct udev_device *parent = udev_device_get_parent(interface);
+void authorize_interface(const char *interface, bool authorize, const struct Snapshot *snap) {
 	char valueStr[16];
 
-	if (!path || !type || !parent || strcmp(type, "usb_interface") != 0)
+	if (!interface || !device_is_devtype(interface, "usb_interface"))
 		return;
 
 	strcpy(valueStr, "");
 	snprintf(valueStr, 16, "%" SCNu8, authorize);
 
-	udev_device_set_sysattr_value(interface, "authorized", valueStr);
+	if (device_write_attr(interface, "authorized", valueStr))
+		metrics_authorized();
+	else
+		syslog(LOG_ERR, "cannot write %s/authorized\n", interface);
 
-	syslog(LOG_NOTICE, "%s interface %s/authorized\n", authorize ? "allow" : "deny", path);
+	syslog(LOG_NOTICE, "%s interface %s/authorized\n", authorize ? "allow" : "deny", interface);
 
-	// probe all device's childs to avoid side-effects with drivers that need multiple interfaces
-	probe_device(parent);
+	if (snap)
+		send_dbus_later(interface, authorize, snap);
+}
+// allow or deny an interface by its evaluation, returns true if the interface's device must be probed
+static bool apply_decision(const char *interface, const struct auth_ret *r, const struct Snapshot *snap) {
+	// do only if one rule has matched, so if there would no generic rule and no specific rule do nothing
+	if (r->match)
+		authorize_interface(interface, r->allowed, snap);
+	else if (gate_active)
+		authorize_interface(interface, true, NULL); // the gate replaces the kernel's default, so no notification
+	else
+		return false;
 
-	if (dbus)
-		send_dbus(interface, authorize, devn);
+	return true;
 }
 
 bool isRule(struct Auth *array, unsigned array_length) {
@@ -347,14 +685,14 @@ bool isRule(struct Auth *array, unsigned array_length) {
 	return ret;
 }
 
-bool match_data(struct Auth *rule, struct Data *d, struct udev_device *interface) {
+bool match_data(struct Auth *rule, struct Data *d, const char *interface, const struct Snapshot *snap) {
+	char parent[PATH_MAX];
 	bool ret = false;
-	struct udev_device *parent = udev_device_get_parent(interface);
 
 	if (d->anyChild) {
-		ret = match_vals_device(rule, d, parent);
+		ret = match_vals_device(rule, d, device_parent(interface, parent, sizeof(parent)));
 	} else {
-		ret = match_vals_interface(rule, d, interface);
+		ret = match_vals_interface(rule, d, snap);
 	}
 
 	if (debuglog)
@@ -363,7 +701,7 @@ bool match_data(struct Auth *rule, struct Data *d, struct udev_device *interface
 	return ret;
 }
 
-struct match_ret match_auth_interface(struct Auth *rule, struct udev_device *interface) {
+struct match_ret match_auth_interface(struct Auth *rule, const char *interface, const struct Snapshot *snap) {
 	int i;
 	struct match_ret ret;
 	bool match = false;
@@ -390,7 +728,7 @@ struct match_ret match_auth_interface(struct Auth *rule, struct udev_device *int
 			return ret;
 		}
 
-		match = match_data(rule, d, interface);
+		match = match_data(rule, d, interface, snap);
 		ret.match_attrs &= match;
 
 		if (d->param != devcount && d->param != intfcount)
@@ -409,196 +747,459 @@ struct match_ret match_auth_interface(struct Auth *rule, struct udev_device *int
 			return ret;
 		}
 
-		ret.match_conds &= match_data(rule, d, interface);
+		ret.match_conds &= match_data(rule, d, interface, snap);
 	}
 
 	return ret;
 }
 
-struct auth_ret match_auths_interface(struct Auth *rule_array, size_t array_len, struct udev_device *usb_interface) {
+struct match_ret match_cond_interface(struct Auth *rule_array, size_t array_len, unsigned cond, const char *usb_interface, const struct Snapshot *snap) {
+	struct cond_memo *m = NULL;
+
+	if (array_len > cond_memo_len) {
+		struct cond_memo *arr = realloc(cond_memo, array_len * sizeof(struct cond_memo));
+
+		if (!arr)
+			return match_auth_interface(&rule_array[cond], usb_interface, snap);
+
+		memset(arr + cond_memo_len, 0, (array_len - cond_memo_len) * sizeof(struct cond_memo));
+		cond_memo = arr;
+		cond_memo_len = array_len;
+	}
+
+	// the result depends only on the interface and on the condition's own counts,
+	// only the intfcount is incremented during the evaluation of an interface if the condition is fulfilled
+	m = &cond_memo[cond];
+	if (m->stamp != cond_stamp || ((cond >= cond_counted_len || cond_counted[cond]) && m->intfcount != rule_array[cond].intfcount)) {
+		uint64_t start = profile_begin();
+
+		m->ret = match_auth_interface(&rule_array[cond], usb_interface, snap);
+		profile_rule(cond, m->ret.match_attrs && m->ret.match_conds, start);
+		m->stamp = cond_stamp;
+		m->intfcount = rule_array[cond].intfcount;
+	}
+
+	return m->ret;
+}
+
+// read the interface's and device's parameters once for all rules, read_attr of the backend is only used if its snapshot_fill fails
+static void snapshot_read(struct Snapshot *snap, const char *usb_interface) {
+	uint64_t start = profile_begin();
+	bool filled = device_snapshot_read(snap, usb_interface, rule_params);
+
+	profile_end(PHASE_SYSFS, start);
+
+	if (!filled)
+		device_snapshot_fill(snap, usb_interface);
+}
+
+struct auth_ret match_auths_interface(struct Auth *rule_array, size_t array_len, const char *usb_interface) {
+	struct Snapshot snap;
+
+	snapshot_read(&snap, usb_interface);
+
+	return match_auths_interface_snapshot(rule_array, array_len, usb_interface, &snap);
+}
+
+struct auth_ret match_auths_interface_snapshot(struct Auth *rule_array, size_t array_len, const char *usb_interface, const struct Snapshot *snap) {
 	int i;
+	unsigned k;
+	unsigned cand_len = array_len;
+	unsigned cond_len = array_len;
+	const unsigned *cand = NULL;
+	const unsigned *conds = NULL;
 	struct auth_ret ret;
+	uint64_t start = profile_begin();
 	ret.match = false;
 	ret.allowed = false;
+	ret.rule = -1;
+
+	// a known device under the same rules is decided without evaluation
+	if (dcache_lookup(snap, &ret))
+		return ret;
+
+	// with the index only rules are iterated that could match the interface's idVendor, idProduct and bInterfaceClass
+	if (index_valid(rule_index, rule_array, array_len)) {
+		cand = index_candidates(rule_index, snap, &cand_len);
+		conds = index_conds(rule_index, &cond_len);
+	}
+
+	// invalidate the condition results of the previous interface
+	if (++cond_stamp == 0) {
+		memset(cond_memo, 0, cond_memo_len * sizeof(struct cond_memo));
+		cond_stamp = 1;
+	}
 
 	// iterate over the rules without conditions from the auth array
 	// for each rule that (case) attributes matches with the given interface
-	for (i = 0; i < array_len; i++) {
-		struct match_ret r1 = match_auth_interface(&rule_array[i], usb_interface);
-		bool ruleApplicable = r1.match_attrs_nocnts; // true if interface is affected by rule
-		if (rule_array[i].type != COND && ruleApplicable) {
-			int j = 0;
+	for (k = 0; k < cand_len; k++) {
+		struct match_ret r1;
+		bool ruleApplicable = false;
+		uint64_t rule_start = 0;
+
+		i = cand ? cand[k] : k;
+		if (rule_array[i].type == COND || rule_array[i].type == COMMENT)
+			continue;
+
+		rule_start = profile_begin();
+		r1 = match_auth_interface(&rule_array[i], usb_interface, snap);
+		profile_rule(i, r1.match_attrs, rule_start);
+		ruleApplicable = r1.match_attrs_nocnts; // true if interface is affected by rule
+
+		// conditions affecting only ALLOW rules
+		if (rule_array[i].type == ALLOW && ruleApplicable) {
+			unsigned l = 0;
 
 			// iterate only over the conditions from the auth array
 			// to check whether the auth rule matches the conditions
-			for (j = 0; j < array_len; j++) {
-				// conditions affecting only ALLOW rules
-				if (rule_array[j].type == COND && rule_array[i].type == ALLOW) {
-					struct match_ret r = match_auth_interface(&rule_array[j], usb_interface);
+			for (l = 0; l < cond_len; l++) {
+				unsigned j = conds ? conds[l] : l;
+
+				if (rule_array[j].type == COND) {
+					struct match_ret r = match_cond_interface(rule_array, array_len, j, usb_interface, snap);
 					// if the condition belongs to the interface (match_attrs is true, that are the case parameters)
 					// AND the condition is fulfilled (match_conds is true, that are the condition parameters)
 					if (r.match_attrs && r.match_conds) {
 						rule_array[j].intfcount++; // count affects r.match_conds
-
-						if (iscounted)
-							iscounted[j] = true; // the devcount will incremented later to avoid side effects
+						counts_mark(j); // the devcount will incremented later to avoid side effects
 					} else if (r.match_attrs && !r.match_conds) // only if the condition belongs to the interface (cases, match_attrs) and the condition is not fulfilled (conds, match_conds)
 						ruleApplicable = false; // condition conflicts with affected rule then ignore the rule
 				}
 			}
+		}
 
-			if (ruleApplicable) { // if current/iterated interface matched rule and was not disabled by conflicting condition
-				rule_array[i].intfcount++; // describes how much interfaces are affected by the rule
-
-				if (iscounted)
-					iscounted[i] = true; // the devcount will incremented later to avoid side effects
+		if (ruleApplicable) { // if current/iterated interface matched rule and was not disabled by conflicting condition
+			rule_array[i].intfcount++; // describes how much interfaces are affected by the rule
+			counts_mark(i); // the devcount will incremented later to avoid side effects
 
-				if (r1.match_attrs) {
-					ret.match |= true; // if interface is affected by at least one rule do allow or deny it, otherwise skip allow/deny action
-					ret.allowed = rule_array[i].type == ALLOW ? true : false; // allow or deny usb_interface, last rule is deciding
-				}
+			if (r1.match_attrs) {
+				ret.match |= true; // if interface is affected by at least one rule do allow or deny it, otherwise skip allow/deny action
+				ret.allowed = rule_array[i].type == ALLOW ? true : false; // allow or deny usb_interface, last rule is deciding
+				ret.rule = i;
 			}
 		}
 	}
 
+	profile_end(PHASE_EVALUATE, start);
+	dcache_store(snap, &ret);
+
 	if (debuglog)
 		syslog(LOG_DEBUG, "match_auths_interface:%i:%i\n", ret.match, ret.allowed);
 
 	return ret;
 }
 
-void match_auths_device_interfaces(struct Auth *rule_array, size_t array_len, struct udev_device *usb_device) {
-	const char *type = udev_device_get_devtype(usb_device);
-	const char *path = udev_device_get_syspath(usb_device);
-	struct udev_list_entry *devices = NULL, *entry = NULL;
-	struct udev_enumerate *enumerate = NULL;
+static bool scan_grow(void **arr, unsigned *cap, unsigned len, size_t size) {
+	unsigned new_cap = *cap ? *cap * 2 : 16;
+	void *new_arr = NULL;
+
+	if (len < *cap)
+		return true;
+
+	new_arr = realloc(*arr, new_cap * size);
+	if (!new_arr)
+		return false;
+
+	*arr = new_arr;
+	*cap = new_cap;
+
+	return true;
+}
+
+// collect a device and its interfaces that are evaluated, used for the serial and the parallel scan
+static bool scan_device(struct scan *scan, const char *usb_device) {
+	struct device_list intfs;
+	struct scan_dev *dev = NULL;
 	unsigned dev_class = 0;
-	const char *plugpath = NULL;
+	unsigned i;
 
-	if (plug_usb_device)
-		plugpath = udev_device_get_syspath(plug_usb_device);
+	if (!usb_device)
+		return false;
 
-	if (!path || !type)
-		return;
+	if (plug_usb_device && strcmp(usb_device, plug_usb_device) == 0)
+		return false;
 
-	if (plugpath && strcmp(path, plugpath) == 0)
-		return;
+	if (!scan_grow((void**) &scan->devs, &scan->dev_cap, scan->dev_len, sizeof(struct scan_dev)))
+		return false;
 
-	if (strcmp(type, "usb_device") != 0)
-		return;
+	if (!device_enumerate(usb_device, "usb_interface", &intfs))
+		return false;
 
-	enumerate = udev_enumerate_new(udev);
+	dev = &scan->devs[scan->dev_len];
+	dev->device = strdup(usb_device);
+	dev->first = scan->intf_len;
+	dev->len = 0;
+	dev->removed = false;
 
-	if (!enumerate)
-		return;
+	if (!dev->device) {
+		device_list_free(&intfs);
+		return false;
+	}
+
+	scan->dev_len++;
+	dev_class = device_get_param_val(bDeviceClass, usb_device);
+
+	// iterate over the childs (usb_interface's) of the usb_device
+	for (i = 0; i < intfs.len; i++) {
+		struct scan_intf *intf = NULL;
+
+		// dev class is HUB and intf class is not HUB
+		// skip device childs from hubs, use only hub's interfaces
+		if (dev_class == 9 && device_get_param_val(bInterfaceClass, intfs.paths[i]) != 9)
+			continue;
+
+		if (!scan_grow((void**) &scan->intfs, &scan->intf_cap, scan->intf_len, sizeof(struct scan_intf)))
+			continue;
+
+		// the list's string is taken over
+		intf = &scan->intfs[scan->intf_len++];
+		memset(intf, 0, sizeof(struct scan_intf));
+		intf->interface = intfs.paths[i];
+		intf->item.syspath = intf->interface;
+		intfs.paths[i] = NULL;
+		dev->len++;
+	}
+
+	device_list_free(&intfs);
+
+	return true;
+}
+
+// read the snapshots of all collected interfaces, libudev is not used by the threads
+static void scan_prefetch(struct scan *scan, unsigned threads) {
+	struct prefetch_item **items = NULL;
+	uint64_t start = 0;
+	unsigned i;
 
-	udev_enumerate_add_match_parent(enumerate, usb_device);
-	udev_enumerate_scan_devices(enumerate);
-	devices = udev_enumerate_get_list_entry(enumerate);
+	if (scan->intf_len)
+		items = calloc(scan->intf_len, sizeof(struct prefetch_item*));
 
-	if (!devices)
+	if (!items)
 		return;
 
-	dev_class = usbauth_get_param_val(bDeviceClass, usb_device);
+	for (i = 0; i < scan->intf_len; i++)
+		items[i] = &scan->intfs[i].item;
+
+	start = profile_begin();
+	prefetch_snapshots(items, scan->intf_len, rule_params, threads);
+	profile_end(PHASE_SYSFS, start);
+	free(items);
+}
+
+// an interface that is not authorized, example created by the gate while no daemon was running
+static bool interface_unauthorized(const char *usb_interface) {
+	char val[16];
+
+	return device_read_attr(usb_interface, "authorized", val, sizeof(val)) && strcmp(val, "0") == 0;
+}
+
+// the devices at the ports of a denied hub interface are disconnected by the kernel, a serial pass would not see them
+static void scan_remove_below(struct scan *scan, unsigned current, const char *hub) {
+	size_t len = strlen(hub);
+	unsigned i;
+
+	for (i = current + 1; i < scan->dev_len; i++) {
+		if (strncmp(scan->devs[i].device, hub, len) == 0 && scan->devs[i].device[len] == '/')
+			scan->devs[i].removed = true;
+	}
+}
+
+// a hub interface that is denied by its written decision
+static bool scan_denies_hub(const struct scan_intf *intf) {
+	return intf->write && intf->r.match && !intf->r.allowed && device_get_param_val(bInterfaceClass, intf->interface) == 9;
+}
+
+// evaluate the interfaces in the same order as a serial scan, so the counts are equal
+static void scan_evaluate(struct Auth *rule_array, size_t array_len, struct scan *scan) {
+	char parent[PATH_MAX];
+	unsigned i, j;
 
-	if (!iscounted)
-		iscounted = calloc(array_len, sizeof(bool));
+	siblings_reset();
 
-	// iterate over the childs (usb_interface's) of the udevdev (usb_device)
-	udev_list_entry_foreach(entry, devices)
-	{
-		const char *path = NULL;
-		struct udev_device *interface = NULL;
-		const char *type = NULL;
+	for (i = 0; i < scan->dev_len; i++) {
+		struct scan_dev *dev = &scan->devs[i];
 
-		if (entry)
-			path = udev_list_entry_get_name(entry);
+		// the device is neither counted nor authorized
+		if (dev->removed)
+			continue;
 
-		if (path)
-			interface = udev_device_new_from_syspath(udev, path);
+		counts_begin_device(rule_array, array_len, dev->device);
 
-		if (interface)
-			type = udev_device_get_devtype(interface);
+		for (j = dev->first; j < dev->first + dev->len; j++) {
+			struct scan_intf *intf = &scan->intfs[j];
 
-		if (type && strcmp(type, "usb_interface") == 0) {
-			unsigned intf_class = usbauth_get_param_val(bInterfaceClass, interface);
-			struct auth_ret r;
+			// read_attr of the backend is only used if its snapshot_fill has failed
+			if (!intf->item.filled)
+				device_snapshot_fill(&intf->item.snap, intf->interface);
 
-			if (dev_class == 9 && intf_class != 9) // dev class is HUB and intf class is not HUB
-				continue; // skip device childs from hubs, use only hub's interfaces
+			intf->r = match_auths_interface_snapshot(rule_array, array_len, intf->interface, &intf->item.snap);
+			counts_commit_interface(device_sysname(intf->interface));
 
-			r = match_auths_interface(rule_array, array_len, interface);
+			intf->write = scan->apply && (!scan->unauthorized_only || interface_unauthorized(intf->interface));
 
-			// do only if one rule has matched, so if there would no generic rule and no specific rule do nothing
-			// now it's the correct device (if plug is set it's only initialization)
-			// do not authorize interfaces and do not send dbus messages multiple times
-			if (r.match && !plug_usb_device)
-				authorize_interface(interface, r.allowed, true);
+			// the following devices are evaluated with the counts of a serial pass, a hub's list has nested hub interfaces,
+			// so the devices below the interface's own hub are removed
+			if (scan_denies_hub(intf) && device_parent(intf->interface, parent, sizeof(parent)))
+				scan_remove_below(scan, i, parent);
 		}
 
-		if (interface)
-			udev_device_unref(interface);
+		// if multiple interfaces are counted by an rule count only once for device
+		counts_end_device(rule_array, array_len);
+
+		if (debuglog)
+			syslog(LOG_DEBUG, "match_auths_device_interfaces plug=%s path=%s\n", plug_usb_device ? "true" : "false", dev->device);
 	}
+}
+
+// allow or deny the evaluated interfaces, device by device, as selected by scan_evaluate
+static void scan_apply(struct scan *scan) {
+	unsigned i, j;
+
+	for (i = 0; i < scan->dev_len; i++) {
+		struct scan_dev *dev = &scan->devs[i];
+		bool authorized = false;
+
+		if (dev->removed)
+			continue;
+
+		for (j = dev->first; j < dev->first + dev->len; j++) {
+			struct scan_intf *intf = &scan->intfs[j];
+
+			if (!intf->write)
+				continue;
 
-	// if multiple interfaces are counted by an rule count only once for device
-	if (iscounted) {
-		unsigned i;
-		for (i=0; i<array_len; i++) {
-			if (iscounted[i])
-				rule_array[i].devcount++;
+			metrics_decision(&intf->r);
+
+			if (apply_decision(intf->interface, &intf->r, &intf->item.snap))
+				authorized = true;
 		}
-		free(iscounted);
-		iscounted = NULL;
+
+		// probe all device's childs once after all interfaces are authorized
+		// to avoid side-effects with drivers that need multiple interfaces
+		if (authorized)
+			probe_device(dev->device);
 	}
 
-	udev_enumerate_unref(enumerate);
+	// one signal per device
+	send_dbus_pending();
+}
 
-	if (debuglog)
-		syslog(LOG_DEBUG, "match_auths_device_interfaces plug=%s path=%s\n", plug_usb_device ? "true" : "false", path);
+static void scan_free(struct scan *scan) {
+	unsigned i;
+
+	for (i = 0; i < scan->intf_len; i++)
+		free(scan->intfs[i].interface);
+
+	for (i = 0; i < scan->dev_len; i++)
+		free(scan->devs[i].device);
+
+	free(scan->intfs);
+	free(scan->devs);
+	memset(scan, 0, sizeof(struct scan));
 }
 
-void perform_rules_devices(struct Auth *rule_array, size_t array_len, bool add) {
-	struct udev_enumerate *enumerate;
-	struct udev_list_entry *devices, *entry;
+void match_auths_device_interfaces(struct Auth *rule_array, size_t array_len, const char *usb_device, bool authorize) {
+	struct scan scan;
 
-	enumerate = udev_enumerate_new(udev);
+	memset(&scan, 0, sizeof(scan));
 
-	if (!enumerate)
-		return;
+	device_flush();
+	scan.apply = authorize;
+
+	if (scan_device(&scan, usb_device)) {
+		scan_prefetch(&scan, 1);
+		scan_evaluate(rule_array, array_len, &scan);
+
+		// without authorize it's only counting, example: other devices than the plugged one
+		// do not authorize interfaces and do not send dbus messages multiple times
+		if (authorize)
+			scan_apply(&scan);
+	}
+
+	scan_free(&scan);
+}
 
-	udev_enumerate_add_match_subsystem(enumerate, "usb");
-	udev_enumerate_scan_devices(enumerate);
-	devices = udev_enumerate_get_list_entry(enumerate);
+static void scan_devices(struct Auth *rule_array, size_t array_len, bool add, bool unauthorized_only) {
+	struct device_list devs;
+	struct scan scan;
+	unsigned i;
 
-	if (!devices)
+	// the values of earlier reads are not used, the devices could have been replaced since them
+	device_flush();
+
+	if (!device_enumerate(NULL, "usb_device", &devs))
+		return;
+
+	if (!devs.len) {
+		device_list_free(&devs);
 		return;
+	}
 
 	syslog(LOG_NOTICE, "perform rules for devices (add=%s)\n", add ? "true" : "false");
 
-	// iterate over all USB devices
-	udev_list_entry_foreach(entry, devices)
-	{
-		const char *path = NULL;
-		struct udev_device *udevdev = NULL;
-		const char *type = NULL;
+	memset(&scan, 0, sizeof(scan));
+	scan.apply = add;
+	scan.unauthorized_only = unauthorized_only;
 
-		if (entry)
-			path = udev_list_entry_get_name(entry);
+	// collect all USB devices and their interfaces
+	for (i = 0; i < devs.len; i++)
+		scan_device(&scan, devs.paths[i]);
 
-		if (path)
-			udevdev = udev_device_new_from_syspath(udev, path);
+	device_list_free(&devs);
 
-		if (udevdev)
-			type = udev_device_get_devtype(udevdev);
+	// the sysfs reads are done in parallel, the evaluation is serial because of the counts
+	scan_prefetch(&scan, prefetch_threads());
+	scan_evaluate(rule_array, array_len, &scan);
 
-		if (type && strcmp(type, "usb_device") == 0) // filter out interfaces, to avoid multiple iterations
-			match_auths_device_interfaces(rule_array, array_len, udevdev);
+	if (add)
+		scan_apply(&scan);
 
-		if (udevdev)
-			udev_device_unref(udevdev);
-	}
+	scan_free(&scan);
+}
 
-	udev_enumerate_unref(enumerate);
+void perform_rules_devices(struct Auth *rule_array, size_t array_len, bool add) {
+	scan_devices(rule_array, array_len, add, false);
+}
+
+void perform_rules_unauthorized(struct Auth *rule_array, size_t array_len) {
+	scan_devices(rule_array, array_len, true, true);
+}
+
+void perform_interface(struct Auth *auths, size_t length, const char *intf) {
+	char parent[PATH_MAX];
+	struct Snapshot snap;
+	struct auth_ret r;
+
+	if (!device_parent(intf, parent, sizeof(parent)))
+		return;
+
+	device_flush();
+	snapshot_read(&snap, intf);
+	siblings_reset();
+
+	// the counts of the interface's device are excluded during the evaluation
+	counts_begin_device(auths, length, parent);
+	r = match_auths_interface_snapshot(auths, length, intf, &snap);
+	counts_commit_interface(device_sysname(intf));
+	counts_end_device(auths, length);
+
+	metrics_decision(&r);
+
+	// the device is probed and the signal is sent by the caller, so the daemon does it once for multiple interfaces
+	if (apply_decision(intf, &r, &snap))
+		probe_device_later(parent);
+}
+
+void perform_interface_add(struct Auth *auths, size_t length, const char *intf) {
+	char parent[PATH_MAX];
+
+	plug_usb_device = device_parent(intf, parent, sizeof(parent)); // set parent of interface (device)
+	perform_rules_devices(auths, length, false); // plug device will excluded
+	plug_usb_device = NULL; // to work with excluded device
+
+	perform_interface(auths, length, intf);
+	probe_devices_pending();
+	send_dbus_pending();
 }
 
 void perform_udev_env(struct Auth *auths, size_t length, bool add) {
@@ -611,60 +1212,599 @@ void perform_udev_env(struct Auth *auths, size_t length, bool add) {
 		type = udev_device_get_devtype(intf);
 
 	if (type && strcmp(type, "usb_interface") == 0) { // use only usb_device's
-		if (add)
-			plug_usb_device = udev_device_get_parent(intf); // set parent of interface (device)
-
 		syslog(LOG_NOTICE, "called by udev with given usb_interface\n");
 
 		if (add) { // only in udev-add mode
-			struct auth_ret r;
-			perform_rules_devices(auths, length, false); // plug device will excluded
-			plug_usb_device = NULL; // to work with excluded device
-			//match_auths_device_interfaces(auths, length, intf); // check plugged (excluded before) device's interfaces now
+			// the latency includes the process start, udev knows when it has seen the interface first
+			metrics_event(METRICS_EVENT_ADD, udev_device_get_usec_since_initialized(intf));
+			perform_interface_add(auths, length, udev_device_get_syspath(intf));
+		}
+	}
+
+	if (intf)
+		udev_device_unref(intf);
+}
+
+static uint32_t anychild_params_of(const struct Auth *auths, unsigned length) {
+	uint32_t ret = 0;
+	unsigned i, j;
+
+	for (i = 0; i < length; i++) {
+		for (j = 0; j < auths[i].attr_len; j++) {
+			if (auths[i].attr_array[j].anyChild)
+				ret |= PARAM_BIT(auths[i].attr_array[j].param);
+		}
+
+		for (j = 0; j < auths[i].cond_len; j++) {
+			if (auths[i].cond_array[j].anyChild)
+				ret |= PARAM_BIT(auths[i].cond_array[j].param);
+		}
+	}
+
+	return ret;
+}
+
+static bool data_reads_intfcount(const struct Data *arr, unsigned len) {
+	unsigned i;
+
+	for (i = 0; i < len; i++) {
+		if (arr[i].param == intfcount)
+			return true;
+	}
+
+	return false;
+}
+
+// rules without intfcount data keep their condition result for the whole interface
+static void cond_counted_prepare(const struct Auth *auths, unsigned length) {
+	unsigned i;
+
+	free(cond_counted);
+	cond_counted = length ? calloc(length, sizeof(bool)) : NULL;
+	cond_counted_len = cond_counted ? length : 0;
+
+	for (i = 0; i < cond_counted_len; i++)
+		cond_counted[i] = data_reads_intfcount(auths[i].attr_array, auths[i].attr_len) || data_reads_intfcount(auths[i].cond_array, auths[i].cond_len);
+}
+
+void rules_prepare(struct Auth *auths, unsigned length) {
+	index_free(rule_index);
+	rule_index = index_build(auths, length);
+	rule_params = usbauth_auths_params(auths, length);
+	rule_params |= dcache_prepare(auths, length); // the parameters of the keys
+	anychild_params = anychild_params_of(auths, length);
+	cond_counted_prepare(auths, length);
+	siblings_reset();
+	counts_clear();
+
+	// the notifier gets the parameters that are read for the evaluation
+	if (bus)
+		rule_params |= PARAM_BITS_NOTIFY;
+
+	profile_clear_rules();
+}
+
+void rules_release() {
+	counts_clear();
+	index_free(rule_index);
+	rule_index = NULL;
+	rule_params = PARAM_BITS_SYSFS;
+	anychild_params = 0;
+	siblings_free();
+	free(cond_memo);
+	cond_memo = NULL;
+	cond_memo_len = 0;
+	free(cond_counted);
+	cond_counted = NULL;
+	cond_counted_len = 0;
+}
+
+bool daemon_running() {
+	bool ret = false;
+	int fd = open(LOCK_FILE, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+		return false;
+
+	// the daemon holds an exclusive lock as long as it is running
+	if (flock(fd, LOCK_SH | LOCK_NB) && errno == EWOULDBLOCK)
+		ret = true;
+
+	close(fd);
+
+	return ret;
+}
+
+void daemon_reload(struct Auth **auths, unsigned *length) {
+	struct Auth *new_auths = NULL;
+	unsigned new_length = 0;
+
+	if (usbauth_config_read()) {
+		syslog(LOG_ERR, "error at parsing usbauth configuration file, keep previous rules\n");
+		return;
+	}
+
+	usbauth_config_get_auths(&new_auths, &new_length);
+
+	if (!isRule(new_auths, new_length)) {
+		syslog(LOG_ERR, "config file not found or empty, keep previous rules\n");
+		usbauth_config_free_auths(new_auths, new_length);
+		return;
+	}
+
+	usbauth_config_free_auths(*auths, *length);
+	*auths = new_auths;
+	*length = new_length;
+
+	metrics_event(METRICS_EVENT_RELOAD, 0);
+
+	// the rule indices changed, so count the available devices again
+	rules_prepare(*auths, *length);
+	perform_rules_devices(*auths, *length, false);
+
+	syslog(LOG_NOTICE, "reloaded usbauth configuration file (%u rules)\n", new_length);
+}
+
+void daemon_udev_event(struct Auth *auths, size_t length, struct udev_device *udevdev) {
+	const char *action = udev_device_get_action(udevdev);
+	const char *type = udev_device_get_devtype(udevdev);
+	const char *path = udev_device_get_syspath(udevdev);
+	char parent[PATH_MAX];
+
+	if (!action || !type || !path)
+		return;
+
+	device_flush();
+
+	if (strcmp(type, "usb_device") == 0) {
+		if (strcmp(action, "add") == 0 && gating) {
+			gate_hub(path); // a new host controller
+		} else if (strcmp(action, "remove") == 0) {
+			metrics_event(METRICS_EVENT_REMOVE, 0);
+			counts_remove_device(auths, length, path);
+		}
+	} else if (strcmp(type, "usb_interface") == 0) {
+		if (strcmp(action, "add") == 0) {
+			syslog(LOG_NOTICE, "daemon received usb_interface %s\n", path);
+			metrics_event(METRICS_EVENT_ADD, udev_device_get_usec_since_initialized(udevdev));
+			perform_interface(auths, length, path);
+		} else if (strcmp(action, "remove") == 0 && device_parent(path, parent, sizeof(parent))) {
+			metrics_event(METRICS_EVENT_REMOVE, 0);
+			counts_remove_interface(auths, length, parent, udev_device_get_sysname(udevdev));
+		}
+	}
+}
+
+// the same group as in the D-Bus policy, its members are allowed to run the notifier
+static bool daemon_dbus_uid_is_notifier(uint32_t uid) {
+	struct passwd *pw = NULL;
+	struct group *gr = NULL;
+	gid_t *groups = NULL;
+	gid_t gid = 0;
+	char *name = NULL;
+	int ngroups = 16;
+	bool ret = false;
+	int i;
+
+	if (uid == 0)
+		return true;
+
+	pw = getpwuid(uid);
+	gr = getgrnam(NOTIFIER_GROUP);
+
+	if (!pw || !gr)
+		return false;
+
+	// getgrouplist could overwrite the static buffers of getpwuid and getgrnam
+	gid = gr->gr_gid;
+	name = strdup(pw->pw_name);
+
+	if (!name)
+		return false;
+
+	groups = malloc(ngroups * sizeof(gid_t));
+
+	// at a too small array ngroups is set to the needed size
+	if (groups && getgrouplist(name, pw->pw_gid, groups, &ngroups) < 0) {
+		gid_t *arr = realloc(groups, ngroups * sizeof(gid_t));
+
+		if (arr)
+			groups = arr;
+
+		if (!arr || getgrouplist(name, pw->pw_gid, groups, &ngroups) < 0)
+			ngroups = 0;
+	}
+
+	for (i = 0; groups && i < ngroups && !ret; i++)
+		ret = groups[i] == gid;
+
+	free(groups);
+	free(name);
+
+	return ret;
+}
+
+// called with the reply of GetConnectionUnixUser, the call is decided and answered now
+static void daemon_dbus_authorize_checked(DBusPendingCall *pending, void *user_data) {
+	DBusMessage *msg = user_data;
+	DBusMessage *uid_reply = dbus_pending_call_steal_reply(pending);
+	DBusMessage *reply = NULL;
+	DBusError error;
+	dbus_bool_t allow = false;
+	int32_t devn = -1;
+	uint32_t uid = 0;
+	const char *path = NULL;
+	const char *sender = dbus_message_get_sender(msg);
+	bool known = false;
+
+	dbus_error_init(&error);
+
+	if (uid_reply) {
+		known = dbus_message_get_args(uid_reply, &error, DBUS_TYPE_UINT32, &uid, DBUS_TYPE_INVALID);
+		no_error_check_dbus(&error);
+		dbus_message_unref(uid_reply);
+	}
+
+	// the arguments were already checked by daemon_dbus_authorize
+	dbus_message_get_args(msg, NULL, DBUS_TYPE_BOOLEAN, &allow, DBUS_TYPE_INT32, &devn, DBUS_TYPE_STRING, &path, DBUS_TYPE_INVALID);
+
+	if (!known || !daemon_dbus_uid_is_notifier(uid)) {
+		syslog(LOG_ERR, "Authorize call from %s denied, the caller is not in group %s\n", sender ? sender : "", NOTIFIER_GROUP);
+		reply = dbus_message_new_error(msg, DBUS_ERROR_ACCESS_DENIED, "the caller is not allowed to run the notifier");
+	} else if (!authorize_by_notifier(allow, devn, path)) {
+		reply = dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS, "no interface with this path and devnum");
+	} else {
+		reply = dbus_message_new_method_return(msg);
+	}
+
+	if (reply && bus) {
+		dbus_connection_send(bus, reply, NULL);
+		dbus_message_unref(reply);
+	} else if (reply) {
+		dbus_message_unref(reply);
+	}
+}
+
+void daemon_dbus_authorize(DBusMessage *msg) {
+	DBusMessage *reply = NULL;
+	DBusMessage *call = NULL;
+	DBusPendingCall *pending = NULL;
+	DBusError error;
+	dbus_bool_t allow = false;
+	int32_t devn = -1;
+	const char *path = NULL;
+	const char *sender = dbus_message_get_sender(msg);
 
-			r = match_auths_interface(auths, length, intf);
+	dbus_error_init(&error);
 
-			// do only if one rule has matched, so if there would no generic rule and no specific rule do nothing
-			if (r.match)
-				authorize_interface(intf, r.allowed, true);
+	if (!dbus_message_get_args(msg, &error, DBUS_TYPE_BOOLEAN, &allow, DBUS_TYPE_INT32, &devn, DBUS_TYPE_STRING, &path, DBUS_TYPE_INVALID)) {
+		reply = dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS, error.message);
+		no_error_check_dbus(&error);
+	} else if (sender) {
+		// the uid of the caller is asked from the bus without blocking the daemon, the bus knows it from the socket
+		call = dbus_message_new_method_call(DBUS_SERVICE_DBUS, DBUS_PATH_DBUS, DBUS_INTERFACE_DBUS, "GetConnectionUnixUser");
+
+		if (call && dbus_message_append_args(call, DBUS_TYPE_STRING, &sender, DBUS_TYPE_INVALID)
+				&& dbus_connection_send_with_reply(bus, call, &pending, DBUS_CALL_TIMEOUT) && pending) {
+			if (!dbus_pending_call_set_notify(pending, daemon_dbus_authorize_checked, dbus_message_ref(msg), (DBusFreeFunction) dbus_message_unref))
+				dbus_pending_call_cancel(pending);
+			dbus_pending_call_unref(pending);
+		} else {
+			reply = dbus_message_new_error(msg, DBUS_ERROR_FAILED, "cannot check the caller");
 		}
+
+		if (call)
+			dbus_message_unref(call);
+	} else {
+		reply = dbus_message_new_error(msg, DBUS_ERROR_ACCESS_DENIED, "the caller is unknown");
+	}
+
+	if (reply) {
+		dbus_connection_send(bus, reply, NULL);
+		dbus_message_unref(reply);
+	}
+}
+
+static bool bus_connected = true;
+
+// every message of the daemon's connection, the replies of the pending calls are handled by libdbus
+static DBusHandlerResult daemon_dbus_filter(DBusConnection *connection, DBusMessage *msg, void *user_data) {
+	if (dbus_message_is_signal(msg, DBUS_INTERFACE_LOCAL, "Disconnected")) {
+		bus_connected = false;
+		return DBUS_HANDLER_RESULT_HANDLED;
+	}
+
+	if (dbus_message_is_method_call(msg, "org.opensuse.usbauth", "Authorize")) {
+		daemon_dbus_authorize(msg);
+		return DBUS_HANDLER_RESULT_HANDLED;
+	}
+
+	return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+}
+
+bool daemon_dbus_event() {
+	if (!dbus_connection_read_write(bus, 0))
+		return false;
+
+	// the daemon serves the Authorize method and watches for a lost bus connection
+	while (bus_connected && dbus_connection_dispatch(bus) == DBUS_DISPATCH_DATA_REMAINS)
+		;
+
+	// send the replies and the calls without blocking, the messages read meanwhile are not signaled by epoll again
+	if (bus_connected && dbus_connection_has_messages_to_send(bus)) {
+		dbus_connection_read_write(bus, 0);
+
+		while (bus_connected && dbus_connection_dispatch(bus) == DBUS_DISPATCH_DATA_REMAINS)
+			;
 	}
+
+	return bus_connected;
+}
+
+// the timeout of epoll_wait: the metrics are flushed in time and unsent dbus messages are retried
+static int daemon_timeout() {
+	int timeout = metrics_flush_timeout();
+
+	if (bus && dbus_connection_has_messages_to_send(bus) && (timeout < 0 || timeout > DBUS_RETRY_TIMEOUT))
+		timeout = DBUS_RETRY_TIMEOUT;
+
+	return timeout;
+}
+
+int perform_daemon(struct Auth **auths, unsigned *length) {
+	int ret = -1;
+	int lockfd = -1;
+	int sigfd = -1;
+	int epfd = -1;
+	int busfd = -1;
+	bool work = true;
+	bool locked = false;
+	char pidStr[16];
+	sigset_t mask;
+	struct epoll_event ev;
+	struct udev_monitor *monitor = NULL;
+
+	// checked before anything is set up, the lock is taken after the first scan
+	if (daemon_running()) {
+		syslog(LOG_ERR, "usbauth daemon is already running\n");
+		return -1;
+	}
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGHUP);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+	monitor = udev_monitor_new_from_netlink(udev, "udev");
+	if (monitor) {
+		udev_monitor_filter_add_match_subsystem_devtype(monitor, "usb", "usb_interface");
+		udev_monitor_filter_add_match_subsystem_devtype(monitor, "usb", "usb_device");
+		if (udev_monitor_enable_receiving(monitor)) {
+			udev_monitor_unref(monitor);
+			monitor = NULL;
+		}
+	}
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+
+	if (sigfd < 0 || !monitor || epfd < 0) {
+		syslog(LOG_ERR, "cannot set up daemon event sources\n");
+		goto out;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+
+	ev.data.fd = sigfd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, sigfd, &ev);
+
+	ev.data.fd = udev_monitor_get_fd(monitor);
+	epoll_ctl(epfd, EPOLL_CTL_ADD, ev.data.fd, &ev);
+
+	if (bus && dbus_connection_get_unix_fd(bus, &busfd)) {
+		ev.data.fd = busfd;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, busfd, &ev);
+
+		// a lost bus only disables the notifications, the messages are dispatched to daemon_dbus_filter
+		dbus_connection_set_exit_on_disconnect(bus, false);
+		dbus_connection_add_filter(bus, daemon_dbus_filter, NULL, NULL);
+	}
+
+	// the monitor is already receiving, so every interface created unauthorized by the gate is seen by the daemon
+	if (gating && !gate_init(GATE_DIR))
+		syslog(LOG_WARNING, "the kernel has no interface_authorized_default, interfaces are not gated\n");
+
+	// count the available devices once, later the counts are updated at add and remove
+	// the interfaces that are still not authorized were created before the monitor, example by a killed gated daemon
+	perform_rules_unauthorized(*auths, *length);
+
+	// until now udev-add also decides new interfaces, after it the monitor's queue holds every interface added since the scan
+	lockfd = open(LOCK_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (lockfd < 0 || flock(lockfd, LOCK_EX | LOCK_NB)) {
+		syslog(LOG_ERR, "usbauth daemon is already running or %s is not accessible\n", LOCK_FILE);
+
+		// another daemon has started meanwhile, its gate is kept
+		gate_release();
+		goto out;
+	}
+
+	locked = true;
+	snprintf(pidStr, sizeof(pidStr), "%d\n", (int) getpid());
+	if (ftruncate(lockfd, 0) || write(lockfd, pidStr, strlen(pidStr)) < 0)
+		syslog(LOG_WARNING, "cannot write pid to %s\n", LOCK_FILE);
+
+	// the notifier calls the Authorize method of this name
+	if (bus)
+		request_name_dbus();
+
+	syslog(LOG_NOTICE, "usbauth daemon started\n");
+
+	while (work) {
+		struct epoll_event events[4];
+		bool dbus_event = false;
+		int i;
+		int n = epoll_wait(epfd, events, sizeof(events)/sizeof(events[0]), daemon_timeout());
+
+		// the metrics are written at most once per second, also during hotplug storms
+		if (metrics_flush_timeout() == 0)
+			metrics_flush();
+
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		if (n < 0) {
+			syslog(LOG_ERR, "epoll_wait error\n");
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			int fd = events[i].data.fd;
+
+			if (fd == sigfd) {
+				struct signalfd_siginfo si;
+
+				while (read(sigfd, &si, sizeof(si)) == sizeof(si)) {
+					if (si.ssi_signo == SIGHUP)
+						daemon_reload(auths, length);
+					else
+						work = false;
+				}
+			} else if (fd == busfd) {
+				dbus_event = true;
+			} else {
+				struct udev_device *udevdev = NULL;
+
+				while ((udevdev = udev_monitor_receive_device(monitor))) {
+					daemon_udev_event(*auths, *length, udevdev);
+					udev_device_unref(udevdev);
+				}
+
+				// probe the devices and send the signals once after all queued interfaces are authorized
+				probe_devices_pending();
+				send_dbus_pending();
+			}
+		}
+
+		// incoming calls and the queued signals are handled together
+		if (bus && (dbus_event || dbus_connection_has_messages_to_send(bus)) && !daemon_dbus_event()) {
+			syslog(LOG_ERR, "lost dbus connection, notifications disabled\n");
+			epoll_ctl(epfd, EPOLL_CTL_DEL, busfd, NULL);
+			dbus_connection_unref(bus);
+			bus = NULL;
+			bus_named = false;
+			busfd = -1;
+		}
+	}
+
+	syslog(LOG_NOTICE, "usbauth daemon stopped\n");
+	ret = 0;
+
+out:
+	// the kernel authorizes new interfaces again if no daemon is running
+	gate_restore();
+
+	if (epfd >= 0)
+		close(epfd);
+
+	if (monitor)
+		udev_monitor_unref(monitor);
+
+	if (sigfd >= 0)
+		close(sigfd);
+
+	// the file of a running daemon is not removed
+	if (locked)
+		unlink(LOCK_FILE);
+
+	if (lockfd >= 0)
+		close(lockfd);
+
+	return ret;
+}
+
+bool authorize_by_notifier(bool allow, int32_t devn, const char *path) {
+	char interface[PATH_MAX];
+	char parent[PATH_MAX];
+
+	metrics_event(METRICS_EVENT_NOTIFIER, 0);
+
+	// the path is given by the user, example /sys/bus/usb/devices/3-2/3-2:1.0/
+	if (!path || !realpath(path, interface) || !device_is_devtype(interface, "usb_interface"))
+		return false;
+
+	// devnr from parameter list must be the same as from sysfs to ensure the correct device
+	if (device_get_param_val(devnum, interface) != devn)
+		return false;
+
+	authorize_interface(interface, allow, NULL);
+	probe_device(device_parent(interface, parent, sizeof(parent)));
+
+	return true;
 }
 
 void perform_notifier(const char* actionStr, const char* devnumStr, const char* path) {
-	struct udev_device *interface = udev_device_new_from_syspath(udev, path);
 	char* end = NULL;
 	int devn_argv = strtol(devnumStr, &end, 16);
-	int devn_sysfs = -1;
-	const char *type = NULL;
 
 	syslog(LOG_NOTICE, "called by notifier\n");
 
-	if (interface) {
-		devn_sysfs = usbauth_get_param_val(devnum, interface);
-		type = udev_device_get_devtype(interface);
-	}
-
 	// at conversion error do nothing
 	if (end && *end != 0)
-		type = NULL;
-
-	// devnr from parameter list must be the same as from sysfs to ensure the correct device
-	if (type && strcmp(type, "usb_interface") == 0 && devn_sysfs == devn_argv) {
-		bool allw = strcmp(actionStr, "allow") == 0 ? true : false;
+		return;
 
-		authorize_interface(interface, allw, false);
-		udev_device_unref(interface);
-	}
+	authorize_by_notifier(strcmp(actionStr, "allow") == 0, devn_argv, path);
 }
 
+#ifndef USBAUTH_BENCH
+static FILE *logfile = NULL;
+
 int main(int argc, char **argv) {
+	int ret = EXIT_SUCCESS;
 	unsigned length = 0;
 	struct Auth *auths = NULL;
 	DBusError error;
+	uint64_t start = 0;
+	int opt = 0;
+
+	// the options are given before the mode, example: usbauth -m daemon
+	while ((opt = getopt(argc, argv, "+gm")) != -1) {
+		if (opt == 'g') {
+			gating = true;
+		} else if (opt == 'm') {
+			if (!metrics_init(METRICS_FILE))
+				syslog(LOG_ERR, "invalid metrics file %s\n", METRICS_FILE);
+		} else {
+			syslog(LOG_ERR, "wrong syntax to call usbauth\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	argc -= optind - 1;
+	argv += optind - 1;
+
+	// profile mode runs the following command and prints the timings to stdout
+	if (argc >= 2 && strcmp(argv[1], "profile") == 0) {
+		profiling = true;
+		argc--;
+		argv++;
+	}
+
+	// the gate needs a process that authorizes the interfaces until it is restored
+	if (gating && (argc != 2 || strcmp(argv[1], "daemon") != 0)) {
+		syslog(LOG_WARNING, "option -g is only used in daemon mode\n");
+		gating = false;
+	}
+
+	// a running daemon already handles the udev events
+	if (!profiling && argc == 2 && strcmp(argv[1], "udev-add") == 0 && daemon_running())
+		return EXIT_SUCCESS;
 
 	dbus_error_init(&error);
+	start = profile_begin();
 	bus = dbus_bus_get(DBUS_BUS_SYSTEM, &error);
+	profile_end(PHASE_DBUS, start);
 
 	udev = udev_new();
 
@@ -673,6 +1813,8 @@ int main(int argc, char **argv) {
 		return EXIT_FAILURE;
 	}
 
+	device_use_udev(udev);
+
 	// connect to syslog
 	openlog("usbauth", LOG_PERROR | LOG_PID, LOG_LOCAL0);
 
@@ -686,13 +1828,30 @@ int main(int argc, char **argv) {
 		bus = NULL;
 	}
 
+	// called by the service manager after the daemon has stopped, the config is not needed
+	if (argc == 2 && strcmp(argv[1], "gate-restore") == 0) {
+		ret = gate_restore_recorded(GATE_DIR) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+		if (bus)
+			dbus_connection_unref(bus);
+
+		device_flush();
+		udev_unref(udev);
+		closelog();
+
+		return ret;
+	}
+
+	start = profile_begin();
 	if (usbauth_config_read())
 		 syslog(LOG_ERR, "error at parsing usbauth configuration file\n");
 
 	usbauth_config_get_auths(&auths, &length);
+	profile_end(PHASE_CONFIG, start);
 
-	if (!iscounted)
-		iscounted = calloc(length, sizeof(bool));
+	// without the directory the decisions are not cached
+	dcache_init(DCACHE_FILE);
+	rules_prepare(auths, length);
 
 	if (!isRule(auths, length)) {
 		syslog(LOG_ERR, "Config file not found or empty.\n");
@@ -702,7 +1861,11 @@ int main(int argc, char **argv) {
 		if (strcmp(argv[1], "udev-add") == 0) { // called by udev
 			perform_udev_env(auths, length, true);
 		} else if (strcmp(argv[1], "init") == 0) { // called manually with init parameter
+			metrics_event(METRICS_EVENT_INIT, 0);
 			perform_rules_devices(auths, length, true);
+		} else if (strcmp(argv[1], "daemon") == 0) { // called by service manager
+			if (perform_daemon(&auths, &length))
+				ret = EXIT_FAILURE;
 		}
 	} else if (argc > 2 && (strcmp(argv[1], "allow") == 0 || strcmp(argv[1], "deny") == 0)) { // called by notifier
 		perform_notifier(argv[1], argv[2], argv[3]);
@@ -710,17 +1873,30 @@ int main(int argc, char **argv) {
 		syslog(LOG_ERR, "wrong syntax to call usbauth\n");
 	}
 
+	profile_report(stdout, auths, length);
+	profile_free();
+
+	if (metrics_enabled)
+		metrics_flush();
+	metrics_free();
+
 	if (bus) {
+		// the signals are only queued by send_dbus_pending
+		dbus_connection_flush(bus);
 		dbus_connection_unref(bus);
 		bus = NULL;
 	}
 
+	device_flush();
 	udev_unref(udev);
 	udev = NULL;
+	rules_release();
+	dcache_free();
 	usbauth_config_free_auths(auths, length);
 
 	// disconnect from syslog
 	closelog();
 
-	return EXIT_SUCCESS;
+	return ret;
 }
+#endif /* USBAUTH_BENCH */
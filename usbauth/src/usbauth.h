@@ -30,6 +30,13 @@
 #include <libudev.h>
 #include <dbus/dbus.h>
 
+extern struct udev *udev;
+extern DBusConnection *bus;
+
+/*
+ * The devices are identified by their syspath and accessed through the backend of usbauth-device.h,
+ * libudev is only used for the udev environment and the udev monitor.
+ */
 
 /**
  * checks string constraint
@@ -77,27 +84,42 @@ bool match_valsInt(int lval, enum Operator op, int rval);
  */
 bool match_vals(const char *lvalStr, enum Operator op, const char *rvalStr);
 
+/**
+ * checks constraint with a parsed rule value
+ * uses the compare type of the data structure, so the rule value is not converted again
+ *
+ * lval op rval
+ * examlpe: 01 <= 02 : return true
+ *
+ * @lvalStr: left value from sysfs
+ * @lval: left value converted from hex, -1 if not convertable
+ * @d: data structure with operator and right value (rval)
+ *
+ * return: true if constraint is matched, false if lvalStr is NULL
+ */
+bool match_vals_data(const char *lvalStr, int lval, const struct Data *d);
+
 /**
  * checks if constraint from rule and data matches for an interface
  *
  * @rule: rule to check including left value (lval)
  * @d: data structure with param and right value (rval)
- * @interface: udev_device from type "usb_interface"
+ * @snap: snapshot of the parameters of an usb_interface
  *
  * return: true if constraint is matched
  */
-bool match_vals_interface(struct Auth *rule, struct Data *d, struct udev_device *interface);
+bool match_vals_interface(struct Auth *rule, struct Data *d, const struct Snapshot *snap);
 
 /**
  * checks if constraint from rule and data matches for at minimum one device's interface
  *
  * @rule: rule to check including left value (lval)
  * @d: data structure with param and right value (rval)
- * @device: udev_device from type "usb_device"
+ * @device: syspath of an usb_device
  *
  * return: true if constraint is matched for minimum one device's interface
  */
-bool match_vals_device(struct Auth *rule, struct Data *d, struct udev_device *device);
+bool match_vals_device(struct Auth *rule, struct Data *d, const char *device);
 
 /* check if a device is already processed
  *
@@ -117,39 +139,68 @@ bool device_processed(struct udev_device* dev);
 bool error_check_dbus(DBusError *error);
 
 /**
- * send dbus message to notifier service for interface
+ * request the name org.opensuse.usbauth once per connection
+ *
+ * Return: true if the name is owned
+ */
+bool request_name_dbus();
+
+/**
+ * remember an interface to send it later to the notifier with send_dbus_pending
  *
- * @udevdev: udev_device with type "usb_interface"
+ * @interface: syspath of an usb_interface
  * @authorize: true for allow, false for deny
+ * @snap: parameters of the interface, read for its evaluation
  *
  */
-void send_dbus(struct udev_device *udevdev, int32_t authorize, int32_t devnum);
+void send_dbus_later(const char *interface, bool authorize, const struct Snapshot *snap);
+
+/**
+ * send one signal per device with all interfaces remembered by send_dbus_later
+ * the signals are queued without blocking
+ */
+void send_dbus_pending();
 
 /**
  * probe an interface
  *
- * @udevdev: udev_device with type "usb_interface"
+ * @interface: syspath of an usb_interface
  *
  */
-void probe_interface(struct udev_device *interface);
+void probe_interface(const char *interface);
 
 /**
  * probe all interfaces of a device
  *
- * @udevdev: udev_device with type "usb_device"
+ * @device: syspath of an usb_device
  *
  */
-void probe_device(struct udev_device *udevdev);
+void probe_device(const char *device);
+
+/**
+ * remember a device to probe it later with probe_devices_pending
+ * a device is probed only once for all its authorized interfaces
+ *
+ * @device: syspath of an usb_device
+ *
+ */
+void probe_device_later(const char *device);
+
+/**
+ * probe all devices remembered by probe_device_later
+ */
+void probe_devices_pending();
 
 /**
  * allow or deny an interface
+ * the interface's device must be probed by the caller after all its interfaces are authorized
  *
- * @udevdev: udev_device with type "usb_interface"
+ * @interface: syspath of an usb_interface
  * @authorize: true for allow, false for deny
- * @dbus: if true, notifications would be enabled
+ * @snap: parameters of the interface for the notifier, NULL to send no notification
  *
  */
-void authorize_interface(struct udev_device *udevdev, bool authorize, bool dbus);
+void authorize_interface(const char *interface, bool authorize, const struct Snapshot *snap);
 
 /**
  * checks if there is at least one rule from type ALLOW or DENY
@@ -163,15 +214,42 @@ void authorize_interface(struct udev_device *udevdev, bool authorize, bool dbus)
  */
 bool isRule(struct Auth *array, unsigned array_length);
 
+/**
+ * checks if constraint from rule and data matches for an interface or with anyChild for its siblings
+ *
+ * @rule: rule to check including left value (lval)
+ * @d: data structure with param and right value (rval)
+ * @interface: syspath of an usb_interface
+ * @snap: snapshot of the interface's parameters
+ *
+ * return: true if constraint is matched
+ */
+bool match_data(struct Auth *rule, struct Data *d, const char *interface, const struct Snapshot *snap);
+
 /**
  * checks if an auth rule matches an USB interface
  * @rule: auth rule
- * @interface: udev_device with type "usb_interface"
+ * @interface: syspath of an usb_interface
+ * @snap: snapshot of the interface's parameters
  *
  * Return: match_attrs is true if the interface matches all (case) attributes
  * match_cond is true if the interface matches all condition attributes or has no such condition attributes
  */
-struct match_ret match_auth_interface(struct Auth *a, struct udev_device *udevdev);
+struct match_ret match_auth_interface(struct Auth *a, const char *interface, const struct Snapshot *snap);
+
+/**
+ * checks if a condition matches an USB interface
+ * the result is reused for the same interface as long as the condition's intfcount is unchanged
+ *
+ * @rule_array: auth rules
+ * @array_len: auth rules length
+ * @cond: index of the condition within the auth rules
+ * @interface: syspath of an usb_interface
+ * @snap: snapshot of the interface's parameters
+ *
+ * Return: see match_auth_interface
+ */
+struct match_ret match_cond_interface(struct Auth *rule_array, size_t array_len, unsigned cond, const char *usb_interface, const struct Snapshot *snap);
 
 /**
  * checks if an USB interface matches to all auth rules
@@ -182,12 +260,24 @@ struct match_ret match_auth_interface(struct Auth *a, struct udev_device *udevde
  *
  * @array: auth rules
  * @array_length: auth rules length
- * @interface: udev_device with type "usb_interface"
+ * @interface: syspath of an usb_interface
  *
  * Return: match is true if the interface matches with all rules
  * allowed: true if the interface should be allowed, otherwise false
  */
-struct auth_ret match_auths_interface(struct Auth *array, size_t array_length, struct udev_device *udevdev);
+struct auth_ret match_auths_interface(struct Auth *array, size_t array_length, const char *interface);
+
+/**
+ * like match_auths_interface, but with parameters that are already read
+ *
+ * @array: auth rules
+ * @array_length: auth rules length
+ * @interface: syspath of an usb_interface
+ * @snap: the interface's parameters
+ *
+ * Return: see match_auths_interface
+ */
+struct auth_ret match_auths_interface_snapshot(struct Auth *array, size_t array_length, const char *interface, const struct Snapshot *snap);
 
 /**
  * checks if at minimum one auth rule matches to an USB device
@@ -198,19 +288,52 @@ struct auth_ret match_auths_interface(struct Auth *array, size_t array_length, s
  *
  * @array: auth rules
  * @array_length: auth rules length
- * @usb_device: udev_device with type "usb_device"
+ * @usb_device: syspath of an usb_device
+ * @authorize: true to allow or deny the interfaces, false to update the counts only
  */
-void match_auths_device_interfaces(struct Auth *array, size_t array_length, struct udev_device *usb_device);
+void match_auths_device_interfaces(struct Auth *array, size_t array_length, const char *usb_device, bool authorize);
 
 /**
  * perform rules on all USB devices
  *
+ * The parameters of all interfaces are read in parallel first,
+ * then the interfaces are evaluated in a serial pass and at last allowed or denied.
+ *
  * @rule_array: auth rules
  * @array_length: auth rules length
- * @add: true if udev-add mode, false if udev-remove mode
+ * @add: true to allow or deny the interfaces, false to update the counts only
  */
 void perform_rules_devices(struct Auth *array, size_t array_length, bool add);
 
+/**
+ * count the interfaces of all devices like perform_rules_devices and allow or deny only the interfaces that are not authorized
+ * used at the start of the daemon, so interfaces created while no daemon was running are decided, example by the gate
+ *
+ * @rule_array: auth rules
+ * @array_length: auth rules length
+ */
+void perform_rules_unauthorized(struct Auth *array, size_t array_length);
+
+/**
+ * perform rules for an interface and allow or deny it
+ * the counts of the interface's device are excluded during the evaluation
+ *
+ * @auths: auth rules
+ * @length: auth rules length
+ * @intf: syspath of an usb_interface
+ */
+void perform_interface(struct Auth *auths, size_t length, const char *intf);
+
+/**
+ * perform rules for a new interface
+ * the counters are computed from all other devices before
+ *
+ * @auths: auth rules
+ * @length: auth rules length
+ * @intf: syspath of an usb_interface
+ */
+void perform_interface_add(struct Auth *auths, size_t length, const char *intf);
+
 /**
  * perform rules on udev environment
  *
@@ -220,6 +343,17 @@ void perform_rules_devices(struct Auth *array, size_t array_length, bool add);
  */
 void perform_udev_env(struct Auth *auths, size_t length, bool add);
 
+/**
+ * allow or deny an interface for the notifier, used by the notifier command and the Authorize method
+ *
+ * @allow: true for allow, false for deny
+ * @devn: devnum of interface, must be equal to the devnum from sysfs
+ * @path: path to interface
+ *
+ * Return: true if the interface was found
+ */
+bool authorize_by_notifier(bool allow, int32_t devn, const char *path);
+
 /**
  * perform notifier command
  *
@@ -230,4 +364,71 @@ void perform_udev_env(struct Auth *auths, size_t length, bool add);
  */
 void perform_notifier(const char* action, const char* devnum, const char* path);
 
+/**
+ * use new rules for the evaluation
+ * the rule index is built and the counts are cleared
+ *
+ * @auths: auth rules
+ * @length: auth rules length
+ */
+void rules_prepare(struct Auth *auths, unsigned length);
+
+/**
+ * free the evaluation state of the rules given to rules_prepare()
+ */
+void rules_release();
+
+/**
+ * check if the usbauth daemon is running
+ *
+ * Return: true if the daemon holds the lock file
+ */
+bool daemon_running();
+
+/**
+ * parse the config file again and replace the rules
+ * the previous rules are kept at parsing errors
+ *
+ * @auths: pointer to auth rules (in/out)
+ * @length: pointer to auth rules length (in/out)
+ */
+void daemon_reload(struct Auth **auths, unsigned *length);
+
+/**
+ * handle an uevent received from the udev monitor
+ *
+ * @auths: auth rules
+ * @length: auth rules length
+ * @udevdev: udev_device from the monitor
+ */
+void daemon_udev_event(struct Auth *auths, size_t length, struct udev_device *udevdev);
+
+/**
+ * serve a call of org.opensuse.usbauth.Authorize(boolean allow, int32 devnum, string path)
+ * only root and the members of the group usbauth-notifier are allowed to call it,
+ * their uid is asked from the bus with a pending call, so the reply is sent after it has arrived
+ *
+ * @msg: the method call
+ */
+void daemon_dbus_authorize(DBusMessage *msg);
+
+/**
+ * handle pending dbus traffic of the daemon
+ *
+ * Return: false if the connection to the bus was lost
+ */
+bool daemon_dbus_event();
+
+/**
+ * run as daemon
+ * waits with epoll for udev monitor events, signals and dbus traffic
+ * SIGHUP reloads the config file, SIGINT and SIGTERM stop the daemon
+ *
+ * @auths: pointer to auth rules (in/out)
+ * @length: pointer to auth rules length (in/out)
+ *
+ * Return: 0 at success, -1 at failure
+ */
+int perform_daemon(struct Auth **auths, unsigned *length);
+
 #endif /* USBAUTH_H_ */